@@ -0,0 +1,308 @@
+#include "AsyncFileReader.h"
+
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// max. reads submitted to the kernel at once, anything past this waits in a queue
+static const unsigned RING_ENTRIES = 64;
+
+AsyncFileReader::AsyncFileReader(const std::string& filename, WorkerPool& pool)
+    : filename(filename), pool(pool)
+{
+#ifdef __linux__
+    useIOUring = SetupIOUring();
+    if (useIOUring)
+        reapThread = std::thread(&AsyncFileReader::ReapLoop, this);
+#endif
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+    Wait();
+#ifdef __linux__
+    if (useIOUring)
+    {
+        {
+            std::lock_guard<std::mutex> guard(ringLock);
+            stopping = true;
+        }
+        ringActive.notify_all();
+        reapThread.join();
+    }
+    ShutdownIOUring();
+#endif
+}
+
+bool AsyncFileReader::UsingIOUring() const
+{
+    return useIOUring;
+}
+
+void AsyncFileReader::Read(uint64_t offset, uint32_t length, Callback onComplete)
+{
+    {
+        std::lock_guard<std::mutex> guard(pendingLock);
+        ++pending;
+    }
+
+    Request request;
+    request.offset = offset;
+    request.buffer = std::make_shared<std::vector<uint8_t>>(length);
+    request.onComplete = std::move(onComplete);
+
+#ifdef __linux__
+    if (useIOUring)
+    {
+        {
+            std::lock_guard<std::mutex> guard(ringLock);
+            queued.push_back(new Request(std::move(request)));
+            SubmitQueued();
+        }
+        ringActive.notify_one();
+        return;
+    }
+#endif
+
+    ReadOnPool(std::move(request));
+}
+
+void AsyncFileReader::Wait()
+{
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> guard(pendingLock);
+            if (pending == 0)
+                return;
+        }
+        // help out with decodes, only sleep if there's nothing to do
+        if (!pool.RunQueuedJob())
+        {
+            std::unique_lock<std::mutex> guard(pendingLock);
+            pendingDone.wait_for(guard, std::chrono::milliseconds(1), [this] { return pending == 0; });
+        }
+    }
+}
+
+void AsyncFileReader::ReadOnPool(Request request)
+{
+    pool.Submit([this, request]() mutable
+    {
+        // take a free stream, or open a new one if they're all in use
+        std::unique_ptr<FastFileStream> stream;
+        {
+            std::lock_guard<std::mutex> guard(streamsLock);
+            if (!freeStreams.empty())
+            {
+                stream = std::move(freeStreams.back());
+                freeStreams.pop_back();
+            }
+        }
+        if (!stream)
+            stream.reset(new FastFileStream(filename));
+
+        stream->Seek(request.offset);
+        stream->Read(request.buffer->data(), request.buffer->size());
+        assert_release(!stream->Failed());
+
+        {
+            std::lock_guard<std::mutex> guard(streamsLock);
+            freeStreams.push_back(std::move(stream));
+        }
+
+        // already on the pool, no need to go through Complete()
+        request.onComplete(request.buffer);
+        std::lock_guard<std::mutex> guard(pendingLock);
+        --pending;
+        pendingDone.notify_all();
+    });
+}
+
+void AsyncFileReader::Complete(Request request)
+{
+    pool.Submit([this, request]()
+    {
+        request.onComplete(request.buffer);
+        std::lock_guard<std::mutex> guard(pendingLock);
+        --pending;
+        pendingDone.notify_all();
+    });
+}
+
+#ifdef __linux__
+// no liburing dependency, the raw interface is small enough
+bool AsyncFileReader::SetupIOUring()
+{
+    fileFd = open(filename.c_str(), O_RDONLY);
+    if (fileFd < 0)
+        return false;
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    // not supported by the kernel, or blocked
+    if (ringFd < 0)
+        return false;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+    {
+        sqRing = nullptr;
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cqRing = sqRing;
+    }
+    else
+    {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+        {
+            cqRing = nullptr;
+            return false;
+        }
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqesPtr = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqesPtr == MAP_FAILED)
+        return false;
+    sqes = reinterpret_cast<io_uring_sqe*>(sqesPtr);
+
+    uint8_t* sqBytes = reinterpret_cast<uint8_t*>(sqRing);
+    uint8_t* cqBytes = reinterpret_cast<uint8_t*>(cqRing);
+    sqTail = reinterpret_cast<unsigned*>(sqBytes + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sqBytes + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sqBytes + params.sq_off.array);
+    cqHead = reinterpret_cast<unsigned*>(cqBytes + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cqBytes + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cqBytes + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cqBytes + params.cq_off.cqes);
+    ringEntries = params.sq_entries;
+
+    return true;
+}
+
+void AsyncFileReader::ShutdownIOUring()
+{
+    if (sqes)
+        munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    if (sqRing)
+        munmap(sqRing, sqRingSize);
+    if (ringFd >= 0)
+        close(ringFd);
+    if (fileFd >= 0)
+        close(fileFd);
+}
+
+void AsyncFileReader::SubmitQueued()
+{
+    unsigned toSubmit = 0;
+    unsigned tail = *sqTail;
+    while (!queued.empty() && submitted < ringEntries)
+    {
+        Request* request = queued.front();
+        queued.pop_front();
+
+        unsigned index = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fileFd;
+        sqe->addr = (uint64_t)request->buffer->data();
+        sqe->len = (uint32_t)request->buffer->size();
+        sqe->off = request->offset;
+        sqe->user_data = (uint64_t)request;
+        sqArray[index] = index;
+
+        ++tail;
+        ++toSubmit;
+        ++submitted;
+    }
+
+    if (toSubmit == 0)
+        return;
+
+    // make the entries visible before the kernel sees the new tail
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+    int result = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, 0, 0, nullptr, 0);
+    assert_release(result >= 0);
+}
+
+void AsyncFileReader::ReadRemaining(Request& request, size_t alreadyRead)
+{
+    while (alreadyRead < request.buffer->size())
+    {
+        ssize_t result = pread(fileFd, request.buffer->data() + alreadyRead, request.buffer->size() - alreadyRead, request.offset + alreadyRead);
+        if (result < 0 && errno == EINTR)
+            continue;
+        assert_release(result > 0);
+        alreadyRead += result;
+    }
+}
+
+void AsyncFileReader::ReapLoop()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(ringLock);
+            ringActive.wait(guard, [this] { return stopping || submitted > 0; });
+            if (submitted == 0)
+                return;
+        }
+
+        // wait for at least one read to finish
+        int result = (int)syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (result < 0 && errno != EINTR)
+            assert_release(false);
+
+        std::vector<Request*> finished;
+        std::vector<int> results;
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            io_uring_cqe* cqe = &cqes[head & *cqMask];
+            finished.push_back(reinterpret_cast<Request*>(cqe->user_data));
+            results.push_back(cqe->res);
+            ++head;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+        // free slots can go straight to anything queued
+        {
+            std::lock_guard<std::mutex> guard(ringLock);
+            submitted -= finished.size();
+            SubmitQueued();
+        }
+
+        for (size_t i = 0; i < finished.size(); ++i)
+        {
+            Request request = std::move(*finished[i]);
+            delete finished[i];
+            // errors (e.g. IORING_OP_READ not supported) and short reads are finished off synchronously
+            if (results[i] < (int)request.buffer->size())
+                ReadRemaining(request, std::max(results[i], 0));
+            Complete(std::move(request));
+        }
+    }
+}
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "Serialize.h"
+#include "WorkerPool.h"
+
+// Keeps many reads of one file in flight at once
+// Uses io_uring on Linux if the kernel supports it, otherwise each read is a job on the worker pool
+class AsyncFileReader
+{
+public:
+    typedef std::function<void(std::shared_ptr<const std::vector<uint8_t>>)> Callback;
+
+    AsyncFileReader(const std::string& filename, WorkerPool& pool = WorkerPool::GetShared());
+    ~AsyncFileReader();
+
+    // onComplete is run on the worker pool as soon as the data is in
+    void Read(uint64_t offset, uint32_t length, Callback onComplete);
+    // blocks until every read + callback has finished, runs pool jobs while waiting
+    void Wait();
+
+    bool UsingIOUring() const;
+
+private:
+    struct Request
+    {
+        uint64_t offset;
+        std::shared_ptr<std::vector<uint8_t>> buffer;
+        Callback onComplete;
+    };
+
+    // thread-pool fallback
+    void ReadOnPool(Request request);
+    // called once a request's buffer is filled
+    void Complete(Request request);
+
+#ifdef __linux__
+    bool SetupIOUring();
+    void ShutdownIOUring();
+    // needs ringLock
+    void SubmitQueued();
+    void ReapLoop();
+    // synchronous read, used if io_uring gives back an error/short read
+    void ReadRemaining(Request& request, size_t alreadyRead);
+
+    int fileFd = -1;
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    struct io_uring_cqe* cqes = nullptr;
+    unsigned ringEntries = 0;
+
+    // requests waiting for space in the ring
+    std::deque<Request*> queued;
+    // requests submitted to the ring
+    size_t submitted = 0;
+    std::mutex ringLock;
+    std::condition_variable ringActive;
+    std::thread reapThread;
+    bool stopping = false;
+#endif
+    bool useIOUring = false;
+
+    std::string filename;
+    WorkerPool& pool;
+
+    // fallback file streams, one is taken for the duration of a read
+    std::vector<std::unique_ptr<FastFileStream>> freeStreams;
+    std::mutex streamsLock;
+
+    // reads + callbacks that haven't finished
+    size_t pending = 0;
+    std::mutex pendingLock;
+    std::condition_variable pendingDone;
+};
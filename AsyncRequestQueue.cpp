@@ -0,0 +1,229 @@
+#include "AsyncRequestQueue.h"
+
+AsyncRequestQueue::AsyncRequestQueue(WorkerPool& pool)
+    : pool(pool)
+{
+}
+
+AsyncRequestQueue::~AsyncRequestQueue()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (!queued.empty())
+    {
+        Request request = std::move(queued.back());
+        queued.pop_back();
+        Finish(request, Status::Cancelled, guard);
+    }
+    // the running request is cancelled after it's current step
+    stopping = true;
+    guard.unlock();
+    requestsAvailable.notify_all();
+    if (runner.joinable())
+        runner.join();
+}
+
+AsyncRequestQueue::Ticket AsyncRequestQueue::Submit(std::function<bool()> step, int32_t priority, std::function<void(Status)> onFinished)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    Request request;
+    request.ticket = nextTicket++;
+    request.priority = priority;
+    request.step = std::move(step);
+    request.onFinished = std::move(onFinished);
+    queued.push_back(std::move(request));
+
+    if (!runner.joinable())
+        runner = std::thread(&AsyncRequestQueue::RunRequests, this);
+    requestsAvailable.notify_one();
+    return queued.back().ticket;
+}
+
+AsyncRequest AsyncRequestQueue::SubmitAsync(std::function<bool()> step, int32_t priority)
+{
+    AsyncRequest request;
+    request.state = std::make_shared<AsyncRequest::State>();
+    request.queue = this;
+    std::shared_ptr<AsyncRequest::State> state = request.state;
+    WorkerPool& resumePool = pool;
+    request.ticket = Submit(std::move(step), priority, [state, &resumePool](Status status)
+    {
+        std::coroutine_handle<> awaiting;
+        {
+            std::lock_guard<std::mutex> guard(state->lock);
+            state->finished = true;
+            state->status = status;
+            awaiting = state->awaiting;
+        }
+        // not resumed here, the coroutine could destroy the queue while it's still finishing this request
+        if (awaiting)
+            resumePool.Submit([awaiting] { awaiting.resume(); }, false);
+    });
+    return request;
+}
+
+AsyncRequestQueue::Status AsyncRequestQueue::Poll(Ticket ticket)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (ticket != 0 && ticket == running)
+        return Status::Running;
+    for (const Request& request : queued)
+    {
+        if (request.ticket == ticket)
+            return Status::Queued;
+    }
+
+    auto found = finishedStatuses.find(ticket);
+    if (found == finishedStatuses.end())
+        return Status::Unknown;
+    Status status = found->second;
+    finishedStatuses.erase(found);
+    return status;
+}
+
+AsyncRequestQueue::Status AsyncRequestQueue::Wait(Ticket ticket)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    finished.wait(guard, [&] { return !IsPending(ticket); });
+
+    auto found = finishedStatuses.find(ticket);
+    if (found == finishedStatuses.end())
+        return Status::Unknown;
+    Status status = found->second;
+    finishedStatuses.erase(found);
+    return status;
+}
+
+bool AsyncRequestQueue::Cancel(Ticket ticket)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (ticket != 0 && ticket == running)
+    {
+        cancelRunning = true;
+        return true;
+    }
+    for (size_t requestIdx = 0; requestIdx < queued.size(); ++requestIdx)
+    {
+        if (queued[requestIdx].ticket == ticket)
+        {
+            Request request = std::move(queued[requestIdx]);
+            queued.erase(queued.begin() + requestIdx);
+            Finish(request, Status::Cancelled, guard);
+            finished.notify_all();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AsyncRequestQueue::IsBusy()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return running != 0 || !queued.empty();
+}
+
+void AsyncRequestQueue::RunRequests()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    Request request;
+    while (true)
+    {
+        if (running == 0)
+        {
+            requestsAvailable.wait(guard, [this] { return stopping || !queued.empty(); });
+            if (stopping)
+                return;
+            request = TakeNextRequest();
+            running = request.ticket;
+            cancelRunning = false;
+        }
+
+        // one step per pass, so cancelling or destroying the queue stops a request in between steps
+        bool done = false;
+        if (!cancelRunning && !stopping)
+        {
+            guard.unlock();
+            done = request.step();
+            guard.lock();
+        }
+        if (done || cancelRunning || stopping)
+        {
+            running = 0;
+            Finish(request, done ? Status::Done : Status::Cancelled, guard);
+            // drop whatever the step captured
+            request = Request();
+            finished.notify_all();
+        }
+    }
+}
+
+AsyncRequestQueue::Request AsyncRequestQueue::TakeNextRequest()
+{
+    size_t next = 0;
+    for (size_t requestIdx = 1; requestIdx < queued.size(); ++requestIdx)
+    {
+        if (queued[requestIdx].priority > queued[next].priority
+            || (queued[requestIdx].priority == queued[next].priority && queued[requestIdx].ticket < queued[next].ticket))
+            next = requestIdx;
+    }
+    Request request = std::move(queued[next]);
+    queued.erase(queued.begin() + next);
+    return request;
+}
+
+void AsyncRequestQueue::Finish(Request& request, Status status, std::unique_lock<std::mutex>& guard)
+{
+    if (!request.onFinished)
+    {
+        finishedStatuses[request.ticket] = status;
+        return;
+    }
+    guard.unlock();
+    request.onFinished(status);
+    guard.lock();
+}
+
+bool AsyncRequestQueue::IsPending(Ticket ticket) const
+{
+    if (ticket == 0)
+        return false;
+    if (ticket == running)
+        return true;
+    for (const Request& request : queued)
+    {
+        if (request.ticket == ticket)
+            return true;
+    }
+    return false;
+}
+
+bool AsyncRequest::Cancel()
+{
+    return queue->Cancel(ticket);
+}
+
+AsyncRequestQueue::Ticket AsyncRequest::GetTicket() const
+{
+    return ticket;
+}
+
+bool AsyncRequest::await_ready() const
+{
+    std::lock_guard<std::mutex> guard(state->lock);
+    return state->finished;
+}
+
+bool AsyncRequest::await_suspend(std::coroutine_handle<> awaiting)
+{
+    // it can finish between await_ready() and here, in which case the coroutine carries straight on
+    std::lock_guard<std::mutex> guard(state->lock);
+    if (state->finished)
+        return false;
+    state->awaiting = awaiting;
+    return true;
+}
+
+AsyncRequestQueue::Status AsyncRequest::await_resume() const
+{
+    std::lock_guard<std::mutex> guard(state->lock);
+    return state->status;
+}
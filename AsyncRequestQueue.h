@@ -0,0 +1,118 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <coroutine>
+#include <stdint.h>
+
+#include "WorkerPool.h"
+
+class AsyncRequest;
+
+// Background requests that are run one at a time on a thread of the queue's own, highest priority first (oldest first within a priority)
+// not a pool job, a step can hold locks + wait on the pool, and threads helping out in RunQueuedJob() must never pick it up
+// each request gets a ticket that can be polled, waited on or cancelled
+// a request is a step function that's called until it returns true, so long requests can be split up -
+// cancelling a running request stops it at the next step, and other users of whatever it reads get a turn in between
+class AsyncRequestQueue
+{
+public:
+    typedef uint64_t Ticket;
+    enum class Status
+    {
+        // never submitted, or finished + already returned by Poll()/Wait()
+        Unknown,
+        Queued,
+        Running,
+        Done,
+        Cancelled
+    };
+
+    // pool is only used for resuming SubmitAsync() coroutines, the thread is started by the first Submit()
+    AsyncRequestQueue(WorkerPool& pool = WorkerPool::GetShared());
+    // cancels every request, waiting for the running one to stop
+    ~AsyncRequestQueue();
+
+    // onFinished is called on the queue's thread with Done or Cancelled, requests with one don't keep their status for Poll()/Wait()
+    Ticket Submit(std::function<bool()> step, int32_t priority = 0, std::function<void(Status)> onFinished = nullptr);
+    // Submit() for coroutines, co_await the result to wait for it
+    AsyncRequest SubmitAsync(std::function<bool()> step, int32_t priority = 0);
+    // a finished request's status is forgotten once it's been returned
+    Status Poll(Ticket ticket);
+    // blocks until the request has finished, can't be called from a step
+    Status Wait(Ticket ticket);
+    // returns false if the request has already finished
+    bool Cancel(Ticket ticket);
+    // true while any request is queued or running
+    bool IsBusy();
+
+private:
+    struct Request
+    {
+        Ticket ticket = 0;
+        int32_t priority = 0;
+        std::function<bool()> step;
+        std::function<void(Status)> onFinished;
+    };
+
+    // the queue's thread, one step per pass until the queue is destroyed
+    void RunRequests();
+    // highest priority, then lowest ticket - lock must be held
+    Request TakeNextRequest();
+    // records the status, or hands it to onFinished - lock must be held, it's released while onFinished runs
+    void Finish(Request& request, Status status, std::unique_lock<std::mutex>& guard);
+    bool IsPending(Ticket ticket) const;
+
+    WorkerPool& pool;
+
+    // guards everything below
+    std::mutex lock;
+    std::condition_variable finished;
+    std::condition_variable requestsAvailable;
+    std::vector<Request> queued;
+    std::unordered_map<Ticket, Status> finishedStatuses;
+    Ticket nextTicket = 1;
+    // 0 if nothing is running
+    Ticket running = 0;
+    bool cancelRunning = false;
+    bool stopping = false;
+    std::thread runner;
+};
+
+// awaitable request from AsyncRequestQueue::SubmitAsync(), co_await gives it's final status (Done or Cancelled)
+// the awaiting coroutine is resumed by a job of it's own on the pool, so it can go on to submit more requests -
+// it's never run by a thread helping out in RunQueuedJob(), which could be holding locks the coroutine needs
+// the queue has to outlive it
+class AsyncRequest
+{
+public:
+    // stops the request, the awaiting coroutine is resumed with Cancelled
+    // returns false if the request has already finished
+    bool Cancel();
+    AsyncRequestQueue::Ticket GetTicket() const;
+
+    bool await_ready() const;
+    bool await_suspend(std::coroutine_handle<> awaiting);
+    AsyncRequestQueue::Status await_resume() const;
+
+private:
+    friend class AsyncRequestQueue;
+
+    // shared with the queue's onFinished, which can run before anything awaits
+    struct State
+    {
+        std::mutex lock;
+        bool finished = false;
+        AsyncRequestQueue::Status status = AsyncRequestQueue::Status::Unknown;
+        std::coroutine_handle<> awaiting;
+    };
+
+    std::shared_ptr<State> state;
+    AsyncRequestQueue* queue = nullptr;
+    AsyncRequestQueue::Ticket ticket = 0;
+};
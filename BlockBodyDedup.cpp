@@ -0,0 +1,28 @@
+#include "BlockBodyDedup.h"
+
+void BlockBodyDedup::Add(const std::vector<uint8_t>& body, uint64_t offset)
+{
+    if (!body.empty())
+        offsetsByHash.emplace(Hash(body), offset);
+}
+
+void BlockBodyDedup::AddSavedBytes(size_t bytes)
+{
+    savedBytes += bytes;
+}
+
+uint64_t BlockBodyDedup::GetSavedBytes() const
+{
+    return savedBytes;
+}
+
+uint64_t BlockBodyDedup::Hash(const std::vector<uint8_t>& body)
+{
+    uint64_t hash = 0xcbf29ce484222325ull ^ body.size();
+    for (uint8_t byte : body)
+    {
+        hash ^= byte;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
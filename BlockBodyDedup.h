@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include <stdint.h>
+
+// Finds block bodies that are byte-for-byte the same as one written earlier, so the index can point both blocks at one copy
+// bodies are looked up by hash, and matches are checked against the earlier bytes so a collision can't alias different blocks
+// repeated tiles, stamped features and flat areas (above the constant block level) often give identical bodies
+class BlockBodyDedup
+{
+public:
+    // returns true + sets offset if an earlier body matches
+    // sameBody(offset) compares the body with the earlier one at offset, of the same length
+    template<typename SameBody>
+    bool Find(const std::vector<uint8_t>& body, uint64_t& offset, SameBody& sameBody) const
+    {
+        if (body.empty())
+            return false;
+        auto matches = offsetsByHash.equal_range(Hash(body));
+        for (auto match = matches.first; match != matches.second; ++match)
+        {
+            if (sameBody(match->second))
+            {
+                offset = match->second;
+                return true;
+            }
+        }
+        return false;
+    }
+    // body was written at offset
+    void Add(const std::vector<uint8_t>& body, uint64_t offset);
+    // bytes saved by Find() matches, for logging
+    void AddSavedBytes(size_t bytes);
+    uint64_t GetSavedBytes() const;
+
+private:
+    // FNV-1a, the length is mixed in so only same-length bodies can match
+    static uint64_t Hash(const std::vector<uint8_t>& body);
+
+    std::unordered_multimap<uint64_t, uint64_t> offsetsByHash;
+    uint64_t savedBytes = 0;
+};
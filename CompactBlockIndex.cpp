@@ -0,0 +1,174 @@
+#include "CompactBlockIndex.h"
+
+#include <cstring>
+#include "RansEncode.h"
+
+void CompactBlockIndex::Write(const std::vector<CompressedImageBlockIndexEntry>& entries, std::vector<uint8_t>& bytes)
+{
+    for (const CompressedImageBlockIndexEntry& entry : entries)
+        WriteVarint(bytes, entry.length);
+
+    uint64_t previousEnd = 0;
+    for (const CompressedImageBlockIndexEntry& entry : entries)
+    {
+        WriteVarint(bytes, ZigZag((int64_t)(entry.offset - previousEnd)));
+        previousEnd = entry.offset + entry.length;
+    }
+
+    // little endian, the top bytes are always 0
+    for (const CompressedImageBlockIndexEntry& entry : entries)
+    {
+        size_t writePos = bytes.size();
+        bytes.resize(bytes.size() + RansState::STATE_BYTES);
+        memcpy(&bytes[writePos], &entry.finalRansState, RansState::STATE_BYTES);
+    }
+
+    for (const CompressedImageBlockIndexEntry& entry : entries)
+        WriteVarint(bytes, entry.flags);
+
+    symbol_t previousMin = 0;
+    for (const CompressedImageBlockIndexEntry& entry : entries)
+    {
+        WriteVarint(bytes, ZigZag((int64_t)entry.minValue - previousMin));
+        previousMin = entry.minValue;
+    }
+    for (const CompressedImageBlockIndexEntry& entry : entries)
+        WriteVarint(bytes, entry.maxValue - entry.minValue);
+
+    for (const CompressedImageBlockIndexEntry& entry : entries)
+    {
+        for (uint16_t levelEnd : entry.levelEnds)
+            WriteVarint(bytes, levelEnd);
+    }
+}
+
+bool CompactBlockIndex::Read(const uint8_t* bytes, size_t size, size_t blockCount, std::vector<uint64_t>& positions, std::vector<uint32_t>& lengths,
+    std::vector<state_t>& ransStates, std::vector<uint16_t>& levelEnds, std::vector<HeightBounds>& bounds)
+{
+    const uint8_t* end = bytes + size;
+
+    // each column is decoded in one go, then turned into values in a separate pass over the flat array
+    lengths.resize(blockCount);
+    if (!ReadVarints(bytes, end, blockCount, lengths.data()))
+        return false;
+
+    // each position is the previous one + the previous length + the delta
+    positions.resize(blockCount);
+    if (!ReadVarints(bytes, end, blockCount, positions.data()))
+        return false;
+    uint64_t previousEnd = 0;
+    for (size_t blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+    {
+        positions[blockIdx] = previousEnd + (uint64_t)UnZigZag(positions[blockIdx]);
+        previousEnd = positions[blockIdx] + lengths[blockIdx];
+    }
+
+    if ((size_t)(end - bytes) < blockCount * RansState::STATE_BYTES)
+        return false;
+    ransStates.resize(blockCount);
+    for (size_t blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+    {
+        state_t state = 0;
+        memcpy(&state, bytes, RansState::STATE_BYTES);
+        bytes += RansState::STATE_BYTES;
+        ransStates[blockIdx] = state;
+    }
+
+    // flags aren't kept, constant blocks are found from their bounds, so they're skipped by counting the varints' last bytes
+    for (size_t flagCount = 0; flagCount < blockCount; ++bytes)
+    {
+        if (bytes == end)
+            return false;
+        flagCount += !(*bytes & 0x80);
+    }
+
+    bounds.resize(blockCount);
+    std::vector<uint32_t> column(blockCount);
+    if (!ReadVarints(bytes, end, blockCount, column.data()))
+        return false;
+    symbol_t previousMin = 0;
+    for (size_t blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+    {
+        previousMin = (symbol_t)(previousMin + UnZigZag(column[blockIdx]));
+        bounds[blockIdx].minValue = previousMin;
+    }
+    if (!ReadVarints(bytes, end, blockCount, column.data()))
+        return false;
+    for (size_t blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+        bounds[blockIdx].maxValue = (symbol_t)(bounds[blockIdx].minValue + column[blockIdx]);
+
+    levelEnds.resize(blockCount * CompressedImageBlockHeader::MAX_LEVEL_ENDS);
+    if (!ReadVarints(bytes, end, levelEnds.size(), levelEnds.data()))
+        return false;
+
+    return bytes == end;
+}
+
+template<typename T>
+bool CompactBlockIndex::ReadVarints(const uint8_t*& bytes, const uint8_t* end, size_t count, T* values)
+{
+    // most columns are almost all 1-byte varints, so 8 bytes are checked at once + copied straight out if none of them continue
+    size_t valueIdx = 0;
+    uint64_t value;
+    while (count - valueIdx >= 8 && end - bytes >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        if ((word & 0x8080808080808080ull) == 0)
+        {
+            for (uint32_t byteIdx = 0; byteIdx < 8; ++byteIdx)
+                values[valueIdx + byteIdx] = (T)((word >> (8 * byteIdx)) & 0xFF);
+            valueIdx += 8;
+            bytes += 8;
+            continue;
+        }
+
+        if (!ReadVarint(bytes, end, value))
+            return false;
+        values[valueIdx++] = (T)value;
+    }
+
+    for (; valueIdx < count; ++valueIdx)
+    {
+        if (!ReadVarint(bytes, end, value))
+            return false;
+        values[valueIdx] = (T)value;
+    }
+    return true;
+}
+
+void CompactBlockIndex::WriteVarint(std::vector<uint8_t>& bytes, uint64_t value)
+{
+    // 7 bits at a time, lowest first, top bit set if more follow
+    while (value >= 0x80)
+    {
+        bytes.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back((uint8_t)value);
+}
+
+bool CompactBlockIndex::ReadVarint(const uint8_t*& bytes, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7)
+    {
+        if (bytes == end)
+            return false;
+        uint8_t byte = *bytes++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+uint64_t CompactBlockIndex::ZigZag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t CompactBlockIndex::UnZigZag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
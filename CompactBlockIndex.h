@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "CompressedImage.h"
+
+// v12+: optional smaller block index, for files that won't be changed with UpdateRegion()
+// stored a column at a time so each field decodes in its own simple loop, in this order:
+// - body lengths, varints
+// - offsets, as a zigzag varint from where the previous block's body ended (0 unless the body is shared)
+// - final rANS states, RansState::STATE_BYTES each instead of 8
+// - flags, varints
+// - min heights as a zigzag varint from the previous block's, max heights as a varint above the min
+// - levelEnds, varints
+// each column is read with one varint loop, body positions are then rebuilt with a prefix sum over the decoded lengths + offset deltas
+class CompactBlockIndex
+{
+public:
+    static void Write(const std::vector<CompressedImageBlockIndexEntry>& entries, std::vector<uint8_t>& bytes);
+    // fills the per-block arrays CompressedImage keeps, returns false if the bytes don't hold blockCount entries
+    static bool Read(const uint8_t* bytes, size_t size, size_t blockCount, std::vector<uint64_t>& positions, std::vector<uint32_t>& lengths,
+        std::vector<state_t>& ransStates, std::vector<uint16_t>& levelEnds, std::vector<HeightBounds>& bounds);
+
+private:
+    static void WriteVarint(std::vector<uint8_t>& bytes, uint64_t value);
+    // returns false if the varint runs past end
+    static bool ReadVarint(const uint8_t*& bytes, const uint8_t* end, uint64_t& value);
+    // reads a column of count varints, truncated to T
+    template<typename T>
+    static bool ReadVarints(const uint8_t*& bytes, const uint8_t* end, size_t count, T* values);
+    static uint64_t ZigZag(int64_t value);
+    static int64_t UnZigZag(uint64_t value);
+};
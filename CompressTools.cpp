@@ -16,6 +16,7 @@
 
 #include "RansEncode.h"
 #include "CompressedImage.h"
+#include "CompressedImageWriter.h"
 
 #include <chrono>
 
@@ -58,8 +59,45 @@ void FreeImageErrorHandler(FREE_IMAGE_FORMAT fif, const char* message) {
     printf(" ***\n");
 }
 
+// opens the file repeatedly and reports how long it takes, then times a full decode
+int RunBenchmark(const std::string& fileName, int openCount)
+{
+    std::cout << "Open benchmark..." << std::endl;
+    std::shared_ptr<CompressedImage> streamedImage;
+    double minOpenTime = 0.0;
+    double totalOpenTime = 0.0;
+    for (int i = 0; i < openCount; ++i)
+    {
+        streamedImage.reset();
+        auto start = std::chrono::high_resolution_clock::now();
+        streamedImage = CompressedImage::OpenStream(fileName);
+        std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+        if (!streamedImage)
+        {
+            std::cerr << "Failed to open " << fileName << std::endl;
+            return 1;
+        }
+        if (i == 0 || duration.count() < minOpenTime)
+            minOpenTime = duration.count();
+        totalOpenTime += duration.count();
+    }
+    std::cout << "File open time (min): " << minOpenTime << std::endl;
+    std::cout << "File open time (avg): " << totalOpenTime / openCount << std::endl;
+
+    std::cout << "Decode benchmark..." << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<symbol_t> decodedPixels = streamedImage->GetBottomLevelPixels();
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "decode: " << duration.count() << std::endl;
+    return 0;
+}
+
 int main(int argc, char* argv[])
 {
+    // CompressTools --benchmark <file.cif> [open count]
+    if (argc >= 3 && std::string(argv[1]) == "--benchmark")
+        return RunBenchmark(argv[2], argc >= 4 ? std::max(1, atoi(argv[3])) : 10);
+
     std::string inputFileName = "./data/newland/land/fullmap.tif";
     std::string outputFileName = "./data/newland/land/fullmap.cif";
 
@@ -68,150 +106,124 @@ int main(int argc, char* argv[])
     if (argc >= 3)
         outputFileName = argv[2];
 
-    std::cout << "Input: " << inputFileName << std::endl;
-    std::cout << "Output: " << outputFileName << std::endl;
-
-    // benchmark test code
-    if (false)
+    // CompressTools <input.tif> <output.cif> [--sample <block row interval>] [--table <trained table>] [--save-table <file>] [--index <fixed|compact>]
+    uint32_t sampleInterval = 1;
+    std::string tableFileName;
+    std::string saveTableFileName;
+    bool compactIndex = false;
+    for (int arg = 3; arg + 1 < argc; arg += 2)
     {
-        auto start = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
-        std::cout << "Decode benchmark..." << std::endl;
-        start = std::chrono::high_resolution_clock::now();
-        std::shared_ptr<CompressedImage> streamedImage = CompressedImage::OpenStream(outputFileName);
-        duration = std::chrono::high_resolution_clock::now() - start;
-        std::cout << "init: " << duration.count() << std::endl;
-        start = std::chrono::high_resolution_clock::now();
-        std::vector<symbol_t> decodedPixels = streamedImage->GetBottomLevelPixels();
-        duration = std::chrono::high_resolution_clock::now() - start;
-        std::cout << "decode: " << duration.count() << std::endl;
-        return 0;
+        std::string option = argv[arg];
+        if (option == "--sample")
+            sampleInterval = std::max(1, atoi(argv[arg + 1]));
+        else if (option == "--table")
+            tableFileName = argv[arg + 1];
+        else if (option == "--save-table")
+            saveTableFileName = argv[arg + 1];
+        else if (option == "--index")
+            compactIndex = std::string(argv[arg + 1]) == "compact";
+        else
+            std::cerr << "Unknown option: " << option << std::endl;
     }
 
+    std::cout << "Input: " << inputFileName << std::endl;
+    std::cout << "Output: " << outputFileName << std::endl;
+
     // normal compressor
     std::cout << "Opening image..." << std::endl;
-    FreeImage_Initialise();
-    FreeImage_SetOutputMessage(FreeImageErrorHandler);
-    FIBITMAP* bitmap = FreeImage_Load(FREE_IMAGE_FORMAT::FIF_TIFF, inputFileName.c_str(), TIFF_DEFAULT);
-
-    int width = FreeImage_GetWidth(bitmap);
-    int height = FreeImage_GetHeight(bitmap);
-    int precision = FreeImage_GetBPP(bitmap);
-    if (precision == 16)
+    const uint32_t blockSize = 32;
+    // uncompressed TIFFs are streamed from disk, anything else is loaded whole with FreeImage
+    std::unique_ptr<ScanlineSource> source;
+    std::vector<uint16_t> values;
+    std::unique_ptr<TiffScanlineSource> tiffSource = std::make_unique<TiffScanlineSource>(inputFileName);
+    if (tiffSource->IsValid())
     {
-        std::cout << "Uncompressed size: " << width*height*sizeof(uint16_t) << " bytes" << std::endl;
-        std::cout << "Reading pixels..." << std::endl;
-
-        std::vector<uint16_t> values;
-        values.resize(width * height);
-        // Undo Free_Image transform
-        // Actually tested it properly this time...
-        for (int y = 0; y < height; ++y)
-        {
-            BYTE* bits = FreeImage_GetScanLine(bitmap, (height-1)-y);
-            memcpy(&values[y*width], bits, width * sizeof(uint16_t));
-        }
-
-        std::cout << "Generating wavelet image..." << std::endl;
-        //std::shared_ptr<WaveletLayer> bottomLayer = std::make_shared<WaveletLayer>(values, width, height);
-        //std::shared_ptr<CompressedImage> compressedImage = std::make_shared<CompressedImage>(bottomLayer);
-        std::shared_ptr<CompressedImage> compressedImage = std::make_shared<CompressedImage>(values, width, height, 32);
-        std::cout << "Serializing..." << std::endl; 
-        std::vector<uint8_t> imageBytes = compressedImage->Serialize();
-        std::cout << "Final encoded bytes: " << imageBytes.size() << std::endl;
-
-        // write to disk
-        std::cout << "Writing bytes..." << std::endl;
-        std::ofstream compressedFile(outputFileName, std::ios::binary);
-        if (compressedFile.is_open())
-        {
-            compressedFile.write((const char*)&imageBytes[0], imageBytes.size());
-            compressedFile.close();
-        }
-        else
-        {
-            std::cerr << "Error opening output file!";
-        }
-
-
-        auto start = std::chrono::high_resolution_clock::now();
-        std::shared_ptr<CompressedImage> decodedImage = CompressedImage::OpenStream(outputFileName);
-        std::chrono::duration<double>  duration = std::chrono::high_resolution_clock::now() - start;
-        std::cout << "File open time: " << duration.count() << std::endl;
-        /*
-        std::cout << decodedImage->GetTopLOD() << std::endl;
-        std::vector<uint8_t> blockLevels = decodedImage->GetBlockLevels();
-        std::cout << int(blockLevels[0]) << std::endl;
-        decodedImage->GetPixel(0, 0);
-        blockLevels = decodedImage->GetBlockLevels();
-        std::cout << int(blockLevels[0]) << std::endl;
-        decodedImage->GetPixel(64, 0);
-        blockLevels = decodedImage->GetBlockLevels();
-        std::cout << int(blockLevels[0]) << std::endl;
-        decodedImage->GetPixel(32, 0);
-        blockLevels = decodedImage->GetBlockLevels();
-        std::cout << int(blockLevels[0]) << std::endl;
-        decodedImage->GetPixel(16, 0);
-        decodedImage->GetPixel(16, 16);
-        blockLevels = decodedImage->GetBlockLevels();
-        std::cout << int(blockLevels[0]) << std::endl;
-        decodedImage->GetPixel(8, 0);
-        blockLevels = decodedImage->GetBlockLevels();
-        std::cout << int(blockLevels[0]) << std::endl;
-        */
-        // test parent reads
-        for (int y = 0; y < height; y += 16)
+        source = std::move(tiffSource);
+    }
+    else
+    {
+        FreeImage_Initialise();
+        FreeImage_SetOutputMessage(FreeImageErrorHandler);
+        FIBITMAP* bitmap = FreeImage_Load(FREE_IMAGE_FORMAT::FIF_TIFF, inputFileName.c_str(), TIFF_DEFAULT);
+
+        int width = FreeImage_GetWidth(bitmap);
+        int height = FreeImage_GetHeight(bitmap);
+        int precision = FreeImage_GetBPP(bitmap);
+        if (precision == 16)
         {
-            for (int x = 0; x < width; x += 16)
+            std::cout << "Reading pixels..." << std::endl;
+            values.resize((size_t)width * height);
+            // Undo Free_Image transform
+            // Actually tested it properly this time...
+            for (int y = 0; y < height; ++y)
             {
-                uint16_t sourcePixel = values[y * width + x];
-                uint16_t decodedPixel = decodedImage->GetPixel(x, y);
-                if (decodedPixel != sourcePixel)
-                {
-                    std::cout << "Decoded pixel values at (" << x << ", " << y << ") did not match." << std::endl;
-                }
-                assert_release(decodedPixel == sourcePixel);
+                BYTE* bits = FreeImage_GetScanLine(bitmap, (height-1)-y);
+                memcpy(&values[(size_t)y*width], bits, width * sizeof(uint16_t));
             }
+            source = std::make_unique<MemoryScanlineSource>(values, width, height);
         }
+        FreeImage_Unload(bitmap);
+        FreeImage_DeInitialise();
+    }
 
-        // test aligned reads
-        std::cout << "Testing aligned reads..." << std::endl;
-        start = std::chrono::high_resolution_clock::now();
-        for (int y = 1024; y < 2048; y += 4)
-        {
-            for (int x = 1024; x < 2048; x += 4)
-            {
-                uint16_t sourcePixel = values[y * width + x];
-                uint16_t decodedPixel = decodedImage->GetPixel(x, y);
-                if (decodedPixel != sourcePixel)
-                {
-                    std::cout << "Decoded pixel values at (" << x << ", " << y << ") did not match." << std::endl;
-                }
-                assert_release(decodedPixel == sourcePixel);
-            }
-        }
-        duration = std::chrono::high_resolution_clock::now() - start;
-        std::cout << "Test time: " << duration.count() << std::endl;
-
-        std::cout << "Decoding bottom-level pixels..." << std::endl;
-        start = std::chrono::high_resolution_clock::now();
-        std::vector<uint16_t> decodedPixels = decodedImage->GetBottomLevelPixels();
-        duration = std::chrono::high_resolution_clock::now() - start;
-        std::cout << "Decode time: " << duration.count() << std::endl;
-        for (int i = 0; i < values.size(); ++i)
+    if (!source)
+    {
+        std::cerr << "Input must be a 16-bit greyscale image!" << std::endl;
+        return 1;
+    }
+
+    uint32_t width = source->GetWidth();
+    uint32_t height = source->GetHeight();
+    std::cout << "Uncompressed size: " << (size_t)width*height*sizeof(uint16_t) << " bytes" << std::endl;
+
+    std::cout << "Encoding..." << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    CompressedImageWriter writer(*source, blockSize);
+    writer.SetSampleInterval(sampleInterval);
+    writer.SetCompactIndex(compactIndex);
+    if (!tableFileName.empty() && !writer.LoadSymbolTable(tableFileName))
+        return 1;
+    if (!writer.Write(outputFileName))
+    {
+        std::cerr << "Error writing output file!" << std::endl;
+        return 1;
+    }
+    if (!saveTableFileName.empty() && !writer.SaveSymbolTable(saveTableFileName))
+        std::cerr << "Error writing symbol table!" << std::endl;
+    std::chrono::duration<double> duration = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Encode time: " << duration.count() << std::endl;
+
+    start = std::chrono::high_resolution_clock::now();
+    std::shared_ptr<CompressedImage> decodedImage = CompressedImage::OpenStream(outputFileName);
+    duration = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "File open time: " << duration.count() << std::endl;
+
+    // check a block row at a time, so the source never has to be in memory
+    std::cout << "Checking values..." << std::endl;
+    start = std::chrono::high_resolution_clock::now();
+    std::vector<uint16_t> sourceRows;
+    std::vector<uint16_t> decodedRows;
+    for (uint32_t y = 0; y < height; y += blockSize)
+    {
+        uint32_t rowCount = std::min(blockSize, height - y);
+        sourceRows.resize((size_t)rowCount * width);
+        decodedRows.resize((size_t)rowCount * width);
+        assert_release(source->ReadRows(y, rowCount, &sourceRows[0]));
+        decodedImage->GetRegion(0, y, width, rowCount, &decodedRows[0]);
+        for (size_t i = 0; i < sourceRows.size(); ++i)
         {
-            assert_release(values[i] == decodedPixels[i]);
-            if (values[i] != decodedPixels[i])
+            if (sourceRows[i] != decodedRows[i])
             {
-                std::cout << "Decoded wavelet values at " << i << " did not match." << std::endl;
+                std::cout << "Decoded pixel values at (" << i % width << ", " << y + i / width << ") did not match." << std::endl;
             }
+            assert_release(sourceRows[i] == decodedRows[i]);
         }
-        std::cout << "Values checked!" << std::endl;
-        decodedImage.reset();
-
-        std::cout << "Done!" << std::endl;
     }
-    
-    FreeImage_Unload(bitmap);
-    FreeImage_DeInitialise();
+    duration = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "Decode time: " << duration.count() << std::endl;
+    std::cout << "Values checked!" << std::endl;
+    decodedImage.reset();
+
+    std::cout << "Done!" << std::endl;
+    return 0;
 }
@@ -1,5 +1,8 @@
 #include "CompressToolsLib.h"
 #include "CompressedImage.h"
+#include "ProgressiveImage.h"
+#include "TiledWorld.h"
+#include "AsyncRequestQueue.h"
 #include "Logging.h"
 
 #include <fstream>
@@ -7,6 +10,7 @@
 #include <Windows.h>
 #include <sstream>
 #include <mutex>
+#include <algorithm>
 
 using namespace CompressToolsLib;
 
@@ -17,12 +21,26 @@ struct CompressToolsLib::CompressedImageFile
 	// TODO REMOVE AFTER TESTING used if preloading
 	std::vector<symbol_t> decodedPixels;
 	std::mutex lock;
+	// used if progressive, has it's own lock
+	std::shared_ptr<ProgressiveImage> progressive;
+	// async requests, last so it's destroyed (waiting for the running request) before everything it reads
+	std::unique_ptr<AsyncRequestQueue> requests;
+};
+
+struct CompressToolsLib::CompressedWorldFile
+{
+	std::shared_ptr<TiledWorld> world;
+	std::mutex lock;
 };
 
 __declspec(dllexport) CompressedImageFileHdl CompressToolsLib::OpenImage(const char* filename, ImageMode mode)
 {
 	// try open
-	std::shared_ptr<CompressedImage> image = CompressedImage::OpenStream(filename);
+	std::shared_ptr<CompressedImage> image;
+	if (mode == ImageMode::Resident)
+		image = CompressedImage::OpenResident(filename);
+	else
+		image = CompressedImage::OpenStream(filename);
 
 	// error opening
 	if (!image)
@@ -42,6 +60,9 @@ __declspec(dllexport) CompressedImageFileHdl CompressToolsLib::OpenImage(const c
 	std::cout << "Heightmap memory usage: " << memoryUsage << "MB" << std::endl;
 	// free up memory
 	imageHdl->image->ClearBlockCache();
+	if (mode == ImageMode::Progressive)
+		imageHdl->progressive = std::make_shared<ProgressiveImage>(imageHdl->image);
+	imageHdl->requests.reset(new AsyncRequestQueue());
 	return imageHdl;
 }
 
@@ -56,17 +77,84 @@ __declspec(dllexport) uint16_t CompressToolsLib::ReadHeightValue(CompressedImage
 		//MessageBoxA(0, msg.str().c_str(), "Debug", MB_OK);
 		return 0;
 	}
+	if (image->progressive)
+		return image->progressive->GetPixel(x, y);
 	image->lock.lock();
 	symbol_t val;
 	// HACK if preloading use preloaded cache
 	if(image->decodedPixels.size() > 0)
-		val = image->decodedPixels[y * image->image->GetWidth() + x];
+		val = image->decodedPixels[(size_t)y * image->image->GetWidth() + x];
 	else
 		val = image->image->GetPixel(x, y);
 	image->lock.unlock();
 	return val;
 }
 
+__declspec(dllexport) void CompressToolsLib::ReadHeightValues(CompressedImageFileHdl image, const uint32_t* xs, const uint32_t* ys, uint32_t count, uint16_t* output, bool multithreaded)
+{
+	if (image->progressive)
+	{
+		for (uint32_t i = 0; i < count; ++i)
+			output[i] = ReadHeightValue(image, xs[i], ys[i]);
+		return;
+	}
+	image->lock.lock();
+	// HACK if preloading use preloaded cache
+	if (image->decodedPixels.size() > 0)
+	{
+		uint32_t width = image->image->GetWidth();
+		uint32_t height = image->image->GetHeight();
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (xs[i] >= width || ys[i] >= height)
+				output[i] = 0;
+			else
+				output[i] = image->decodedPixels[(size_t)ys[i] * width + xs[i]];
+		}
+	}
+	else
+	{
+		image->image->GetPixels(xs, ys, count, output, multithreaded);
+	}
+	image->lock.unlock();
+}
+
+__declspec(dllexport) float CompressToolsLib::SampleHeightBilinear(CompressedImageFileHdl image, float x, float y, float scale, float offset)
+{
+	image->lock.lock();
+	float val = image->image->SampleBilinear(x, y, scale, offset);
+	image->lock.unlock();
+	return val;
+}
+
+__declspec(dllexport) float CompressToolsLib::SampleHeightBicubic(CompressedImageFileHdl image, float x, float y, float scale, float offset)
+{
+	image->lock.lock();
+	float val = image->image->SampleBicubic(x, y, scale, offset);
+	image->lock.unlock();
+	return val;
+}
+
+__declspec(dllexport) void CompressToolsLib::SampleHeightsBilinear(CompressedImageFileHdl image, const float* xs, const float* ys, uint32_t count, float* output, float scale, float offset)
+{
+	image->lock.lock();
+	image->image->SampleBilinear(xs, ys, count, output, scale, offset);
+	image->lock.unlock();
+}
+
+__declspec(dllexport) void CompressToolsLib::SampleHeightsBicubic(CompressedImageFileHdl image, const float* xs, const float* ys, uint32_t count, float* output, float scale, float offset)
+{
+	image->lock.lock();
+	image->image->SampleBicubic(xs, ys, count, output, scale, offset);
+	image->lock.unlock();
+}
+
+__declspec(dllexport) void CompressToolsLib::SetRefineFocus(CompressedImageFileHdl image, uint32_t x, uint32_t y)
+{
+	if (image->progressive)
+		image->progressive->SetFocus(x, y);
+}
+
 __declspec(dllexport) void CompressToolsLib::CloseImage(CompressedImageFileHdl image)
 {
 	delete image;
@@ -78,6 +166,21 @@ __declspec(dllexport) void CompressToolsLib::SetLoggers(void(*debugLogger)(const
 	CompressTools::SetErrorLogger(errorLogger);
 }
 
+__declspec(dllexport) uint32_t CompressToolsLib::GetImageWidth(CompressedImageFileHdl image)
+{
+	return image->image->GetWidth();
+}
+
+__declspec(dllexport) uint32_t CompressToolsLib::GetImageHeight(CompressedImageFileHdl image)
+{
+	return image->image->GetHeight();
+}
+
+__declspec(dllexport) uint64_t CompressToolsLib::GetImagePixelCount(CompressedImageFileHdl image)
+{
+	return image->image->GetPixelCount();
+}
+
 __declspec(dllexport) uint32_t CompressToolsLib::GetImageWidthInBlocks(CompressedImageFileHdl image)
 {
 	image->lock.lock();
@@ -97,9 +200,17 @@ __declspec(dllexport) uint32_t CompressToolsLib::GetImageHeightInBlocks(Compress
 // outputs w
 __declspec(dllexport) void CompressToolsLib::GetBlockLODs(CompressedImageFileHdl image, uint8_t* output)
 {
-	image->lock.lock();
-	std::vector<uint8_t> blockLevels = image->image->GetBlockLevels();
-	image->lock.unlock();
+	std::vector<uint8_t> blockLevels;
+	if (image->progressive)
+	{
+		blockLevels = image->progressive->GetBlockLevels();
+	}
+	else
+	{
+		image->lock.lock();
+		blockLevels = image->image->GetBlockLevels();
+		image->lock.unlock();
+	}
 	memcpy(output, &blockLevels[0], sizeof(uint8_t) * blockLevels.size());
 }
 
@@ -113,6 +224,8 @@ __declspec(dllexport) uint32_t CompressToolsLib::GetMaxLOD(CompressedImageFileHd
 
 __declspec(dllexport) size_t CompressToolsLib::GetMemoryUsage(CompressedImageFileHdl image)
 {
+	if (image->progressive)
+		return image->progressive->GetMemoryUsage();
 	image->lock.lock();
 	size_t val = image->image->GetMemoryUsage();
 	image->lock.unlock();
@@ -128,3 +241,255 @@ __declspec(dllexport) void CompressToolsLib::GetBottomPixels(CompressedImageFile
 	return;
 }
 
+__declspec(dllexport) void CompressToolsLib::PrefetchRegion(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+	image->lock.lock();
+	// preloaded images already have everything
+	if (image->decodedPixels.size() == 0)
+		image->image->PrefetchRegion(x, y, width, height);
+	image->lock.unlock();
+}
+
+__declspec(dllexport) bool CompressToolsLib::UpdateRegion(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint16_t* values)
+{
+	// the refiner decodes from the file while it's running
+	if (image->progressive
+		|| x + (uint64_t)width > image->image->GetWidth()
+		|| y + (uint64_t)height > image->image->GetHeight())
+		return false;
+	image->lock.lock();
+	bool updated = image->image->UpdateRegion(x, y, width, height, values);
+	// keep preloaded pixels in sync
+	if (updated && image->decodedPixels.size() > 0)
+	{
+		for (uint32_t row = 0; row < height; ++row)
+			memcpy(&image->decodedPixels[(size_t)(y + row) * image->image->GetWidth() + x], &values[(size_t)row * width], width * sizeof(uint16_t));
+	}
+	image->lock.unlock();
+	return updated;
+}
+
+__declspec(dllexport) void CompressToolsLib::GetHeightBounds(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t* minValue, uint16_t* maxValue)
+{
+	*minValue = 0;
+	*maxValue = 0;
+	if (width == 0 || height == 0
+		|| x + (uint64_t)width > image->image->GetWidth()
+		|| y + (uint64_t)height > image->image->GetHeight())
+		return;
+	image->lock.lock();
+	HeightBounds bounds = image->image->GetBounds(x, y, width, height);
+	image->lock.unlock();
+	*minValue = bounds.minValue;
+	*maxValue = bounds.maxValue;
+}
+
+__declspec(dllexport) bool CompressToolsLib::RaycastHeightmap(CompressedImageFileHdl image, const float* origin, const float* dir, float maxT, float scale, float offset, float* hitPosition, float* hitT)
+{
+	if (scale <= 0.0f)
+		return false;
+	image->lock.lock();
+	RaycastHit hit;
+	bool hitSurface = image->image->Raycast(origin[0], origin[1], origin[2], dir[0], dir[1], dir[2], maxT, hit, scale, offset);
+	image->lock.unlock();
+	if (hitSurface)
+	{
+		hitPosition[0] = hit.x;
+		hitPosition[1] = hit.y;
+		hitPosition[2] = hit.z;
+		*hitT = hit.t;
+	}
+	return hitSurface;
+}
+
+__declspec(dllexport) bool CompressToolsLib::HasLineOfSight(CompressedImageFileHdl image, const float* from, const float* to, float scale, float offset)
+{
+	if (scale <= 0.0f)
+		return false;
+	image->lock.lock();
+	RaycastHit hit;
+	bool blocked = image->image->IntersectSegment(from[0], from[1], from[2], to[0], to[1], to[2], hit, scale, offset);
+	image->lock.unlock();
+	return !blocked;
+}
+
+__declspec(dllexport) void CompressToolsLib::GetLevelPixels(CompressedImageFileHdl image, uint32_t level, uint16_t* values)
+{
+	image->lock.lock();
+	std::vector<symbol_t> vals = image->image->GetLevelPixels(level);
+	memcpy(values, &vals[0], sizeof(symbol_t) * vals.size());
+	image->lock.unlock();
+}
+
+__declspec(dllexport) uint32_t CompressToolsLib::GetLevelWidth(CompressedImageFileHdl image, uint32_t level)
+{
+	return image->image->GetLevelWidth(level);
+}
+
+__declspec(dllexport) uint32_t CompressToolsLib::GetLevelHeight(CompressedImageFileHdl image, uint32_t level)
+{
+	return image->image->GetLevelHeight(level);
+}
+
+__declspec(dllexport) bool CompressToolsLib::IsHeightmapBusy(CompressedImageFileHdl image)
+{
+	if (image->progressive && !image->progressive->IsRefined())
+		return true;
+	return image->requests->IsBusy();
+}
+
+// requests work a block row at a time, returns the end of the strip starting at row
+static uint32_t GetStripEnd(CompressedImageFileHdl image, uint32_t row, uint32_t end)
+{
+	uint32_t blockSize = image->image->GetTileStride();
+	uint64_t stripEnd = ((uint64_t)row / blockSize + 1) * blockSize;
+	return (uint32_t)std::min<uint64_t>(stripEnd, end);
+}
+
+__declspec(dllexport) RequestTicket CompressToolsLib::RequestRegion(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t* output, int32_t priority)
+{
+	if (x + (uint64_t)width > image->image->GetWidth()
+		|| y + (uint64_t)height > image->image->GetHeight())
+		return 0;
+	uint32_t row = y;
+	uint32_t end = y + height;
+	return image->requests->Submit([=]() mutable
+	{
+		if (width == 0 || row >= end)
+			return true;
+		uint32_t stripEnd = GetStripEnd(image, row, end);
+		uint16_t* stripOutput = output + (size_t)(row - y) * width;
+		if (image->progressive)
+		{
+			image->progressive->GetRegion(x, row, width, stripEnd - row, stripOutput);
+		}
+		else
+		{
+			image->lock.lock();
+			// HACK if preloading use preloaded cache
+			if (image->decodedPixels.size() > 0)
+			{
+				for (uint32_t stripRow = row; stripRow < stripEnd; ++stripRow)
+					memcpy(stripOutput + (size_t)(stripRow - row) * width, &image->decodedPixels[(size_t)stripRow * image->image->GetWidth() + x], width * sizeof(uint16_t));
+			}
+			else
+			{
+				image->image->GetRegion(x, row, width, stripEnd - row, stripOutput);
+			}
+			image->lock.unlock();
+		}
+		row = stripEnd;
+		return row >= end;
+	}, priority);
+}
+
+__declspec(dllexport) RequestTicket CompressToolsLib::RequestPrefetch(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, int32_t priority)
+{
+	if (x + (uint64_t)width > image->image->GetWidth()
+		|| y + (uint64_t)height > image->image->GetHeight())
+		return 0;
+	uint32_t row = y;
+	uint32_t end = y + height;
+	return image->requests->Submit([=]() mutable
+	{
+		// preloaded images already have everything, and progressive ones refine on their own
+		if (width == 0 || row >= end || image->progressive)
+			return true;
+		uint32_t stripEnd = GetStripEnd(image, row, end);
+		image->lock.lock();
+		if (image->decodedPixels.size() == 0)
+			image->image->PrefetchRegion(x, row, width, stripEnd - row);
+		image->lock.unlock();
+		row = stripEnd;
+		return row >= end;
+	}, priority);
+}
+
+static_assert((int)AsyncRequestQueue::Status::Cancelled == RequestCancelled, "RequestStatus has to match AsyncRequestQueue::Status");
+
+__declspec(dllexport) RequestStatus CompressToolsLib::PollRequest(CompressedImageFileHdl image, RequestTicket ticket)
+{
+	return (RequestStatus)image->requests->Poll(ticket);
+}
+
+__declspec(dllexport) RequestStatus CompressToolsLib::WaitForRequest(CompressedImageFileHdl image, RequestTicket ticket)
+{
+	return (RequestStatus)image->requests->Wait(ticket);
+}
+
+__declspec(dllexport) bool CompressToolsLib::CancelRequest(CompressedImageFileHdl image, RequestTicket ticket)
+{
+	return image->requests->Cancel(ticket);
+}
+
+__declspec(dllexport) CompressedWorldFileHdl CompressToolsLib::OpenWorld(const char* manifestFilename)
+{
+	std::shared_ptr<TiledWorld> world = TiledWorld::Open(manifestFilename);
+	if (!world)
+	{
+		CompressTools::ErrorLog(std::string("Error opening world: ") + manifestFilename);
+		return nullptr;
+	}
+	CompressedWorldFileHdl worldHdl = new CompressedWorldFile();
+	worldHdl->world = world;
+	return worldHdl;
+}
+
+__declspec(dllexport) uint16_t CompressToolsLib::ReadWorldHeightValue(CompressedWorldFileHdl world, uint32_t x, uint32_t y)
+{
+	world->lock.lock();
+	uint16_t val = world->world->GetPixel(x, y);
+	world->lock.unlock();
+	return val;
+}
+
+__declspec(dllexport) void CompressToolsLib::ReadWorldHeightValues(CompressedWorldFileHdl world, const uint32_t* xs, const uint32_t* ys, uint32_t count, uint16_t* output, bool multithreaded)
+{
+	world->lock.lock();
+	world->world->GetPixels(xs, ys, count, output, multithreaded);
+	world->lock.unlock();
+}
+
+__declspec(dllexport) void CompressToolsLib::GetWorldRegion(CompressedWorldFileHdl world, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t* output)
+{
+	world->lock.lock();
+	world->world->GetRegion(x, y, width, height, output);
+	world->lock.unlock();
+}
+
+__declspec(dllexport) void CompressToolsLib::PrefetchWorldRegion(CompressedWorldFileHdl world, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+	world->lock.lock();
+	world->world->PrefetchRegion(x, y, width, height);
+	world->lock.unlock();
+}
+
+__declspec(dllexport) void CompressToolsLib::SetWorldCacheBudget(CompressedWorldFileHdl world, size_t bytes)
+{
+	world->lock.lock();
+	world->world->SetCacheBudget(bytes);
+	world->lock.unlock();
+}
+
+__declspec(dllexport) size_t CompressToolsLib::GetWorldMemoryUsage(CompressedWorldFileHdl world)
+{
+	world->lock.lock();
+	size_t val = world->world->GetMemoryUsage();
+	world->lock.unlock();
+	return val;
+}
+
+__declspec(dllexport) uint32_t CompressToolsLib::GetWorldWidth(CompressedWorldFileHdl world)
+{
+	return world->world->GetWidth();
+}
+
+__declspec(dllexport) uint32_t CompressToolsLib::GetWorldHeight(CompressedWorldFileHdl world)
+{
+	return world->world->GetHeight();
+}
+
+__declspec(dllexport) void CompressToolsLib::CloseWorld(CompressedWorldFileHdl world)
+{
+	delete world;
+}
@@ -9,7 +9,12 @@ namespace CompressToolsLib {
 	enum ImageMode
 	{
 		Streaming,
-		Preload
+		Preload,
+		// compressed file is kept in memory, blocks are decoded on demand
+		Resident,
+		// streamed, height reads never wait for a decode - they're interpolated from coarser data until
+		// a background thread has refined the block, ends up fully decoded like Preload
+		Progressive
 	};
 
 	struct CompressedImageFile;
@@ -18,15 +23,89 @@ namespace CompressToolsLib {
 	// need to use C strings...
 	__declspec(dllexport) CompressedImageFileHdl OpenImage(const char* filename, ImageMode mode = Streaming);
 	__declspec(dllexport) uint16_t ReadHeightValue(CompressedImageFileHdl image, uint32_t x, uint32_t y);
+	// batched ReadHeightValue, output[i] = height at (xs[i], ys[i])
+	__declspec(dllexport) void ReadHeightValues(CompressedImageFileHdl image, const uint32_t* xs, const uint32_t* ys, uint32_t count, uint16_t* output, bool multithreaded = false);
+	// interpolated heights in world units (height * scale + offset), positions are in pixels
+	__declspec(dllexport) float SampleHeightBilinear(CompressedImageFileHdl image, float x, float y, float scale, float offset);
+	__declspec(dllexport) float SampleHeightBicubic(CompressedImageFileHdl image, float x, float y, float scale, float offset);
+	__declspec(dllexport) void SampleHeightsBilinear(CompressedImageFileHdl image, const float* xs, const float* ys, uint32_t count, float* output, float scale, float offset);
+	__declspec(dllexport) void SampleHeightsBicubic(CompressedImageFileHdl image, const float* xs, const float* ys, uint32_t count, float* output, float scale, float offset);
+	// reads + decodes all blocks in the region ahead of time, with many reads in flight at once
+	__declspec(dllexport) void PrefetchRegion(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+	// writes width * height new heights into the file in place, only the blocks under the region are re-encoded
+	// returns false if the file couldn't be updated (needs a v5+ file, opened with Streaming or Preload)
+	__declspec(dllexport) bool UpdateRegion(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, const uint16_t* values);
+	// lowest + highest height in a region, for culling/collision without decoding the whole region
+	// both are 0 if the region is empty or goes outside the image
+	__declspec(dllexport) void GetHeightBounds(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t* minValue, uint16_t* maxValue);
+	// first point where a ray from origin to origin + dir * maxT meets the surface, x/y in pixels, z in world units (height * scale + offset)
+	// on a hit, hitPosition gets x, y, z and hitT the position along the ray in multiples of dir
+	__declspec(dllexport) bool RaycastHeightmap(CompressedImageFileHdl image, const float* origin, const float* dir, float maxT, float scale, float offset, float* hitPosition, float* hitT);
+	// true if the segment between two points doesn't touch the surface
+	__declspec(dllexport) bool HasLineOfSight(CompressedImageFileHdl image, const float* from, const float* to, float scale, float offset);
+	// Progressive images refine blocks nearest here first, does nothing for other modes
+	__declspec(dllexport) void SetRefineFocus(CompressedImageFileHdl image, uint32_t x, uint32_t y);
 	__declspec(dllexport) void CloseImage(CompressedImageFileHdl image);
 	// for debugging
 	__declspec(dllexport) void SetLoggers(void(*debugLogger)(const char*), void(*errorLogger)(const char*));
 	__declspec(dllexport) void GetBlockLODs(CompressedImageFileHdl image, uint8_t* output);
+	__declspec(dllexport) uint32_t GetImageWidth(CompressedImageFileHdl image);
+	__declspec(dllexport) uint32_t GetImageHeight(CompressedImageFileHdl image);
+	// width * height, 64-bit since big maps can have more than 4G pixels
+	__declspec(dllexport) uint64_t GetImagePixelCount(CompressedImageFileHdl image);
 	__declspec(dllexport) uint32_t GetImageWidthInBlocks(CompressedImageFileHdl image);
 	__declspec(dllexport) uint32_t GetImageHeightInBlocks(CompressedImageFileHdl image);
 	__declspec(dllexport) uint32_t GetMaxLOD(CompressedImageFileHdl image);
 	__declspec(dllexport) size_t GetMemoryUsage(CompressedImageFileHdl image);
 	// TOOD remove after testing?
+	// output is GetImagePixelCount() values
 	__declspec(dllexport) void GetBottomPixels(CompressedImageFileHdl image, uint16_t *values);
+	// reduced-resolution decode, output is GetLevelWidth() * GetLevelHeight() values
+	__declspec(dllexport) void GetLevelPixels(CompressedImageFileHdl image, uint32_t level, uint16_t* values);
+	__declspec(dllexport) uint32_t GetLevelWidth(CompressedImageFileHdl image, uint32_t level);
+	__declspec(dllexport) uint32_t GetLevelHeight(CompressedImageFileHdl image, uint32_t level);
+	// true while async requests are queued or running, or a Progressive image is still refining
 	__declspec(dllexport) bool IsHeightmapBusy(CompressedImageFileHdl image);
+
+	// async requests, run one at a time per image on a background thread so the calling thread never waits on a decode
+	// higher priorities run first. Requests are run a block row at a time, so blocking calls on the same image
+	// only wait for one row, and a cancelled request stops at the end of the row it's on
+	enum RequestStatus
+	{
+		// 0 ticket, or finished + already returned by PollRequest()/WaitForRequest()
+		RequestUnknown,
+		RequestQueued,
+		RequestRunning,
+		RequestDone,
+		RequestCancelled
+	};
+	typedef uint64_t RequestTicket;
+
+	// writes width * height heights into output, which has to stay valid until the request has finished
+	// returns 0 if the region goes outside the image
+	__declspec(dllexport) RequestTicket RequestRegion(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t* output, int32_t priority = 0);
+	// async PrefetchRegion()
+	__declspec(dllexport) RequestTicket RequestPrefetch(CompressedImageFileHdl image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, int32_t priority = 0);
+	// a finished request's status is only returned once, after that the ticket is forgotten
+	__declspec(dllexport) RequestStatus PollRequest(CompressedImageFileHdl image, RequestTicket ticket);
+	__declspec(dllexport) RequestStatus WaitForRequest(CompressedImageFileHdl image, RequestTicket ticket);
+	// returns false if the request has already finished
+	__declspec(dllexport) bool CancelRequest(CompressedImageFileHdl image, RequestTicket ticket);
+
+	// many .cif tiles read as one world, see TiledWorld.h for the manifest format
+	// tiles are opened on first read, positions outside every tile read as 0
+	struct CompressedWorldFile;
+	typedef CompressedWorldFile* CompressedWorldFileHdl;
+
+	__declspec(dllexport) CompressedWorldFileHdl OpenWorld(const char* manifestFilename);
+	__declspec(dllexport) uint16_t ReadWorldHeightValue(CompressedWorldFileHdl world, uint32_t x, uint32_t y);
+	__declspec(dllexport) void ReadWorldHeightValues(CompressedWorldFileHdl world, const uint32_t* xs, const uint32_t* ys, uint32_t count, uint16_t* output, bool multithreaded = false);
+	__declspec(dllexport) void GetWorldRegion(CompressedWorldFileHdl world, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t* output);
+	__declspec(dllexport) void PrefetchWorldRegion(CompressedWorldFileHdl world, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+	// memory all open tiles share, least recently used tiles are closed to stay under it
+	__declspec(dllexport) void SetWorldCacheBudget(CompressedWorldFileHdl world, size_t bytes);
+	__declspec(dllexport) size_t GetWorldMemoryUsage(CompressedWorldFileHdl world);
+	__declspec(dllexport) uint32_t GetWorldWidth(CompressedWorldFileHdl world);
+	__declspec(dllexport) uint32_t GetWorldHeight(CompressedWorldFileHdl world);
+	__declspec(dllexport) void CloseWorld(CompressedWorldFileHdl world);
 }
@@ -0,0 +1,472 @@
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CompressedImage.h"
+#include "CompressedImageWriter.h"
+#include "ProgressiveImage.h"
+#include "RansEncode.h"
+#include "WorkerPool.h"
+
+// regression tests for CompressToolsCore, returns non-zero if anything fails
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::fprintf(stderr, "%s(%d): CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures; \
+        } \
+    } while (0)
+
+static std::string TempPath(const char* name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+static void WriteFile(const std::string& filename, const std::vector<uint8_t>& bytes)
+{
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+static std::vector<uint8_t> ReadFile(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+}
+
+// smooth terrain with noise, spikes and a flat floor, like a real height map
+static std::vector<symbol_t> MakeMap(size_t width, size_t height, uint32_t seed)
+{
+    std::vector<symbol_t> values(width * height);
+    std::mt19937 rng(seed);
+    for (size_t y = 0; y < height; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            double terrain = std::sin(x * 0.002) * 3000 + std::cos(y * 0.0017) * 2000 + 20000;
+            symbol_t value = (symbol_t)(terrain + rng() % 64);
+            if (rng() % 5000 == 0)
+            {
+                value = (symbol_t)(rng() % 60000);
+            }
+            values[y * width + x] = terrain < 18000 ? 18000 : value;
+        }
+    }
+    return values;
+}
+
+static void SetRegion(std::vector<symbol_t>& values, size_t width, uint32_t x, uint32_t y, uint32_t regionWidth, uint32_t regionHeight, const std::vector<symbol_t>& pixels)
+{
+    for (uint32_t j = 0; j < regionHeight; ++j)
+    {
+        std::copy_n(&pixels[(size_t)j * regionWidth], regionWidth, &values[(y + j) * width + x]);
+    }
+}
+
+// every way of opening a file has to see the same pixels
+static void CheckReopen(const std::string& filename, const std::vector<symbol_t>& expected)
+{
+    std::shared_ptr<CompressedImage> stream = CompressedImage::OpenStream(filename);
+    CHECK(stream && stream->GetBottomLevelPixels() == expected);
+
+    std::shared_ptr<CompressedImage> resident = CompressedImage::OpenResident(filename);
+    CHECK(resident && resident->GetBottomLevelPixels() == expected);
+
+    std::vector<uint8_t> bytes = ReadFile(filename);
+    IteratorPtr<uint8_t> iterator = StreamFromVector<uint8_t>(&bytes);
+    std::shared_ptr<CompressedImage> deserialized = CompressedImage::Deserialize(*iterator);
+    CHECK(deserialized && deserialized->GetBottomLevelPixels() == expected);
+}
+
+// a table read from disk + GenerateEncodingTables() has to encode exactly like the table it was written from
+// tables without the fast path put padding in front of the slow path symbols, the encoder maps have to follow it
+static void TestRansTableFromFile()
+{
+    for (int variant = 0; variant < 3; ++variant)
+    {
+        SymbolCountDict counts;
+        std::mt19937 rng(variant);
+        for (int i = 0; i < 1024; ++i)
+        {
+            count_t count = variant == 0 ? 1 + rng() % 3 : variant == 1 ? (i < 10 ? 1000 : 2) : 1 + (i % 2);
+            counts[(symbol_t)(1000 + i * 3)] = count;
+        }
+
+        RansTable encodeTable(counts, PROBABILITY_RES);
+        std::shared_ptr<RansTable> fileTable = std::make_shared<RansTable>(encodeTable.GenerateGroupCDFs(), PROBABILITY_RES);
+        fileTable->GenerateEncodingTables();
+
+        std::vector<symbol_t> symbols(20000);
+        for (symbol_t& symbol : symbols)
+        {
+            symbol = (symbol_t)(1000 + (rng() % 1024) * 3);
+        }
+
+        RansState encoder(fileTable);
+        for (symbol_t symbol : symbols)
+        {
+            encoder.AddSymbol(symbol);
+        }
+
+        std::vector<block_t> compressedBlocks = encoder.GetCompressedBlocks();
+        std::shared_ptr<VectorStream<block_t>> blocks = std::make_shared<VectorVectorStream<block_t>>(compressedBlocks);
+        RansState decoder(blocks, encoder.GetRansState(), fileTable);
+        bool matches = true;
+        for (size_t i = symbols.size(); i-- > 0;)
+        {
+            matches &= decoder.ReadSymbol() == symbols[i];
+        }
+        CHECK(matches);
+    }
+}
+
+// small edits, then one noisy edit big enough to outgrow the parent image's spare room
+static void TestUpdateRegionReopen()
+{
+    const size_t width = 1000, height = 777;
+    const std::string filename = TempPath("CompressToolsTests_update.cif");
+    std::vector<symbol_t> values = MakeMap(width, height, 1);
+    {
+        CompressedImage image(values, width, height, 32);
+        WriteFile(filename, image.Serialize());
+    }
+
+    std::shared_ptr<CompressedImage> image = CompressedImage::OpenStream(filename);
+    std::mt19937 rng(3);
+
+    // block 0, an edge block and a single pixel
+    std::vector<symbol_t> flat(40 * 40, 4242);
+    CHECK(image->UpdateRegion(0, 0, 40, 40, flat.data()));
+    SetRegion(values, width, 0, 0, 40, 40, flat);
+    std::vector<symbol_t> edge(30 * 17, 100);
+    CHECK(image->UpdateRegion(width - 30, height - 17, 30, 17, edge.data()));
+    SetRegion(values, width, width - 30, height - 17, 30, 17, edge);
+    std::vector<symbol_t> pixel(1, 65535);
+    CHECK(image->UpdateRegion(500, 400, 1, 1, pixel.data()));
+    SetRegion(values, width, 500, 400, 1, 1, pixel);
+    CheckReopen(filename, values);
+
+    for (int edit = 0; edit < 3; ++edit)
+    {
+        uint32_t x = (edit * 131) % 800, y = (edit * 97) % 600, regionWidth = 150 + edit * 20, regionHeight = 150;
+        std::vector<symbol_t> noise((size_t)regionWidth * regionHeight);
+        for (symbol_t& value : noise)
+        {
+            value = (symbol_t)(rng() % 65536);
+        }
+        CHECK(image->UpdateRegion(x, y, regionWidth, regionHeight, noise.data()));
+        SetRegion(values, width, x, y, regionWidth, regionHeight, noise);
+        CHECK(image->GetBottomLevelPixels() == values);
+        CheckReopen(filename, values);
+    }
+
+    image.reset();
+    std::filesystem::remove(filename);
+}
+
+// updating one copy of a shared block body mustn't change the other copies
+static void TestUpdateRegionSharedBodies()
+{
+    const size_t width = 512, height = 512, blockSize = 32;
+    const std::string filename = TempPath("CompressToolsTests_shared.cif");
+    std::vector<symbol_t> values = MakeMap(width, height, 2);
+    for (size_t y = 0; y < height / 2; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            values[y * width + x] = values[(y % blockSize) * width + x % blockSize];
+        }
+    }
+    {
+        CompressedImage image(values, width, height, blockSize);
+        WriteFile(filename, image.Serialize());
+    }
+
+    std::shared_ptr<CompressedImage> image = CompressedImage::OpenStream(filename);
+    std::vector<symbol_t> pixels(8 * 8, 7);
+    CHECK(image->UpdateRegion(64, 32, 8, 8, pixels.data()));
+    SetRegion(values, width, 64, 32, 8, 8, pixels);
+    CHECK(image->GetBottomLevelPixels() == values);
+    image.reset();
+    CheckReopen(filename, values);
+
+    std::filesystem::remove(filename);
+}
+
+// edge blocks have less levels, above their root only the parent vals are stored
+static void TestLevelPixelsAboveEdgeRoots()
+{
+    const std::string filename = TempPath("CompressToolsTests_levels.cif");
+    for (size_t blockSize : { 8, 32 })
+    {
+        const size_t width = 212, height = 282;
+        std::vector<symbol_t> values = MakeMap(width, height, 5);
+        {
+            CompressedImage image(values, width, height, blockSize);
+            WriteFile(filename, image.Serialize());
+        }
+
+        std::shared_ptr<CompressedImage> stream = CompressedImage::OpenStream(filename);
+        std::shared_ptr<CompressedImage> resident = CompressedImage::OpenResident(filename);
+        CHECK(stream->GetLevelPixels(0) == values);
+        for (uint32_t level = 1; level <= stream->GetTopLOD(); ++level)
+            CHECK(stream->GetLevelPixels(level) == resident->GetLevelPixels(level));
+    }
+    std::filesystem::remove(filename);
+}
+
+// once IsRefined() every block has to be exact
+// the small image fits in one batch, so pass 0 starts with blocks the coarse pass has only just queued
+static void TestProgressiveImageRefines()
+{
+    const std::string filename = TempPath("CompressToolsTests_progressive.cif");
+    for (size_t width : { 96, 1000 })
+    {
+        size_t height = width * 7 / 9;
+        std::vector<symbol_t> values = MakeMap(width, height, 6);
+        for (size_t blockSize : { 16, 32, 64 })
+        {
+            {
+                CompressedImage image(values, width, height, blockSize);
+                WriteFile(filename, image.Serialize());
+            }
+
+            for (bool resident : { false, true })
+            {
+                ProgressiveImage progressive(resident ? CompressedImage::OpenResident(filename) : CompressedImage::OpenStream(filename));
+                while (!progressive.IsRefined())
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+                std::vector<uint8_t> levels = progressive.GetBlockLevels();
+                CHECK(std::count(levels.begin(), levels.end(), 0) == (ptrdiff_t)levels.size());
+                std::vector<symbol_t> region(width * height);
+                progressive.GetRegion(0, 0, (uint32_t)width, (uint32_t)height, region.data());
+                CHECK(region == values);
+            }
+        }
+    }
+    std::filesystem::remove(filename);
+}
+
+// requests lock the image like CompressToolsLib does, while the caller does a blocking read under the same lock
+// with every worker busy, the caller helps out with the pool's queue - it mustn't be handed the request
+static void TestRequestsWithLockHeld()
+{
+    const std::string filename = TempPath("CompressToolsTests_requests.cif");
+    size_t width = 600;
+    size_t height = 500;
+    std::vector<symbol_t> values = MakeMap(width, height, 7);
+    {
+        CompressedImage image(values, width, height, 32);
+        WriteFile(filename, image.Serialize());
+    }
+
+    std::shared_ptr<CompressedImage> image = CompressedImage::OpenStream(filename);
+    std::mutex imageLock;
+    AsyncRequestQueue requests;
+
+    std::atomic<bool> release(false);
+    for (size_t i = 0; i < WorkerPool::GetShared().GetThreadCount(); ++i)
+    {
+        WorkerPool::GetShared().Submit([&]
+        {
+            while (!release)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+    }
+
+    std::vector<symbol_t> region(width * height);
+    AsyncRequestQueue::Ticket ticket = requests.Submit([&]
+    {
+        std::lock_guard<std::mutex> guard(imageLock);
+        image->GetRegion(0, 0, (uint32_t)width, (uint32_t)height, region.data());
+        return true;
+    });
+    std::thread releaser([&]
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        release = true;
+    });
+    {
+        std::lock_guard<std::mutex> guard(imageLock);
+        image->PrefetchRegion(0, 0, (uint32_t)width, (uint32_t)height);
+    }
+    releaser.join();
+
+    CHECK(requests.Wait(ticket) == AsyncRequestQueue::Status::Done);
+    CHECK(region == values);
+    image.reset();
+    std::filesystem::remove(filename);
+}
+
+// more than 4G of one symbol, which overflowed a 32-bit count_t
+static void TestRansTableLargeCounts()
+{
+    SymbolCountDict counts;
+    counts[0] = 1ull << 33;
+    counts[1] = 3;
+    for (symbol_t symbol = 2; symbol < 200; ++symbol)
+    {
+        counts[symbol] = 1ull << 20;
+    }
+
+    std::shared_ptr<RansTable> table = std::make_shared<RansTable>(counts, PROBABILITY_RES);
+    std::vector<symbol_t> symbols(5000);
+    std::mt19937 rng(4);
+    for (symbol_t& symbol : symbols)
+    {
+        symbol = rng() % 4 == 0 ? (symbol_t)(rng() % 200) : 0;
+    }
+
+    RansState encoder(table);
+    for (symbol_t symbol : symbols)
+    {
+        encoder.AddSymbol(symbol);
+    }
+
+    std::vector<block_t> compressedBlocks = encoder.GetCompressedBlocks();
+    std::shared_ptr<VectorStream<block_t>> blocks = std::make_shared<VectorVectorStream<block_t>>(compressedBlocks);
+    RansState decoder(blocks, encoder.GetRansState(), table);
+    bool matches = true;
+    for (size_t i = symbols.size(); i-- > 0;)
+    {
+        matches &= decoder.ReadSymbol() == symbols[i];
+    }
+    CHECK(matches);
+    // the flat symbol has to be almost free
+    CHECK(table->GetSymbolBits(0) < 0.1);
+}
+
+// flat sea floor with a few bumps, one of them in the far corner, past 4G pixels in
+class SparseScanlineSource : public ScanlineSource
+{
+public:
+    static constexpr uint32_t WIDTH = 65600;
+    static constexpr uint32_t HEIGHT = 65700;
+    static constexpr symbol_t FLOOR = 1000;
+
+    static symbol_t GetValue(uint32_t x, uint32_t y)
+    {
+        bool bump = ((x % 16384) < 300 && (y % 16384) < 200) || (x >= WIDTH - 250 && y >= HEIGHT - 180);
+        return bump ? (symbol_t)(2000 + ((x * 7 + y * 13) % 97) * 30 + ((x ^ y) % 5)) : FLOOR;
+    }
+
+    uint32_t GetWidth() const override
+    {
+        return WIDTH;
+    }
+
+    uint32_t GetHeight() const override
+    {
+        return HEIGHT;
+    }
+
+    bool ReadRows(uint32_t startRow, uint32_t rowCount, symbol_t* output) override
+    {
+        for (uint32_t j = 0; j < rowCount; ++j)
+        {
+            uint32_t y = startRow + j;
+            symbol_t* row = output + (size_t)j * WIDTH;
+            std::fill_n(row, WIDTH, FLOOR);
+            // only rows with bumps need every pixel
+            if ((y % 16384) < 200 || y >= HEIGHT - 180)
+            {
+                for (uint32_t x = 0; x < WIDTH; ++x)
+                {
+                    row[x] = GetValue(x, y);
+                }
+            }
+        }
+        return true;
+    }
+};
+
+// a map bigger than 65536x65536, written without ever being in memory
+// every block is counted, so the flat floor's zero wavelets go past 4G too
+static void TestLargeSparseMap()
+{
+    typedef SparseScanlineSource Source;
+    const std::string filename = TempPath("CompressToolsTests_large.cif");
+    {
+        Source source;
+        CompressedImageWriter writer(source, 256);
+        CHECK(writer.Write(filename));
+    }
+
+    std::shared_ptr<CompressedImage> image = CompressedImage::OpenStream(filename);
+    CHECK(image && image->GetPixelCount() == (uint64_t)Source::WIDTH * Source::HEIGHT);
+    CHECK(image->GetPixelCount() > 0xFFFFFFFFull);
+
+    const uint32_t lastX = Source::WIDTH - 1, lastY = Source::HEIGHT - 1;
+    for (uint32_t y : { 0u, 199u, 200u, 16384u, lastY - 180, lastY - 179, lastY })
+    {
+        for (uint32_t x : { 0u, 299u, 300u, 32768u, lastX - 250, lastX - 249, lastX })
+        {
+            CHECK(image->GetPixel(x, y) == Source::GetValue(x, y));
+        }
+    }
+
+    const uint32_t regionX = Source::WIDTH - 400, regionY = Source::HEIGHT - 300, regionWidth = 400, regionHeight = 300;
+    std::vector<symbol_t> region((size_t)regionWidth * regionHeight);
+    image->GetRegion(regionX, regionY, regionWidth, regionHeight, region.data());
+    bool matches = true;
+    for (uint32_t j = 0; j < regionHeight; ++j)
+    {
+        for (uint32_t i = 0; i < regionWidth; ++i)
+        {
+            matches &= region[(size_t)j * regionWidth + i] == Source::GetValue(regionX + i, regionY + j);
+        }
+    }
+    CHECK(matches);
+
+    HeightBounds flat = image->GetBounds(20000, 20000, 10000, 10000);
+    CHECK(flat.minValue == Source::FLOOR && flat.maxValue == Source::FLOOR);
+
+    // update the far corner, then reopen
+    std::vector<symbol_t> pixels(300 * 200, 4242);
+    CHECK(image->UpdateRegion(Source::WIDTH - 300, Source::HEIGHT - 200, 300, 200, pixels.data()));
+    image.reset();
+    for (std::shared_ptr<CompressedImage> reopened : { CompressedImage::OpenStream(filename), CompressedImage::OpenResident(filename) })
+    {
+        CHECK(reopened->GetPixel(lastX, lastY) == 4242 && reopened->GetPixel(Source::WIDTH - 300, Source::HEIGHT - 200) == 4242);
+        CHECK(reopened->GetPixel(Source::WIDTH - 301, lastY) == Source::GetValue(Source::WIDTH - 301, lastY));
+        CHECK(reopened->GetPixel(100, 100) == Source::GetValue(100, 100));
+    }
+
+    std::filesystem::remove(filename);
+}
+
+int main()
+{
+    TestRansTableFromFile();
+    TestRansTableLargeCounts();
+    TestUpdateRegionReopen();
+    TestUpdateRegionSharedBodies();
+    TestLevelPixelsAboveEdgeRoots();
+    TestProgressiveImageRefines();
+    TestRequestsWithLockHeld();
+    TestLargeSparseMap();
+
+    if (failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}
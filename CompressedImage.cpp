@@ -1,7 +1,15 @@
 #include "CompressedImage.h"
 
 #include <iostream>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
 #include "Release_Assert.h"
+#include "WorkerPool.h"
+#include "AsyncFileReader.h"
+#include "WaveletZeroTree.h"
+#include "BlockBodyDedup.h"
+#include "CompactBlockIndex.h"
 
 SymbolCountDict GenerateSymbolCountDictionary(std::vector<symbol_t> symbols)
 {
@@ -23,6 +31,7 @@ CompressedImage::CompressedImage(const std::vector<symbol_t>& values, size_t wid
 
     // generate blocks
     std::vector<symbol_t> waveletValues;
+    WaveletZeroTreeStats zeroTreeStats;
     std::cout << "Generating image blocks..." << std::endl;
     for (size_t blockStartY = 0; blockStartY < height; blockStartY += blockSize)
     {
@@ -48,6 +57,7 @@ CompressedImage::CompressedImage(const std::vector<symbol_t>& values, size_t wid
             if (blockX == 50 && blockY == 50)
                 std::cout << "Chosen block hash: " << HashVec(blockValues) << " Num. wavelets: " << layerWavelets.size() << std::endl;
             waveletValues.insert(waveletValues.end(), layerWavelets.begin(), layerWavelets.end());
+            block->AddZeroTreeStats(zeroTreeStats);
             compressedImageBlocks.emplace_back(block);
         }
     }
@@ -55,6 +65,8 @@ CompressedImage::CompressedImage(const std::vector<symbol_t>& values, size_t wid
     std::cout << waveletValues.size() << " wavelet values..." << std::endl;
     std::cout << "Generating symbol counts..." << std::endl;
     globalSymbolCounts = GenerateSymbolCountDictionary(waveletValues);
+    // zeros under zero flags aren't coded
+    zeroTreeStats.AdjustCounts(globalSymbolCounts);
     std::cout << compressedImageBlocks.size() << " blocks created." << std::endl;
 }
 
@@ -68,76 +80,66 @@ void WriteSymbolTable(std::vector<uint8_t>& outputBytes, const TableGroupList& g
     }
 }
 
-TableGroupList ReadSymbolTable(ByteIterator &bytes)
+TableGroupList ReadSymbolTable(const std::vector<uint8_t>& bytes, uint64_t& readPos)
 {
     TableGroupList groupList;
-    groupList.resize(ReadValue<group_t>(bytes));
+    groupList.resize(ReadValue<group_t>(bytes, readPos));
     for (int group = 0; group < groupList.size(); ++group)
     {
-        groupList[group].first = ReadValue<prob_t>(bytes);
-        groupList[group].second = ReadVector<symbol_t>(bytes);
+        groupList[group].first = ReadValue<prob_t>(bytes, readPos);
+        groupList[group].second = ReadVector<symbol_t>(bytes, readPos);
     }
 
     return groupList;
 }
 
-std::vector<uint8_t> CompressedImage::Serialize()
+uint32_t CompressedImage::GetParentValsSize(uint32_t size, uint32_t blockSize)
 {
-    std::vector<uint8_t> byteStream;
-
-    // Header is written to position 0 later (need to rANS encode first)
-    byteStream.resize(sizeof(header));
-
-    // write global symbol table
-    std::cout << "Unique symbols: " << globalSymbolCounts.size() << std::endl;
-    
-    // generate rANS symbol table (currently costly)
-    globalSymbolTable = std::make_shared<RansTable>(globalSymbolCounts, PROBABILITY_RES);
-
-    // write symbol table
-    std::cout << "Writing symbol table..." << std::endl;
-    WriteSymbolTable(byteStream, globalSymbolTable->GenerateGroupCDFs());
-
-    // Generate wavelet image for parent vals
-   // parent block parents, wavelet counts, header, body
-    size_t parentValsWidth = header.width / (header.blockSize / 2);
-    if (header.width % (header.blockSize) != 0)
-        parentValsWidth += 1;
-    size_t parentValsHeight = header.height / (header.blockSize / 2);
-    if (header.height % (header.blockSize) != 0)
-        parentValsHeight += 1;
+    return ((size + blockSize - 1) / blockSize) * 2;
+}
 
-    // get parent values
-    std::vector<symbol_t> parentValues;
-    parentValues.resize(parentValsWidth * parentValsHeight);
-    size_t parentValCount = 0;
-    for (size_t blockIdx  = 0; blockIdx < compressedImageBlocks.size(); ++blockIdx)
+void CompressedImage::StoreRootParentVals(CompressedImageBlock& block, size_t blockX, size_t blockY, symbol_t* parentValues, size_t parentValsWidth)
+{
+    // TODO this will need to change for interpolated wavelets
+    std::vector<symbol_t> blockParentVals = block.GetParentVals();
+    WaveletLayerSize rootParentSize = block.GetSize().GetRoot().GetParentSize();
+    if (blockParentVals.size() != rootParentSize.GetPixelCount())
+        std::cout << "Invalid number of parent vals! " << blockParentVals.size() << " " << rootParentSize.GetPixelCount() << std::endl;
+
+    // write to parent val image (de-swizzle)
+    // thin edge blocks can have less than 2x2, the rest is filled with the nearest val
+    for (uint32_t y = 0; y < 2; ++y)
     {
-        std::shared_ptr<CompressedImageBlock> block = compressedImageBlocks[blockIdx];
-        std::vector<symbol_t> blockParentVals = block->GetParentVals();
-        // TODO this will need to change for interpolated wavelets
-        WaveletLayerSize rootParentSize = block->GetSize().GetRoot().GetParentSize();
-        size_t blockY = blockIdx / GetWidthInBlocks();
-        size_t blockX = blockIdx % GetWidthInBlocks();
-
-        if (blockParentVals.size() != rootParentSize.GetPixelCount())
-            std::cout << "Invalid number of parent vals! " << blockParentVals.size() << " " << rootParentSize.GetPixelCount() << std::endl;
-
-        // write to parent val image (de-swizzle)
-        for (int y = 0; y < rootParentSize.GetHeight(); ++y)
-            for (int x = 0; x < rootParentSize.GetWidth(); ++x)
-                parentValues[(blockY * 2 + y) * parentValsWidth + (blockX * 2 + x)] = blockParentVals[y * rootParentSize.GetWidth() + x];
+        for (uint32_t x = 0; x < 2; ++x)
+        {
+            uint32_t srcX = std::min(x, rootParentSize.GetWidth() - 1);
+            uint32_t srcY = std::min(y, rootParentSize.GetHeight() - 1);
+            parentValues[(blockY * 2 + y) * parentValsWidth + (blockX * 2 + x)] = blockParentVals[srcY * rootParentSize.GetWidth() + srcX];
+        }
+    }
+}
 
-        //parentValues.insert(parentValues.end(), blockParentVals.begin(), blockParentVals.end());
-        parentValCount += blockParentVals.size();
+void CompressedImage::WriteParentImage(std::vector<uint8_t>& byteStream, const std::vector<symbol_t>& parentValues, size_t parentValsWidth, size_t parentValsHeight)
+{
+    size_t parentImageStart = byteStream.size();
+    // big parent val images are a nested image, size first, 0 = single block
+    if (parentValsWidth > PARENT_PYRAMID_BLOCK_SIZE || parentValsHeight > PARENT_PYRAMID_BLOCK_SIZE)
+    {
+        std::cout << "Writing parent val pyramid..." << std::endl;
+        // it's always re-encoded whole, so it never needs a fixed-size index
+        CompressedImage pyramid(parentValues, parentValsWidth, parentValsHeight, PARENT_PYRAMID_BLOCK_SIZE);
+        pyramid.SetCompactIndex(true);
+        std::vector<uint8_t> pyramidBytes = pyramid.Serialize();
+        WriteValue(byteStream, (uint64_t)pyramidBytes.size());
+        byteStream.insert(byteStream.end(), pyramidBytes.begin(), pyramidBytes.end());
+        byteStream.resize(byteStream.size() + pyramidBytes.size() / PARENT_IMAGE_SLACK_DIVISOR + PARENT_IMAGE_SLACK_MIN);
+        std::cout << "Parent pyramid size:" << (byteStream.size() - parentImageStart) << std::endl;
+        return;
     }
+    WriteValue(byteStream, (uint64_t)0);
 
-    if (parentValues.size() != parentValCount)
-        std::cout << "Wrong number of parent values! " << parentValues.size() << " " <<  parentValCount << " " << parentValsWidth << " " << parentValsHeight << std::endl;
-    
-    // create parent vals image
+    // parent block parents, wavelet counts, header, body
     std::shared_ptr<CompressedImageBlock> parentValsImage = std::make_shared< CompressedImageBlock>(parentValues, parentValsWidth, parentValsHeight);
-    size_t parentImageStart = byteStream.size();
 
     // write parent val block parents
     WriteVector(byteStream, parentValsImage->GetParentVals());
@@ -161,41 +163,119 @@ std::vector<uint8_t> CompressedImage::Serialize()
     // write out body bytes
     byteStream.insert(byteStream.end(), parentValsBodyBytes.begin(), parentValsBodyBytes.end());
 
+    // spare room so UpdateRegion() can re-encode the parent image without moving the index
+    byteStream.resize(byteStream.size() + parentValsBodyBytes.size() / PARENT_IMAGE_SLACK_DIVISOR + PARENT_IMAGE_SLACK_MIN);
+
     std::cout << "Parent block size:" << (byteStream.size() - parentImageStart) << std::endl;
+}
+
+void CompressedImage::SetCompactIndex(bool compact)
+{
+    compactIndex = compact;
+}
+
+std::vector<uint8_t> CompressedImage::Serialize()
+{
+    std::vector<uint8_t> byteStream;
+
+    // Header is written to position 0 later (need to rANS encode first)
+    byteStream.resize(sizeof(header));
+
+    // write global symbol table
+    std::cout << "Unique symbols: " << globalSymbolCounts.size() << std::endl;
+    
+    // generate rANS symbol table (currently costly)
+    globalSymbolTable = std::make_shared<RansTable>(globalSymbolCounts, PROBABILITY_RES);
 
-    // Write block bodies + generate headers
-    size_t blockHeaderPos = byteStream.size();
-    std::vector<CompressedImageBlockHeader> blockHeaders;
+    // write symbol table
+    std::cout << "Writing symbol table..." << std::endl;
+    WriteSymbolTable(byteStream, globalSymbolTable->GenerateGroupCDFs());
+
+    // Generate wavelet image for parent vals
+    size_t parentValsWidth = GetParentValsSize(header.width, header.blockSize);
+    size_t parentValsHeight = GetParentValsSize(header.height, header.blockSize);
+
+    // get parent values
+    std::vector<symbol_t> parentValues;
+    parentValues.resize(parentValsWidth * parentValsHeight);
+    for (size_t blockIdx  = 0; blockIdx < compressedImageBlocks.size(); ++blockIdx)
+    {
+        size_t blockY = blockIdx / GetWidthInBlocks();
+        size_t blockX = blockIdx % GetWidthInBlocks();
+        StoreRootParentVals(*compressedImageBlocks[blockIdx], blockX, blockY, &parentValues[0], parentValsWidth);
+    }
+
+    WriteParentImage(byteStream, parentValues, parentValsWidth, parentValsHeight);
+
+    // Write block bodies + generate index
+    std::vector<CompressedImageBlockIndexEntry> blockIndex;
     std::vector<uint8_t> bodyBytes;
-    std::cout << "Generating block bodies and headers..." << std::endl;
+    std::vector<uint8_t> blockBody;
+    BlockBodyDedup bodyDedup;
+    std::cout << "Generating block bodies and index..." << std::endl;
     for (auto block : compressedImageBlocks)
     {
         //std::cout << "New block... "  << block.first.first << " " << block.first.second << std::endl;
-        size_t bodyWritePos = bodyBytes.size();
+        blockBody.clear();
+        // constant blocks are just their min/max, so they don't get a body
         // this secretly updates the header
-        block->WriteBody(bodyBytes, globalSymbolTable);
-        // generate header with block byte position
-        CompressedImageBlockHeader header = CompressedImageBlockHeader(block->GetHeader(), bodyWritePos);
-        //std::cout << "rANS state: " << header.GetFinalRANSState() << std::endl;
-        blockHeaders.push_back(header);
+        if (!block->IsConstant())
+            block->WriteBody(blockBody, globalSymbolTable, true);
+        CompressedImageBlockIndexEntry entry;
+        entry.offset = bodyBytes.size();
+        entry.length = blockBody.size();
+        // bodies that have already been written are shared instead
+        auto sameBody = [&](uint64_t offset) { return memcmp(&bodyBytes[offset], blockBody.data(), blockBody.size()) == 0; };
+        if (bodyDedup.Find(blockBody, entry.offset, sameBody))
+        {
+            bodyDedup.AddSavedBytes(blockBody.size());
+        }
+        else
+        {
+            bodyDedup.Add(blockBody, entry.offset);
+            bodyBytes.insert(bodyBytes.end(), blockBody.begin(), blockBody.end());
+        }
+        entry.finalRansState = block->GetHeader().GetFinalRansState();
+        entry.flags = block->IsConstant() ? CompressedImageBlockIndexEntry::FLAG_CONSTANT : 0;
+        entry.minValue = block->GetMinValue();
+        entry.maxValue = block->GetMaxValue();
+        memcpy(entry.levelEnds, block->GetHeader().GetLevelEnds(), sizeof(entry.levelEnds));
+        //std::cout << "rANS state: " << entry.finalRansState << std::endl;
+        blockIndex.push_back(entry);
     }
-    std::cout << "Block bodies size: " << bodyBytes.size() << std::endl;
-
-    // Write generated headers
-    std::cout << "Writing block headers..." << std::endl;
-    size_t headersStart = byteStream.size();
-    for (auto blockHeader : blockHeaders)
+    std::cout << "Block bodies size: " << bodyBytes.size() << " (" << bodyDedup.GetSavedBytes() << " bytes of duplicates shared)" << std::endl;
+
+    // Write block index
+    std::cout << "Writing block index..." << std::endl;
+    CompressedImageFooter footer;
+    footer.indexStart = byteStream.size();
+    footer.blockCount = blockIndex.size();
+    CompressedImageIndexTrailer trailer;
+    if (compactIndex)
+    {
+        CompactBlockIndex::Write(blockIndex, byteStream);
+        trailer.compactIndexSize = byteStream.size() - footer.indexStart;
+    }
+    else
     {
-        blockHeader.Write(byteStream);
+        for (auto entry : blockIndex)
+        {
+            WriteValue(byteStream, entry);
+        }
     }
-    std::cout << "Headers size: " << (byteStream.size() - headersStart) << std::endl;
+    WriteValue(byteStream, trailer);
+    std::cout << "Index size: " << (byteStream.size() - footer.indexStart) << std::endl;
 
     // Write encoded block bodies
     std::cout << "Position at: " << byteStream.size() << std::endl;
     std::cout << "Writing block bodies..." << std::endl;
+    header.version = CompressedImageHeader::CURR_VERSION;
     header.blockBodyStart = byteStream.size();
     byteStream.insert(byteStream.end(), bodyBytes.begin(), bodyBytes.end());
 
+    // write footer
+    WriteValue(byteStream, footer);
+
     // write header
     memcpy(&byteStream[0], &header, sizeof(header));
     std::cout << "Final size: " << byteStream.size() << std::endl;
@@ -215,94 +295,245 @@ std::shared_ptr<CompressedImage> CompressedImage::GenerateFromStream(ByteIterato
 
     assert_release(header.IsCorrect());
 
-    size_t parentValsWidth = header.width / (header.blockSize / 2);
-    if (header.width % (header.blockSize) != 0)
-        parentValsWidth += 1;
-    size_t parentValsHeight = header.height / (header.blockSize / 2);
-    if (header.height % (header.blockSize) != 0)
-        parentValsHeight += 1;
+    // copy everything before the block bodies in one read so it can be parsed from memory
+    std::vector<uint8_t> headerBytes;
+    headerBytes.resize(header.blockBodyStart);
+    memcpy(&headerBytes[0], &header, sizeof(header));
+    bytes.Read(&headerBytes[sizeof(header)], headerBytes.size() - sizeof(header));
 
-    // global block symbol counts
-    TableGroupList waveletSymbolGroups = ReadSymbolTable(bytes);
-    // generate rANS symbol table (currently costly)
-    std::shared_ptr<RansTable> globalSymbolTable = std::make_shared<RansTable>(waveletSymbolGroups, PROBABILITY_RES);
+    return GenerateFromBytes(headerBytes);
+}
 
-    // read parent val block parents
-    std::vector<symbol_t> parentValImageParents = ReadVector<symbol_t>(bytes);
+// parses everything up to blockBodyStart, anything after is ignored
+std::shared_ptr<CompressedImage> CompressedImage::GenerateFromBytes(const std::vector<uint8_t>& bytes)
+{
+    uint64_t readPos = 0;
+    CompressedImageHeader header = ReadValue<CompressedImageHeader>(bytes, readPos);
+    assert_release(header.IsCorrect());
+    assert_release(bytes.size() >= header.blockBodyStart);
+
+    std::shared_ptr<CompressedImage> image = std::make_shared<CompressedImage>();
+    image->header = header;
+    image->parentValsWidth = GetParentValsSize(header.width, header.blockSize);
+    // everything's already in memory, so there's no point leaving the tables for later
+    std::call_once(image->tablesLoaded, [&]() { image->ReadTables(bytes, readPos); });
+
+    // read block headers
+    size_t blockCount = (size_t)image->GetWidthInBlocks() * image->GetHeightInBlocks();
+    if (header.version >= 0x0005)
+    {
+        // index is right before the bodies (+ trailer) - there can be spare room between it and the parent image
+        size_t trailerStart = header.blockBodyStart - CompressedImageIndexTrailer::GetSize(header.version);
+        assert_release(trailerStart >= readPos);
+        CompressedImageIndexTrailer trailer;
+        if (header.version >= 0x000C)
+            memcpy(&trailer, &bytes[trailerStart], sizeof(trailer));
+        size_t indexSize = trailer.compactIndexSize > 0 ? trailer.compactIndexSize : blockCount * CompressedImageBlockIndexEntry::GetSize(header.version);
+        assert_release(indexSize <= trailerStart - readPos);
+        size_t indexStart = trailerStart - indexSize;
+        bool validIndex = image->ReadIndex(&bytes[indexStart], header.blockBodyStart - indexStart);
+        assert_release(validIndex);
+    }
+    else
+    {
+        image->blockPositions.reserve(blockCount);
+        image->blockLengths.reserve(blockCount);
+        image->blockRansStates.reserve(blockCount);
+        for (size_t blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+        {
+            // parent vals come from the parent val image instead
+            CompressedImageBlockHeader blockHeader = CompressedImageBlockHeader::Read(bytes, readPos, std::vector<symbol_t>(), 0, 0);
+            // v4 positions are 32-bit, with padding garbage above them
+            image->blockPositions.push_back((uint32_t)blockHeader.GetBlockPos());
+            image->blockRansStates.push_back(blockHeader.GetFinalRansState());
+        }
 
-    // read parent val block wavelet counts
-    TableGroupList parentValImageWaveletGroups = ReadSymbolTable(bytes);
-    std::shared_ptr<RansTable> parentBlockSymbolTable = std::make_shared<RansTable>(parentValImageWaveletGroups, PROBABILITY_RES);
+        // v4 has no lengths, but bodies are written in order so they can be worked out
+        // the last one depends on the file size, so it's left to the caller
+        for (size_t blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+        {
+            if (blockIdx + 1 < blockCount)
+                image->blockLengths.push_back(image->blockPositions[blockIdx + 1] - image->blockPositions[blockIdx]);
+            else
+                image->blockLengths.push_back(0);
+        }
+        image->AddIndexOverhead();
+    }
 
-    // read parent val block header
-    CompressedImageBlockHeader parentValImageHeader = CompressedImageBlockHeader::Read(bytes, parentValImageParents, parentValsWidth, parentValsHeight);
+    image->BuildBlockAliases();
 
-    // read parent val image
-    IteratorPtr<block_t> bodyStream = IteratorPtr<block_t>(bytes.castToBlocks());
-    // TODO this is dumb - move bytes by same amount
-    SkipVector<block_t>(bytes);
+    return std::move(image);
+}
 
-    std::shared_ptr <CompressedImageBlock> block = std::make_shared<CompressedImageBlock>(parentValImageHeader, *bodyStream, parentBlockSymbolTable);
+std::shared_ptr<CompressedImage> CompressedImage::GenerateFromIndex(const CompressedImageHeader& header, const CompressedImageFooter& footer, const uint8_t* indexBytes)
+{
+    std::shared_ptr<CompressedImage> image = std::make_shared<CompressedImage>();
+    image->header = header;
+    image->parentValsWidth = GetParentValsSize(header.width, header.blockSize);
+    image->tablesEnd = footer.indexStart;
+    if (!image->ReadIndex(indexBytes, header.blockBodyStart - footer.indexStart))
+        return std::shared_ptr<CompressedImage>();
+    return image;
+}
 
-    // Decode parent values
-    std::vector<symbol_t> rawParentVals = block->GetBottomLevelPixels();
+void CompressedImage::ReadTables(const std::vector<uint8_t>& bytes, uint64_t& readPos)
+{
+    size_t parentValsHeight = GetParentValsSize(header.height, header.blockSize);
 
-    // Re-swizzle
-    // TODO there are nicer ways of doing this
-    std::vector<symbol_t> parentVals;
-    for (int y = 0; y < parentValsHeight; y += 2)
+    // global block symbol counts
+    TableGroupList waveletSymbolGroups = ReadSymbolTable(bytes, readPos);
+    // generate rANS symbol table (currently costly)
+    globalSymbolTable = std::make_shared<RansTable>(waveletSymbolGroups, PROBABILITY_RES);
+
+    // v11+: parent val image size if it's a pyramid, 0 if it's a single block
+    uint64_t pyramidSize = 0;
+    if (header.version >= 0x000B)
     {
-        for (int x = 0; x < parentValsWidth; x += 2)
-        {
-            parentVals.push_back(rawParentVals[y * parentValsWidth + x]);
-            if (x + 1 < parentValsWidth)
-                parentVals.push_back(rawParentVals[y * parentValsWidth + x + 1]);
-            if (y + 1 < parentValsHeight)
-                parentVals.push_back(rawParentVals[(y + 1) * parentValsWidth + x]);
-            if (x + 1 < parentValsWidth && y + 1 < parentValsHeight)
-                parentVals.push_back(rawParentVals[(y + 1) * parentValsWidth + x + 1]);
-        }
+        parentImageStart = readPos;
+        pyramidSize = ReadValue<uint64_t>(bytes, readPos);
+    }
+    if (pyramidSize > 0)
+    {
+        // only the top of the pyramid is decoded, its blocks are read from this copy as root vals are needed
+        assert_release(readPos + pyramidSize <= bytes.size());
+        std::shared_ptr<std::vector<uint8_t>> pyramidBytes = std::make_shared<std::vector<uint8_t>>(bytes.begin() + readPos, bytes.begin() + readPos + pyramidSize);
+        parentPyramid = OpenResident(pyramidBytes);
+        assert_release(parentPyramid && parentPyramid->GetWidth() == parentValsWidth && parentPyramid->GetHeight() == parentValsHeight);
+        hasParentPyramid = true;
+        readPos += pyramidSize;
+    }
+    else
+    {
+        // read parent val block parents
+        parentImageStart = readPos;
+        std::vector<symbol_t> parentValImageParents = ReadVector<symbol_t>(bytes, readPos);
+
+        // read parent val block wavelet counts
+        TableGroupList parentValImageWaveletGroups = ReadSymbolTable(bytes, readPos);
+        parentSymbolTable = std::make_shared<RansTable>(parentValImageWaveletGroups, PROBABILITY_RES);
+
+        // read parent val block header
+        parentBlockHeaderStart = readPos;
+        CompressedImageBlockHeader parentValImageHeader = CompressedImageBlockHeader::Read(bytes, readPos, parentValImageParents, parentValsWidth, parentValsHeight);
+
+        // read parent val image
+        IteratorPtr<block_t> bodyStream = StreamFromVector<block_t>(&bytes, readPos);
+        VectorHeader<block_t> bodyHeader = ReadValue<VectorHeader<block_t>>(bytes, readPos);
+        readPos += bodyHeader.count * sizeof(block_t);
+
+        // Decode parent values, kept as a 2D image - no need to split them up per block
+        std::shared_ptr <CompressedImageBlock> block = std::make_shared<CompressedImageBlock>(parentValImageHeader, *bodyStream, parentSymbolTable);
+        parentVals = block->GetBottomLevelPixels();
     }
 
-    if (rawParentVals.size() != parentVals.size())
-        std::cerr << "De-swizzle changed num. parent vals!" << std::endl;
+    size_t tablesOverhead = parentVals.capacity() * sizeof(parentVals[0]) + globalSymbolTable->GetMemoryFootprint();
+    memoryOverhead += tablesOverhead;
+    currentCacheSize += tablesOverhead;
+}
 
-    // read block headers
-    std::vector<CompressedImageBlockHeader> headers;
-    auto parentVal = parentVals.begin();
-    for (uint32_t blockStartY = 0; blockStartY < header.height; blockStartY += header.blockSize)
+bool CompressedImage::ReadIndex(const uint8_t* indexBytes, size_t indexSize)
+{
+    size_t blockCount = (size_t)GetWidthInBlocks() * GetHeightInBlocks();
+    size_t trailerSize = CompressedImageIndexTrailer::GetSize(header.version);
+    if (indexSize < trailerSize)
+        return false;
+    CompressedImageIndexTrailer trailer;
+    if (header.version >= 0x000C)
+        memcpy(&trailer, indexBytes + indexSize - trailerSize, sizeof(trailer));
+    size_t entriesSize = indexSize - trailerSize;
+
+    if (trailer.compactIndexSize > 0)
     {
-        for (uint32_t blockStartX = 0; blockStartX < header.width; blockStartX += header.blockSize)
+        if (trailer.compactIndexSize != entriesSize)
+            return false;
+        compactIndex = true;
+        boundsPyramid.resize(1);
+        if (!CompactBlockIndex::Read(indexBytes, entriesSize, blockCount, blockPositions, blockLengths, blockRansStates, blockLevelEnds, boundsPyramid[0]))
+            return false;
+        BuildBoundsPyramid();
+        AddIndexOverhead();
+        return true;
+    }
+
+    size_t entrySize = CompressedImageBlockIndexEntry::GetSize(header.version);
+    if (blockCount * entrySize != entriesSize)
+        return false;
+    blockPositions.reserve(blockCount);
+    blockLengths.reserve(blockCount);
+    blockRansStates.reserve(blockCount);
+    if (header.version >= 0x0007)
+        blockLevelEnds.reserve(blockCount * CompressedImageBlockHeader::MAX_LEVEL_ENDS);
+    if (header.version >= 0x0006)
+        boundsPyramid.resize(1);
+    for (size_t blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+    {
+        CompressedImageBlockIndexEntry entry = {};
+        memcpy(&entry, indexBytes + blockIdx * entrySize, entrySize);
+        blockPositions.push_back(entry.offset);
+        blockLengths.push_back(entry.length);
+        blockRansStates.push_back(entry.finalRansState);
+        if (header.version >= 0x0007)
+            blockLevelEnds.insert(blockLevelEnds.end(), std::begin(entry.levelEnds), std::end(entry.levelEnds));
+        if (header.version >= 0x0006)
         {
-            size_t blockW = std::min(header.width - blockStartX, header.blockSize);
-            size_t blockH = std::min(header.height - blockStartY, header.blockSize);
-            WaveletLayerSize rootParentSize = WaveletLayerSize(blockW, blockH).GetRoot().GetParentSize();
-            std::vector<symbol_t> blockParents;
-            blockParents.insert(blockParents.end(), parentVal, parentVal + rootParentSize.GetPixelCount());
-            parentVal += rootParentSize.GetPixelCount();
-            CompressedImageBlockHeader header = CompressedImageBlockHeader::Read(bytes, blockParents, blockW, blockH);
-            headers.push_back(header);
+            HeightBounds bounds;
+            bounds.minValue = entry.minValue;
+            bounds.maxValue = entry.maxValue;
+            boundsPyramid[0].push_back(bounds);
         }
     }
+    if (header.version >= 0x0006)
+        BuildBoundsPyramid();
+    AddIndexOverhead();
+    return true;
+}
 
-    std::cout << headers.size() << " block headers read." << std::endl;
+void CompressedImage::AddIndexOverhead()
+{
+    std::cout << blockPositions.size() << " block headers read." << std::endl;
 
     // get theoretical RAM usage
-    size_t memoryOverhead = 0;
-    for (auto header : headers)
-        memoryOverhead += header.GetMemoryFootprint();
-    memoryOverhead += globalSymbolTable->GetMemoryFootprint();
+    size_t indexOverhead = 0;
+    indexOverhead += blockPositions.capacity() * sizeof(blockPositions[0]);
+    indexOverhead += blockLengths.capacity() * sizeof(blockLengths[0]);
+    indexOverhead += blockRansStates.capacity() * sizeof(blockRansStates[0]);
+    indexOverhead += blockLevelEnds.capacity() * sizeof(uint16_t);
+    for (auto& level : boundsPyramid)
+        indexOverhead += level.capacity() * sizeof(HeightBounds);
+    memoryOverhead += indexOverhead;
+    currentCacheSize += indexOverhead;
     std::cout << "Header memory overhead: " << memoryOverhead << " bytes." << std::endl;
 
-    std::shared_ptr<CompressedImage> image = std::make_shared<CompressedImage>();
-    image->header = header;
-    image->globalSymbolTable = globalSymbolTable;
-    image->blockHeaders = std::move(headers);
-    image->currentCacheSize = memoryOverhead;
-    image->memoryOverhead = memoryOverhead;
-    image->compressedImageBlocks.resize(image->GetWidthInBlocks()*image->GetHeightInBlocks());
+    compressedImageBlocks.resize(blockPositions.size());
+}
 
-    return std::move(image);
+void CompressedImage::LoadTables()
+{
+    std::call_once(tablesLoaded, [this]()
+    {
+        // images that weren't opened from their index already have them
+        if (tablesEnd == 0)
+            return;
+
+        uint64_t readPos = sizeof(CompressedImageHeader);
+        if (residentFile)
+        {
+            ReadTables(*residentFile, readPos);
+        }
+        else
+        {
+            // own stream, the shared one can be in use on another thread
+            std::vector<uint8_t> tableBytes(tablesEnd);
+            FastFileStream tableStream(filename);
+            tableStream.Read(tableBytes.data(), tableBytes.size());
+            assert_release(!tableStream.Failed());
+            ReadTables(tableBytes, readPos);
+        }
+        assert_release(readPos <= tablesEnd);
+
+        // aliases have to match root parent vals, so they can't be found before now
+        BuildBlockAliases();
+    });
 }
 
 std::shared_ptr<CompressedImage> CompressedImage::Deserialize(ByteIterator &bytes)
@@ -318,36 +549,37 @@ std::shared_ptr<CompressedImage> CompressedImage::Deserialize(ByteIterator &byte
 
     // read block bodies
     std::vector<std::shared_ptr<CompressedImageBlock>>& blocks = image->compressedImageBlocks;
-    auto blockHeader = image->blockHeaders.begin();
     std::cout << "Decoding block bodies..." << std::endl;
     // hack to deal with late evaluation of block body
-    size_t lastBlockStart = blockHeader->GetBlockPos();
-    for (uint32_t blockStartY = 0; blockStartY < header.height; blockStartY += header.blockSize)
+    // the stream starts at the bodies, block 0 isn't always first (UpdateRegion() appends new bodies)
+    size_t lastBlockStart = 0;
+    for (size_t blockIdx = 0; blockIdx < blocks.size(); ++blockIdx)
     {
-        for (uint32_t blockStartX = 0; blockStartX < header.width; blockStartX += header.blockSize)
+        uint32_t blockX = blockIdx % widthInBlocks;
+        uint32_t blockY = blockIdx / widthInBlocks;
+
+        // constant blocks have nothing to decode, they're filled in from their bounds
+        if (image->IsConstantBlock(blockIdx))
+            continue;
+        // aliases decode to the same pixels, so they share the block
+        if (image->GetSharedBlockIndex(blockIdx) != blockIdx)
         {
-            uint32_t blockX = blockStartX / header.blockSize;
-            uint32_t blockY = blockStartY / header.blockSize;
-            uint32_t blockW = std::min(header.width - blockStartX, header.blockSize);
-            uint32_t blockH = std::min(header.height - blockStartY, header.blockSize);
-
-            // seek to block start
-            bytes += blockHeader->GetBlockPos() - lastBlockStart;
-            lastBlockStart = blockHeader->GetBlockPos();
-
-            // read parent val image
-            IteratorPtr<block_t> bodyStream = IteratorPtr<block_t>(bytes.castToBlocks());
+            blocks[blockIdx] = blocks[image->GetSharedBlockIndex(blockIdx)];
+            continue;
+        }
 
-            std::shared_ptr <CompressedImageBlock> block = std::make_shared<CompressedImageBlock>(*blockHeader, *bodyStream, image->globalSymbolTable);
-            if (blockX == 50 && blockY == 50)
-                std::cout << "Chosen block hash: " << HashVec(block->GetBottomLevelPixels()) << std::endl;
+        // seek to block start
+        bytes += image->blockPositions[blockIdx] - lastBlockStart;
+        lastBlockStart = image->blockPositions[blockIdx];
 
-            size_t blockIdx = blockY * widthInBlocks + blockX;
-            blocks[blockIdx] = block;
+        // read parent val image
+        IteratorPtr<block_t> bodyStream = IteratorPtr<block_t>(bytes.castToBlocks());
 
+        std::shared_ptr <CompressedImageBlock> block = std::make_shared<CompressedImageBlock>(image->GetBlockHeader(blockIdx), *bodyStream, image->globalSymbolTable);
+        if (blockX == 50 && blockY == 50)
+            std::cout << "Chosen block hash: " << HashVec(block->GetBottomLevelPixels()) << std::endl;
 
-            ++blockHeader;
-        }
+        blocks[blockIdx] = block;
     }
 
     return std::move(image);
@@ -363,12 +595,51 @@ std::shared_ptr<CompressedImage> CompressedImage::OpenStream(std::string filenam
     if (compressedFile.Failed())
         return std::shared_ptr<CompressedImage>();
 
-    ByteIteratorPtr bytes = StreamFromFile<uint8_t>(&compressedFile);
+    CompressedImageHeader header;
+    compressedFile.Read(&header, sizeof(header));
+    if (compressedFile.Failed() || !header.IsCorrect())
+        return std::shared_ptr<CompressedImage>();
 
-    // read headers
-    std::shared_ptr<CompressedImage> image = GenerateFromStream(*bytes);
-    std::cout << "Stream pos: " << compressedFile.GetPosition() << std::endl;
-    image->blockBodiesStart = compressedFile.GetPosition();
+    size_t fileSize = compressedFile.GetSize();
+    std::shared_ptr<CompressedImage> image;
+    CompressedImageFooter footer;
+    if (header.version >= 0x0005)
+    {
+        compressedFile.Seek(fileSize - sizeof(footer));
+        compressedFile.Read(&footer, sizeof(footer));
+        if (compressedFile.Failed() || !footer.IsCorrect() || footer.indexStart < sizeof(header) || footer.indexStart > header.blockBodyStart)
+        {
+            std::cerr << "Invalid footer in CompressedImage::OpenStream()" << std::endl;
+            return std::shared_ptr<CompressedImage>();
+        }
+
+        // only the index is read up front, the tables + parent image are read the first time a block needs them
+        std::vector<uint8_t> indexBytes(header.blockBodyStart - footer.indexStart);
+        compressedFile.Seek(footer.indexStart);
+        compressedFile.Read(indexBytes.data(), indexBytes.size());
+        if (compressedFile.Failed())
+            return std::shared_ptr<CompressedImage>();
+        image = GenerateFromIndex(header, footer, indexBytes.data());
+    }
+    else
+    {
+        // read everything before the block bodies in one go, parsing byte-by-byte from the file is slow
+        std::vector<uint8_t> headerBytes;
+        headerBytes.resize(header.blockBodyStart);
+        memcpy(&headerBytes[0], &header, sizeof(header));
+        compressedFile.Read(&headerBytes[sizeof(header)], headerBytes.size() - sizeof(header));
+        if (compressedFile.Failed())
+            return std::shared_ptr<CompressedImage>();
+        image = GenerateFromBytes(headerBytes);
+    }
+
+    if (!image || !image->CheckBlockData(fileSize, footer))
+    {
+        std::cerr << "Invalid index in CompressedImage::OpenStream()" << std::endl;
+        return std::shared_ptr<CompressedImage>();
+    }
+    image->blockBodiesStart = header.blockBodyStart;
+    image->filename = filename;
     // close + reopen file (std::move gives buggy behaviour)
     compressedFile.Close();
     image->fileStream = FastFileStream(filename);
@@ -376,22 +647,98 @@ std::shared_ptr<CompressedImage> CompressedImage::OpenStream(std::string filenam
     return image;
 }
 
+// Reads the whole file into memory
+std::shared_ptr<CompressedImage> CompressedImage::OpenResident(std::string filename)
+{
+    FastFileStream compressedFile(filename);
+    if (compressedFile.Failed())
+        return std::shared_ptr<CompressedImage>();
+
+    // one sequential read for everything
+    std::shared_ptr<std::vector<uint8_t>> fileBytes = std::make_shared<std::vector<uint8_t>>(compressedFile.GetSize());
+    compressedFile.Read(fileBytes->data(), fileBytes->size());
+    if (compressedFile.Failed())
+        return std::shared_ptr<CompressedImage>();
+
+    std::shared_ptr<CompressedImage> image = OpenResident(fileBytes);
+    if (image)
+        image->filename = filename;
+    return image;
+}
+
+std::shared_ptr<CompressedImage> CompressedImage::OpenResident(std::shared_ptr<const std::vector<uint8_t>> fileBytes)
+{
+    if (fileBytes->size() < sizeof(CompressedImageHeader))
+        return std::shared_ptr<CompressedImage>();
+
+    CompressedImageHeader header;
+    memcpy(&header, fileBytes->data(), sizeof(header));
+    if (!header.IsCorrect() || header.blockBodyStart > fileBytes->size())
+        return std::shared_ptr<CompressedImage>();
+
+    std::shared_ptr<CompressedImage> image;
+    CompressedImageFooter footer;
+    if (header.version >= 0x0005)
+    {
+        if (fileBytes->size() < header.blockBodyStart + sizeof(footer))
+            return std::shared_ptr<CompressedImage>();
+        memcpy(&footer, &(*fileBytes)[fileBytes->size() - sizeof(footer)], sizeof(footer));
+        if (!footer.IsCorrect() || footer.indexStart < sizeof(header) || footer.indexStart > header.blockBodyStart)
+        {
+            std::cerr << "Invalid footer in CompressedImage::OpenResident()" << std::endl;
+            return std::shared_ptr<CompressedImage>();
+        }
+        // tables + parent image are parsed from the buffer on first use, like OpenStream()
+        image = GenerateFromIndex(header, footer, &(*fileBytes)[footer.indexStart]);
+    }
+    else
+    {
+        image = GenerateFromBytes(*fileBytes);
+    }
+
+    if (!image || !image->CheckBlockData(fileBytes->size(), footer))
+    {
+        std::cerr << "Invalid index in CompressedImage::OpenResident()" << std::endl;
+        return std::shared_ptr<CompressedImage>();
+    }
+    image->blockBodiesStart = header.blockBodyStart;
+
+    // file buffer is part of the minimum footprint
+    image->residentFile = fileBytes;
+    image->memoryOverhead += fileBytes->capacity();
+    image->currentCacheSize += fileBytes->capacity();
+
+    return image;
+}
+
+bool CompressedImage::CheckBlockData(size_t fileSize, const CompressedImageFooter& footer)
+{
+    // v5+ the index has already been read from where the footer points, just check they agree
+    if (header.version >= 0x0005)
+        return footer.IsCorrect() && footer.blockCount == blockPositions.size();
+
+    // v4 last block runs to the end of the file
+    if (!blockLengths.empty())
+        blockLengths.back() = fileSize - header.blockBodyStart - blockPositions.back();
+    return true;
+}
+
+bool CompressedImage::ReadsFromFile() const
+{
+    return !filename.empty() && !residentFile;
+}
+
 // Gets/creates the block for the given index
 std::shared_ptr<CompressedImageBlock> CompressedImage::GetBlock(size_t index)
 {
-    std::shared_ptr<CompressedImageBlock> foundBlock = compressedImageBlocks[index];
+    std::shared_ptr<CompressedImageBlock>& foundBlock = GetBlockSlot(index);
 
     // create block if needed
     if (!foundBlock)
     {
-        CompressedImageBlockHeader& header = blockHeaders[index];
-
-        // Create new byte iterator at block body start
-        IteratorPtr<block_t> blocks = StreamFromFile<block_t>(&fileStream, blockBodiesStart + header.GetBlockPos());
+        std::shared_ptr <CompressedImageBlock> block = CreateBlock(index, &fileStream);
 
-        std::shared_ptr <CompressedImageBlock> block = std::make_shared<CompressedImageBlock>(header, *blocks, globalSymbolTable);
-
-        compressedImageBlocks[index] = block;
+        foundBlock = block;
 
         // add memory overhead of block
         currentCacheSize += block->GetMemoryFootprint();
@@ -404,10 +751,87 @@ std::shared_ptr<CompressedImageBlock> CompressedImage::GetBlock(size_t index)
     }
 }
 
+void CompressedImage::EvictBlock(size_t index)
+{
+    // an alias's own slot is always empty, the block it shares still decodes to the right pixels for the others
+    if (compressedImageBlocks[index])
+    {
+        currentCacheSize -= compressedImageBlocks[index]->GetMemoryFootprint();
+        compressedImageBlocks[index] = std::shared_ptr<CompressedImageBlock>();
+    }
+    tileCache.Erase(index % GetWidthInBlocks(), (uint32_t)(index / GetWidthInBlocks()), index);
+}
+
+void CompressedImage::BuildBlockAliases()
+{
+    size_t oldFootprint = blockAliases.capacity() * sizeof(uint32_t);
+    blockAliases.clear();
+    blockAliases.shrink_to_fit();
+
+    // a shared body only decodes to the same pixels with the same rANS state, size and root parent vals
+    auto IsSameBlock = [&](size_t sharedIdx, size_t blockIdx)
+    {
+        if (blockLengths[sharedIdx] != blockLengths[blockIdx] || blockRansStates[sharedIdx] != blockRansStates[blockIdx])
+            return false;
+        // edge blocks are smaller
+        uint32_t sharedX = sharedIdx % GetWidthInBlocks();
+        uint32_t sharedY = (uint32_t)(sharedIdx / GetWidthInBlocks());
+        uint32_t blockX = blockIdx % GetWidthInBlocks();
+        uint32_t blockY = (uint32_t)(blockIdx / GetWidthInBlocks());
+        if (std::min(header.width - sharedX * header.blockSize, header.blockSize) != std::min(header.width - blockX * header.blockSize, header.blockSize)
+            || std::min(header.height - sharedY * header.blockSize, header.blockSize) != std::min(header.height - blockY * header.blockSize, header.blockSize))
+            return false;
+        for (uint32_t rootY = 0; rootY < 2; ++rootY)
+        {
+            for (uint32_t rootX = 0; rootX < 2; ++rootX)
+            {
+                if (GetRootParentVal(sharedIdx, rootX, rootY) != GetRootParentVal(blockIdx, rootX, rootY))
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    // only the first block at each body offset is checked against, it's enough for repeated tiles
+    std::unordered_map<uint64_t, uint32_t> firstAtPosition;
+    for (size_t blockIdx = 0; blockIdx < blockPositions.size(); ++blockIdx)
+    {
+        // v4 files and constant blocks can have empty bodies, which aren't shared
+        if (blockLengths[blockIdx] == 0 || IsConstantBlock(blockIdx))
+            continue;
+        auto first = firstAtPosition.emplace(blockPositions[blockIdx], (uint32_t)blockIdx);
+        if (first.second || !IsSameBlock(first.first->second, blockIdx))
+            continue;
+        if (blockAliases.empty())
+        {
+            blockAliases.resize(blockPositions.size());
+            for (size_t i = 0; i < blockAliases.size(); ++i)
+                blockAliases[i] = (uint32_t)i;
+        }
+        blockAliases[blockIdx] = first.first->second;
+    }
+
+    size_t newFootprint = blockAliases.capacity() * sizeof(uint32_t);
+    memoryOverhead = memoryOverhead + newFootprint - oldFootprint;
+    currentCacheSize = currentCacheSize + newFootprint - oldFootprint;
+}
+
+size_t CompressedImage::GetSharedBlockIndex(size_t index)
+{
+    // aliases are only known once the parent vals are
+    LoadTables();
+    return blockAliases.empty() ? index : blockAliases[index];
+}
+
+std::shared_ptr<CompressedImageBlock>& CompressedImage::GetBlockSlot(size_t index)
+{
+    return compressedImageBlocks[GetSharedBlockIndex(index)];
+}
+
 std::vector<symbol_t> CompressedImage::GetBottomLevelPixels()
 {
     std::vector<symbol_t> pixels;
-    pixels.resize(header.width * header.height);
+    pixels.resize(GetPixelCount());
 
     // recreate image from blocks
     for (uint32_t blockStartY = 0; blockStartY < header.height; blockStartY += header.blockSize)
@@ -420,6 +844,13 @@ std::vector<symbol_t> CompressedImage::GetBottomLevelPixels()
             uint32_t blockH = std::min(header.height - blockStartY, header.blockSize);
             size_t blockIdx = blockY * GetWidthInBlocks() + blockX;
 
+            if (IsConstantBlock(blockIdx))
+            {
+                for (uint32_t pixY = 0; pixY < blockH; ++pixY)
+                    std::fill_n(&pixels[(size_t)(blockStartY + pixY) * header.width + blockStartX], blockW, GetConstantValue(blockIdx));
+                continue;
+            }
+
             // creates if necessary
             std::shared_ptr<CompressedImageBlock> block = GetBlock(blockIdx);
 
@@ -432,7 +863,7 @@ std::vector<symbol_t> CompressedImage::GetBottomLevelPixels()
             {
                 for (uint32_t pixX = 0; pixX < blockW; ++pixX)
                 {
-                    pixels[(blockStartY + pixY) * header.width + (blockStartX + pixX)] = blockPixels[pixY * blockW + pixX];
+                    pixels[(size_t)(blockStartY + pixY) * header.width + (blockStartX + pixX)] = blockPixels[pixY * blockW + pixX];
                 }
             }
         }
@@ -441,6 +872,407 @@ std::vector<symbol_t> CompressedImage::GetBottomLevelPixels()
     return pixels;
 }
 
+const symbol_t* CompressedImage::GetBlockPixelData(size_t index)
+{
+    uint32_t blockX = index % GetWidthInBlocks();
+    uint32_t blockY = (uint32_t)(index / GetWidthInBlocks());
+    return GetTile(blockX, blockY);
+}
+
+const symbol_t* CompressedImage::GetTile(uint32_t blockX, uint32_t blockY)
+{
+    assert_release(blockX < GetWidthInBlocks() && blockY < GetHeightInBlocks());
+    size_t index = blockY * GetWidthInBlocks() + blockX;
+
+    AllocateTileCache();
+    const symbol_t* tile = tileCache.Find(blockX, blockY, index);
+    if (tile)
+        return tile;
+
+    if (IsConstantBlock(index))
+    {
+        // no decode, the tile is just filled
+        symbol_t* constantTile = tileCache.Insert(blockX, blockY, index);
+        std::fill_n(constantTile, (size_t)header.blockSize * header.blockSize, GetConstantValue(index));
+        return constantTile;
+    }
+
+    // cached blocks are reused, otherwise the block is only kept around long enough to fill the tile
+    std::shared_ptr<CompressedImageBlock> block = GetBlockSlot(index);
+    if (block)
+    {
+        currentCacheSize -= block->GetMemoryFootprint();
+        block->GetBottomLevelData();
+        currentCacheSize += block->GetMemoryFootprint();
+    }
+    else
+    {
+        block = CreateBlock(index, &fileStream);
+    }
+    return FillTile(blockX, blockY, block->GetBottomLevelData());
+}
+
+uint32_t CompressedImage::GetTileStride() const
+{
+    return header.blockSize;
+}
+
+void CompressedImage::AllocateTileCache()
+{
+    if (tileCache.IsAllocated())
+        return;
+    size_t tileBytes = (size_t)header.blockSize * header.blockSize * sizeof(symbol_t);
+    tileCache.Resize(header.blockSize, TILE_CACHE_BYTES / tileBytes);
+    currentCacheSize += tileCache.GetMemoryFootprint();
+}
+
+const symbol_t* CompressedImage::FillTile(uint32_t blockX, uint32_t blockY, const symbol_t* blockPixels)
+{
+    uint32_t blockW = std::min(header.width - blockX * header.blockSize, header.blockSize);
+    uint32_t blockH = std::min(header.height - blockY * header.blockSize, header.blockSize);
+    symbol_t* tile = tileCache.Insert(blockX, blockY, blockY * GetWidthInBlocks() + blockX);
+    // edge blocks are narrower than the tile, rows keep the full tile stride
+    for (uint32_t pixY = 0; pixY < blockH; ++pixY)
+        memcpy(&tile[pixY * header.blockSize], &blockPixels[pixY * blockW], blockW * sizeof(symbol_t));
+    return tile;
+}
+
+void CompressedImage::GetRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, symbol_t* output)
+{
+    assert_release(x + width <= header.width && y + height <= header.height);
+    if (width == 0 || height == 0)
+        return;
+
+    // go through the region a tile cache window at a time, so prefetched tiles can't evict each other
+    AllocateTileCache();
+    uint32_t windowPixels = tileCache.GetWindowSize() * header.blockSize;
+    uint32_t endX = x + width;
+    uint32_t endY = y + height;
+    for (uint32_t windowY = (y / windowPixels) * windowPixels; windowY < endY; windowY += windowPixels)
+    {
+        for (uint32_t windowX = (x / windowPixels) * windowPixels; windowX < endX; windowX += windowPixels)
+        {
+            uint32_t startX = std::max(x, windowX);
+            uint32_t startY = std::max(y, windowY);
+            uint32_t windowEndX = std::min<uint64_t>(endX, (uint64_t)windowX + windowPixels);
+            uint32_t windowEndY = std::min<uint64_t>(endY, (uint64_t)windowY + windowPixels);
+
+            // get all the missing blocks at once rather than one by one below
+            PrefetchRegion(startX, startY, windowEndX - startX, windowEndY - startY);
+
+            for (uint32_t blockStartY = (startY / header.blockSize) * header.blockSize; blockStartY < windowEndY; blockStartY += header.blockSize)
+            {
+                for (uint32_t blockStartX = (startX / header.blockSize) * header.blockSize; blockStartX < windowEndX; blockStartX += header.blockSize)
+                {
+                    uint32_t blockX = blockStartX / header.blockSize;
+                    uint32_t blockY = blockStartY / header.blockSize;
+                    const symbol_t* tile = GetTile(blockX, blockY);
+
+                    // overlap of block + region
+                    uint32_t copyStartX = std::max(startX, blockStartX);
+                    uint32_t copyEndX = std::min(windowEndX, blockStartX + header.blockSize);
+                    uint32_t copyStartY = std::max(startY, blockStartY);
+                    uint32_t copyEndY = std::min(windowEndY, blockStartY + header.blockSize);
+
+                    for (uint32_t pixY = copyStartY; pixY < copyEndY; ++pixY)
+                    {
+                        memcpy(&output[(size_t)(pixY - y) * width + (copyStartX - x)],
+                            &tile[(pixY - blockStartY) * header.blockSize + (copyStartX - blockStartX)],
+                            (copyEndX - copyStartX) * sizeof(symbol_t));
+                    }
+                }
+            }
+        }
+    }
+}
+
+void CompressedImage::PrefetchRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    if (width == 0 || height == 0 || x >= header.width || y >= header.height)
+        return;
+
+    uint32_t endBlockX = (std::min(x + width, header.width) - 1) / header.blockSize;
+    uint32_t endBlockY = (std::min(y + height, header.height) - 1) / header.blockSize;
+    std::vector<size_t> missingBlocks;
+    for (uint32_t blockY = y / header.blockSize; blockY <= endBlockY; ++blockY)
+    {
+        for (uint32_t blockX = x / header.blockSize; blockX <= endBlockX; ++blockX)
+        {
+            size_t blockIdx = blockY * GetWidthInBlocks() + blockX;
+            // constant blocks have nothing to read
+            if (!GetBlockSlot(blockIdx) && !IsConstantBlock(blockIdx) && !tileCache.Find(blockX, blockY, blockIdx))
+                missingBlocks.push_back(blockIdx);
+        }
+    }
+
+    FetchBlocks(missingBlocks);
+}
+
+void CompressedImage::FetchBlocks(const std::vector<size_t>& indices)
+{
+    // nothing to read if the whole image is in memory
+    if (indices.empty() || (!ReadsFromFile() && !residentFile))
+        return;
+
+    // aliases are only decoded once, then copied into each of their tiles
+    std::vector<size_t> fetchIndices;
+    std::vector<size_t> fetchedPositions;
+    std::unordered_map<size_t, size_t> sharedPositions;
+    for (size_t blockIdx : indices)
+    {
+        auto shared = sharedPositions.emplace(GetSharedBlockIndex(blockIdx), fetchIndices.size());
+        if (shared.second)
+            fetchIndices.push_back(shared.first->first);
+        fetchedPositions.push_back(shared.first->second);
+    }
+
+    std::vector<std::shared_ptr<CompressedImageBlock>> fetchedBlocks;
+    fetchedBlocks.resize(fetchIndices.size());
+    if (residentFile)
+    {
+        // bodies are already in memory, just decode
+        WorkerPool::GetShared().ParallelFor(fetchIndices.size(), [&](size_t start, size_t end)
+        {
+            for (size_t i = start; i < end; ++i)
+            {
+                fetchedBlocks[i] = CreateBlock(fetchIndices[i], nullptr);
+                fetchedBlocks[i]->GetBottomLevelData();
+            }
+        });
+    }
+    else
+    {
+        ReadBlocksAsync(fetchIndices, fetchedBlocks);
+    }
+
+    // only the decoded pixels are kept
+    AllocateTileCache();
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        uint32_t blockX = indices[i] % GetWidthInBlocks();
+        uint32_t blockY = (uint32_t)(indices[i] / GetWidthInBlocks());
+        FillTile(blockX, blockY, fetchedBlocks[fetchedPositions[i]]->GetBottomLevelData());
+    }
+}
+
+void CompressedImage::ReadBlocksAsync(const std::vector<size_t>& indices, std::vector<std::shared_ptr<CompressedImageBlock>>& fetchedBlocks)
+{
+    if (!asyncReader)
+        asyncReader = std::make_shared<AsyncFileReader>(filename);
+
+    // each callback only writes it's own slot
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        size_t blockIdx = indices[i];
+        asyncReader->Read(blockBodiesStart + blockPositions[blockIdx], blockLengths[blockIdx],
+            [this, blockIdx, i, &fetchedBlocks](std::shared_ptr<const std::vector<uint8_t>> body)
+        {
+            std::shared_ptr<CompressedImageBlock> block = CreateBlock(blockIdx, body);
+            block->GetBottomLevelData();
+            fetchedBlocks[i] = block;
+        });
+    }
+    asyncReader->Wait();
+}
+
+std::shared_ptr<CompressedImageBlock> CompressedImage::CreateBlock(size_t index, FastFileStream* stream, uint32_t level)
+{
+    LoadTables();
+    // resident images decode straight from the file buffer
+    if (residentFile)
+    {
+        IteratorPtr<block_t> blocks = StreamFromBuffer<block_t>(residentFile, blockBodiesStart + blockPositions[index]);
+        return std::make_shared<CompressedImageBlock>(GetBlockHeader(index), *blocks, globalSymbolTable);
+    }
+
+    return CreateBlock(index, ReadBlockBody(index, stream, level));
+}
+
+std::shared_ptr<CompressedImageBlock> CompressedImage::CreateBlock(size_t index, std::shared_ptr<const std::vector<uint8_t>> body)
+{
+    LoadTables();
+    return std::make_shared<CompressedImageBlock>(GetBlockHeader(index), body, globalSymbolTable);
+}
+
+std::shared_ptr<const std::vector<uint8_t>> CompressedImage::ReadBlockBody(size_t index, FastFileStream* stream, uint32_t level)
+{
+    // lengths are known up front, so the whole body is one read instead of a seek + read per rANS block
+    std::shared_ptr<std::vector<uint8_t>> body = std::make_shared<std::vector<uint8_t>>(GetBodyLength(index, level));
+    stream->Seek(blockBodiesStart + blockPositions[index]);
+    stream->Read(body->data(), body->size());
+    assert_release(!stream->Failed());
+    return body;
+}
+
+size_t CompressedImage::GetBodyLength(size_t index, uint32_t level) const
+{
+    if (blockLevelEnds.empty() || level == 0)
+        return blockLengths[index];
+
+    // levels past the last stored one need even less, so it's end is still enough
+    uint32_t endIdx = std::min(level, CompressedImageBlockHeader::MAX_LEVEL_ENDS) - 1;
+    size_t levelEnd = blockLevelEnds[index * CompressedImageBlockHeader::MAX_LEVEL_ENDS + endIdx] * sizeof(block_t);
+    if (levelEnd == 0 || levelEnd > blockLengths[index])
+        return blockLengths[index];
+    return levelEnd;
+}
+
+CompressedImageBlockHeader CompressedImage::GetBlockHeader(size_t index) const
+{
+    uint32_t blockX = index % GetWidthInBlocks();
+    uint32_t blockY = index / GetWidthInBlocks();
+    uint32_t blockW = std::min(header.width - blockX * header.blockSize, header.blockSize);
+    uint32_t blockH = std::min(header.height - blockY * header.blockSize, header.blockSize);
+    if (parentPyramid)
+    {
+        symbol_t rootVals[4];
+        std::lock_guard<std::mutex> guard(parentPyramidLock);
+        for (uint32_t rootY = 0; rootY < 2; ++rootY)
+        {
+            for (uint32_t rootX = 0; rootX < 2; ++rootX)
+                rootVals[rootY * 2 + rootX] = parentPyramid->GetPixel(blockX * 2 + rootX, blockY * 2 + rootY);
+        }
+        return CompressedImageBlockHeader(blockW, blockH, blockPositions[index], blockRansStates[index], rootVals, 2, header.version >= 0x0009);
+    }
+    const symbol_t* blockParentVals = &parentVals[(size_t)blockY * 2 * parentValsWidth + blockX * 2];
+    return CompressedImageBlockHeader(blockW, blockH, blockPositions[index], blockRansStates[index], blockParentVals, parentValsWidth, header.version >= 0x0009);
+}
+
+symbol_t CompressedImage::GetRootParentVal(size_t index, uint32_t rootX, uint32_t rootY) const
+{
+    uint32_t blockX = index % GetWidthInBlocks();
+    uint32_t blockY = index / GetWidthInBlocks();
+    if (parentPyramid)
+    {
+        std::lock_guard<std::mutex> guard(parentPyramidLock);
+        return parentPyramid->GetPixel(blockX * 2 + rootX, blockY * 2 + rootY);
+    }
+    return parentVals[(size_t)(blockY * 2 + rootY) * parentValsWidth + blockX * 2 + rootX];
+}
+
+bool CompressedImage::IsConstantBlock(size_t index) const
+{
+    return !boundsPyramid.empty() && boundsPyramid[0][index].minValue == boundsPyramid[0][index].maxValue;
+}
+
+symbol_t CompressedImage::GetConstantValue(size_t index) const
+{
+    return boundsPyramid[0][index].minValue;
+}
+
+std::vector<symbol_t> CompressedImage::GetLevelPixels(uint32_t level)
+{
+    assert_release(level <= GetTopLOD());
+
+    uint32_t levelWidth = GetLevelWidth(level);
+    uint32_t levelHeight = GetLevelHeight(level);
+    std::vector<symbol_t> pixels;
+    pixels.resize((size_t)levelWidth * levelHeight);
+
+    // cache size changes from blocks that were already cached
+    std::mutex cacheSizeLock;
+
+    WorkerPool::GetShared().ParallelFor(compressedImageBlocks.size(), [&](size_t start, size_t end)
+    {
+        // the shared file stream can't be used from multiple threads, so each range gets it's own
+        FastFileStream rangeStream;
+        if (ReadsFromFile())
+            rangeStream = FastFileStream(filename);
+
+        for (size_t blockIdx = start; blockIdx < end; ++blockIdx)
+        {
+            // aliases are copied from their shared block afterwards
+            if (GetSharedBlockIndex(blockIdx) != blockIdx)
+                continue;
+
+            uint32_t blockStartX = (blockIdx % GetWidthInBlocks()) * header.blockSize;
+            uint32_t blockStartY = (blockIdx / GetWidthInBlocks()) * header.blockSize;
+            uint32_t blockW = std::min(header.width - blockStartX, header.blockSize);
+            uint32_t blockH = std::min(header.height - blockStartY, header.blockSize);
+
+            std::vector<symbol_t> blockPixels;
+            WaveletLayerSize blockLevelSize = WaveletLayerSize(blockW, blockH);
+            for (uint32_t i = 0; i < level; ++i)
+                blockLevelSize = blockLevelSize.GetParentSize();
+
+            // edge blocks can have less levels than the full-size ones
+            WaveletLayerSize rootSize = WaveletLayerSize(blockW, blockH);
+            uint32_t rootLevel = 1;
+            while (!rootSize.IsRoot())
+            {
+                rootSize = rootSize.GetParentSize();
+                ++rootLevel;
+            }
+
+            std::shared_ptr<CompressedImageBlock> block = compressedImageBlocks[blockIdx];
+            if (IsConstantBlock(blockIdx))
+            {
+                blockPixels.assign(blockLevelSize.GetPixelCount(), GetConstantValue(blockIdx));
+            }
+            else if (level >= rootLevel)
+            {
+                // parent vals are already in memory, no decode needed
+                // the body's levelEnds above the root only cover it's header, so higher levels are sampled from them
+                // like WaveletDecodeLayer::GetParentLevelPixels() does
+                std::vector<symbol_t> parentVals = GetBlockHeader(blockIdx).GetParentVals();
+                uint32_t parentWidth = rootSize.GetParentWidth();
+                uint32_t shift = level - rootLevel;
+                blockPixels.resize(blockLevelSize.GetPixelCount());
+                for (uint32_t pixY = 0; pixY < blockLevelSize.GetHeight(); ++pixY)
+                {
+                    for (uint32_t pixX = 0; pixX < blockLevelSize.GetWidth(); ++pixX)
+                        blockPixels[pixY * blockLevelSize.GetWidth() + pixX] = parentVals[(size_t)(pixY << shift) * parentWidth + (pixX << shift)];
+                }
+            }
+            // cached blocks can only be used if they won't need to read from the shared stream
+            else if (block && (!ReadsFromFile() || block->GetLevel() <= level))
+            {
+                size_t oldFootprint = block->GetMemoryFootprint();
+                blockPixels = block->GetLevelPixels(level);
+                std::lock_guard<std::mutex> guard(cacheSizeLock);
+                currentCacheSize += block->GetMemoryFootprint() - oldFootprint;
+            }
+            else
+            {
+                // temporary block, only decodes the levels we need
+                blockPixels = CreateBlock(blockIdx, &rangeStream, level)->GetLevelPixels(level);
+            }
+
+            assert_release(blockPixels.size() == blockLevelSize.GetPixelCount());
+
+            // copy pixels
+            uint32_t levelStartX = blockStartX >> level;
+            uint32_t levelStartY = blockStartY >> level;
+            for (uint32_t pixY = 0; pixY < blockLevelSize.GetHeight(); ++pixY)
+            {
+                memcpy(&pixels[(size_t)(levelStartY + pixY) * levelWidth + levelStartX],
+                    &blockPixels[pixY * blockLevelSize.GetWidth()], blockLevelSize.GetWidth() * sizeof(symbol_t));
+            }
+        }
+    });
+
+    // aliases are the same size as their shared block, so it's level pixels can just be copied
+    for (size_t blockIdx = 0; blockIdx < blockAliases.size(); ++blockIdx)
+    {
+        size_t sharedIdx = blockAliases[blockIdx];
+        if (sharedIdx == blockIdx)
+            continue;
+        uint32_t blockStartX = (blockIdx % GetWidthInBlocks()) * header.blockSize;
+        uint32_t blockStartY = (blockIdx / GetWidthInBlocks()) * header.blockSize;
+        uint32_t sharedStartX = (sharedIdx % GetWidthInBlocks()) * header.blockSize;
+        uint32_t sharedStartY = (sharedIdx / GetWidthInBlocks()) * header.blockSize;
+        WaveletLayerSize blockLevelSize = WaveletLayerSize(std::min(header.width - blockStartX, header.blockSize), std::min(header.height - blockStartY, header.blockSize));
+        for (uint32_t i = 0; i < level; ++i)
+            blockLevelSize = blockLevelSize.GetParentSize();
+        for (uint32_t pixY = 0; pixY < blockLevelSize.GetHeight(); ++pixY)
+        {
+            memcpy(&pixels[(size_t)((blockStartY >> level) + pixY) * levelWidth + (blockStartX >> level)],
+                &pixels[(size_t)((sharedStartY >> level) + pixY) * levelWidth + (sharedStartX >> level)], blockLevelSize.GetWidth() * sizeof(symbol_t));
+        }
+    }
+
+    return pixels;
+}
 
 std::vector<uint8_t> CompressedImage::GetBlockLevels()
 {
@@ -455,9 +1287,12 @@ std::vector<uint8_t> CompressedImage::GetBlockLevels()
             size_t blockIdx = blockY * GetWidthInBlocks() + blockX;
 
             // DON'T use GetBlock, since that would create a block if none exists
-            std::shared_ptr<CompressedImageBlock> block = compressedImageBlocks[blockIdx];
+            std::shared_ptr<CompressedImageBlock> block = GetBlockSlot(blockIdx);
 
-            if (!block)
+            // constant blocks never need decoding
+            if (IsConstantBlock(blockIdx))
+                blockLevels.push_back(0);
+            else if (!block)
                 blockLevels.push_back(topLevel);
             else
                 blockLevels.push_back(block->GetLevel());
@@ -474,33 +1309,31 @@ symbol_t CompressedImage::GetPixel(size_t x, size_t y)
     uint32_t subBlockY = y % header.blockSize;
     size_t blockIdx = blockY * GetWidthInBlocks() + blockX;
 
-    std::shared_ptr<CompressedImageBlock> foundBlock = compressedImageBlocks[blockIdx];
+    if (IsConstantBlock(blockIdx))
+        return GetConstantValue(blockIdx);
+
+    std::shared_ptr<CompressedImageBlock> foundBlock = GetBlockSlot(blockIdx);
 
     // handle nonexistant block
     if (!foundBlock)
     {
-        CompressedImageBlockHeader& blockHeader = blockHeaders[blockIdx];
         uint32_t rootStride = (header.blockSize / 2);
 
         // If root value is being read, skip block creation
         if (subBlockX % rootStride == 0
             && subBlockY % rootStride == 0)
         {
-            uint32_t rootWidth = (blockHeader.getWidth() + (rootStride - 1)) / rootStride;
             uint32_t rootX = subBlockX / rootStride;
             uint32_t rootY = subBlockY / rootStride;
             // Read directly from root vals
-            return blockHeader.GetParentVals()[rootY * rootWidth + rootX];
+            return GetRootParentVal(blockIdx, rootX, rootY);
         }
         // Else, need to create block so it can be decoded
         else
         {
-            // Create new byte iterator at block body start
-            IteratorPtr<block_t> blocks = StreamFromFile<block_t>(&fileStream, blockBodiesStart + blockHeader.GetBlockPos());
+            std::shared_ptr <CompressedImageBlock> block = CreateBlock(blockIdx, &fileStream);
 
-            std::shared_ptr <CompressedImageBlock> block = std::make_shared<CompressedImageBlock>(blockHeader, *blocks, globalSymbolTable);
-
-            compressedImageBlocks[blockIdx] = block;
+            GetBlockSlot(blockIdx) = block;
 
             // add memory overhead of block
             currentCacheSize += block->GetMemoryFootprint();
@@ -516,6 +1349,129 @@ symbol_t CompressedImage::GetPixel(size_t x, size_t y)
     return value;
 }
 
+void CompressedImage::GetPixels(const uint32_t* xs, const uint32_t* ys, size_t count, symbol_t* output, bool multithreaded)
+{
+    // sort queries by block, as (block index, query index) pairs - both can need more than 32 bits
+    // aliases are sorted under the block they share, so it's only decoded once
+    std::vector<std::pair<size_t, size_t>> sortedQueries;
+    sortedQueries.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (xs[i] >= header.width || ys[i] >= header.height)
+        {
+            output[i] = 0;
+            continue;
+        }
+        size_t blockIdx = GetSharedBlockIndex((size_t)(ys[i] / header.blockSize) * GetWidthInBlocks() + (xs[i] / header.blockSize));
+        sortedQueries.emplace_back(blockIdx, i);
+    }
+    std::sort(sortedQueries.begin(), sortedQueries.end());
+
+    // find where each block's queries start
+    std::vector<size_t> blockStarts;
+    for (size_t i = 0; i < sortedQueries.size(); ++i)
+    {
+        if (i == 0 || sortedQueries[i].first != sortedQueries[i - 1].first)
+            blockStarts.push_back(i);
+    }
+    blockStarts.push_back(sortedQueries.size());
+
+    uint32_t rootStride = (header.blockSize / 2);
+
+    // returns true if every query for the block can be read from it's root vals
+    auto IsRootOnly = [&](size_t start, size_t end)
+    {
+        for (size_t i = start; i < end; ++i)
+        {
+            size_t queryIdx = sortedQueries[i].second;
+            if ((xs[queryIdx] % header.blockSize) % rootStride != 0
+                || (ys[queryIdx] % header.blockSize) % rootStride != 0)
+                return false;
+        }
+        return true;
+    };
+
+    auto ReadRootVals = [&](size_t blockIdx, size_t start, size_t end)
+    {
+        for (size_t i = start; i < end; ++i)
+        {
+            size_t queryIdx = sortedQueries[i].second;
+            uint32_t rootX = (xs[queryIdx] % header.blockSize) / rootStride;
+            uint32_t rootY = (ys[queryIdx] % header.blockSize) / rootStride;
+            output[queryIdx] = GetRootParentVal(blockIdx, rootX, rootY);
+        }
+    };
+
+    auto ReadConstant = [&](size_t blockIdx, size_t start, size_t end)
+    {
+        for (size_t i = start; i < end; ++i)
+            output[sortedQueries[i].second] = GetConstantValue(blockIdx);
+    };
+
+    auto ReadBlock = [&](CompressedImageBlock& block, size_t start, size_t end)
+    {
+        for (size_t i = start; i < end; ++i)
+        {
+            size_t queryIdx = sortedQueries[i].second;
+            output[queryIdx] = block.GetPixel(xs[queryIdx] % header.blockSize, ys[queryIdx] % header.blockSize);
+        }
+    };
+
+    if (!multithreaded)
+    {
+        for (size_t group = 0; group + 1 < blockStarts.size(); ++group)
+        {
+            size_t start = blockStarts[group];
+            size_t end = blockStarts[group + 1];
+            size_t blockIdx = sortedQueries[start].first;
+
+            // same as GetPixel, skip block creation for constant blocks or if only root values are read
+            if (IsConstantBlock(blockIdx))
+            {
+                ReadConstant(blockIdx, start, end);
+                continue;
+            }
+            if (!compressedImageBlocks[blockIdx] && IsRootOnly(start, end))
+            {
+                ReadRootVals(blockIdx, start, end);
+                continue;
+            }
+
+            std::shared_ptr<CompressedImageBlock> block = GetBlock(blockIdx);
+            currentCacheSize -= block->GetMemoryFootprint();
+            ReadBlock(*block, start, end);
+            currentCacheSize += block->GetMemoryFootprint();
+        }
+        return;
+    }
+
+    WorkerPool::GetShared().ParallelFor(blockStarts.size() - 1, [&](size_t rangeStart, size_t rangeEnd)
+    {
+        // the shared file stream can't be used from multiple threads, so each range gets it's own
+        FastFileStream rangeStream;
+        if (ReadsFromFile())
+            rangeStream = FastFileStream(filename);
+
+        for (size_t group = rangeStart; group < rangeEnd; ++group)
+        {
+            size_t start = blockStarts[group];
+            size_t end = blockStarts[group + 1];
+            size_t blockIdx = sortedQueries[start].first;
+            std::shared_ptr<CompressedImageBlock> block = compressedImageBlocks[blockIdx];
+
+            if (IsConstantBlock(blockIdx))
+                ReadConstant(blockIdx, start, end);
+            else if (!block && IsRootOnly(start, end))
+                ReadRootVals(blockIdx, start, end);
+            // cached blocks can only be used if they won't need to read from the shared stream
+            else if (block && (!ReadsFromFile() || block->GetLevel() == 0))
+                ReadBlock(*block, start, end);
+            else
+                ReadBlock(*CreateBlock(blockIdx, &rangeStream), start, end);
+        }
+    });
+}
+
 uint32_t CompressedImage::GetWidth() const
 {
     return header.width;
@@ -526,6 +1482,11 @@ uint32_t CompressedImage::GetHeight() const
     return header.height;
 }
 
+uint64_t CompressedImage::GetPixelCount() const
+{
+    return (uint64_t)header.width * header.height;
+}
+
 uint32_t CompressedImage::GetWidthInBlocks() const
 {
     uint32_t roundedWidth = header.width / header.blockSize;
@@ -542,6 +1503,16 @@ uint32_t CompressedImage::GetHeightInBlocks() const
     return roundedHeight;
 }
 
+uint32_t CompressedImage::GetLevelWidth(uint32_t level) const
+{
+    return (uint32_t)(((uint64_t)header.width + (1ull << level) - 1) >> level);
+}
+
+uint32_t CompressedImage::GetLevelHeight(uint32_t level) const
+{
+    return (uint32_t)(((uint64_t)header.height + (1ull << level) - 1) >> level);
+}
+
 uint32_t CompressedImage::GetTopLOD() const
 {
     uint32_t LOD = 0;
@@ -560,6 +1531,11 @@ size_t CompressedImage::GetMemoryUsage() const
     size_t totalMemUsage = currentCacheSize;
     // this isn't even slightly accurate, but better than nothing
     size_t mapSize = compressedImageBlocks.capacity() * sizeof(std::shared_ptr<CompressedImageBlock>);
+    if (parentPyramid)
+    {
+        std::lock_guard<std::mutex> guard(parentPyramidLock);
+        mapSize += parentPyramid->GetMemoryUsage();
+    }
     return currentCacheSize + mapSize;
 }
 
@@ -571,4 +1547,11 @@ void CompressedImage::ClearBlockCache()
         if (compressedImageBlocks[i])
             compressedImageBlocks[i] = std::shared_ptr<CompressedImageBlock>();
     }
+    tileCache.Clear();
+    currentCacheSize = memoryOverhead;
+    if (parentPyramid)
+    {
+        std::lock_guard<std::mutex> guard(parentPyramidLock);
+        parentPyramid->ClearBlockCache();
+    }
 }
\ No newline at end of file
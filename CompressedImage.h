@@ -1,12 +1,34 @@
 #pragma once
 #include <vector>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <iosfwd>
 
 #include "CompressedImageBlock.h"
+#include "DecodedTileCache.h"
 #include "Precision.h"
+#include "AsyncRequestQueue.h"
+
+class AsyncFileReader;
+
+// shared with CompressedImageWriter
+void WriteSymbolTable(std::vector<uint8_t>& outputBytes, const TableGroupList& groupList);
+TableGroupList ReadSymbolTable(const std::vector<uint8_t>& bytes, uint64_t& readPos);
 
 struct CompressedImageHeader
 {
-    static const uint16_t CURR_VERSION = 0x0004;
+    // v5: block headers replaced by a fixed-size block index + footer
+    // v6: per-block min/max heights in the index
+    // v7: per-level body lengths in the index
+    // v8: constant blocks are flagged in the index and have no body
+    // v9: block layers below the root start with all-zero quadtree flags
+    // v10: block header positions are 64-bit
+    // v11: big parent val images are stored as a nested image, see parentPyramid
+    // v12: index trailer before the block bodies, the index can be stored compacted
+    static const uint16_t CURR_VERSION = 0x000C;
+    // oldest version that can still be read
+    static const uint16_t MIN_VERSION = 0x0004;
     CompressedImageHeader()
     {
 
@@ -16,9 +38,9 @@ struct CompressedImageHeader
     {}
     bool IsCorrect()
     {
-        if (version != CURR_VERSION)
-            std::cerr << "Old file version not supported: " << version << " expected: " << CURR_VERSION << std::endl;
-        return MAGIC == 0xFEDF && version == CURR_VERSION;
+        if (version < MIN_VERSION || version > CURR_VERSION)
+            std::cerr << "File version not supported: " << version << " expected: " << MIN_VERSION << "-" << CURR_VERSION << std::endl;
+        return MAGIC == 0xFEDF && version >= MIN_VERSION && version <= CURR_VERSION;
     }
     // Header header
     uint16_t MAGIC = 0xFEDF;
@@ -28,11 +50,103 @@ struct CompressedImageHeader
     uint32_t width;
     uint32_t height;
     uint32_t blockSize;
-    size_t blockBodyStart;
+    uint64_t blockBodyStart;
+};
+
+// v5+: one per block, written after the parent val image
+// fixed size so a block's entry can be found without parsing anything
+struct CompressedImageBlockIndexEntry
+{
+    // entries are shorter in older files, only the fields that existed are stored
+    static size_t GetSize(uint16_t version)
+    {
+        if (version >= 0x0007)
+            return sizeof(CompressedImageBlockIndexEntry);
+        return version >= 0x0006 ? 32 : 24;
+    }
+    // relative to blockBodyStart, blocks with identical bodies can point at the same one
+    uint64_t offset;
+    uint64_t finalRansState;
+    uint32_t length;
+    // v8+: FLAG_ bits below, reserved before that
+    uint32_t flags;
+    // v6+: lowest + highest bottom-level pixel in the block
+    symbol_t minValue;
+    symbol_t maxValue;
+    // v7+: body length needed to decode down to levels 1 to 6, in block_t's, 0 = read the whole body
+    // v6 has 4 reserved bytes here instead
+    uint16_t levelEnds[CompressedImageBlockHeader::MAX_LEVEL_ENDS];
+
+    // every pixel is minValue, there's no body (length 0)
+    static const uint32_t FLAG_CONSTANT = 1;
+};
+
+// v12+: last bytes before the block bodies, says how the index in front of it is stored
+struct CompressedImageIndexTrailer
+{
+    static size_t GetSize(uint16_t version)
+    {
+        return version >= 0x000C ? sizeof(CompressedImageIndexTrailer) : 0;
+    }
+    // bytes of CompactBlockIndex in front of the trailer, 0 = fixed-size entries
+    uint64_t compactIndexSize = 0;
+};
+
+// lowest + highest height in a region, empty if minValue > maxValue
+struct HeightBounds
+{
+    void Add(symbol_t value)
+    {
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
+    }
+    void Add(const HeightBounds& bounds)
+    {
+        minValue = std::min(minValue, bounds.minValue);
+        maxValue = std::max(maxValue, bounds.maxValue);
+    }
+    // true if bounds has values outside these ones
+    bool CanExtend(const HeightBounds& bounds) const
+    {
+        return bounds.minValue < minValue || bounds.maxValue > maxValue;
+    }
+    symbol_t minValue = std::numeric_limits<symbol_t>::max();
+    symbol_t maxValue = 0;
+};
+
+// where a ray hit the surface
+struct RaycastHit
+{
+    // position along the ray, in multiples of it's direction
+    float t = 0.0f;
+    // x/y in pixels, z is the surface height there in world units
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+};
+
+// v5+: last bytes of the file, used to find the block index
+struct CompressedImageFooter
+{
+    bool IsCorrect() const
+    {
+        return MAGIC == 0xFEDF && version >= 0x0005 && version <= CompressedImageHeader::CURR_VERSION;
+    }
+    uint64_t indexStart;
+    uint64_t blockCount;
+    // reserved
+    uint32_t flags = 0;
+    // at the very end so the footer layout can be picked from the last 4 bytes
+    uint16_t version = CompressedImageHeader::CURR_VERSION;
+    uint16_t MAGIC = 0xFEDF;
 };
 
 class CompressedImage
 {
+    // writes the same file as Serialize() without creating the image first
+    friend class CompressedImageWriter;
+    // decodes blocks on it's own thread, straight from the file
+    friend class ProgressiveImage;
 public:
     // TODO remove
     CompressedImage() {};
@@ -42,18 +156,79 @@ public:
     static std::shared_ptr<CompressedImage> Deserialize(ByteIterator& bytes);
     // Opens for streaming
     static std::shared_ptr<CompressedImage> OpenStream(std::string filename);
+    // Reads the compressed file into memory in one go, blocks are decoded from there on demand
+    static std::shared_ptr<CompressedImage> OpenResident(std::string filename);
     std::vector<uint8_t> Serialize();
+    // Serialize() writes a CompactBlockIndex instead of fixed-size entries
+    // smaller + faster to open, but the file can't be changed with UpdateRegion()
+    void SetCompactIndex(bool compact);
     std::vector<symbol_t> GetBottomLevelPixels();
+    // decodes whole image at 1/2^level resolution, blocks are only decoded down to level
+    // level 0 = full res, GetTopLOD() = parent vals
+    std::vector<symbol_t> GetLevelPixels(uint32_t level);
+
+    // copies a width * height region of bottom-level pixels, region must be inside the image
+    void GetRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, symbol_t* output);
+    // reads + decodes every block overlapping the region that isn't in the tile cache
+    // many block reads are kept in flight at once, and each block is decoded as soon as it's body arrives
+    // regions bigger than the tile cache window will evict some of their own tiles
+    void PrefetchRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+    // co_await-able GetRegion() + PrefetchRegion(), run one at a time on the image's request thread, highest priority first
+    // they work a block row at a time, so a cancelled request stops at the end of the row it's on
+    // the image mustn't be used directly while requests are in flight, and output has to stay valid until they finish
+    AsyncRequest GetRegionAsync(uint32_t x, uint32_t y, uint32_t width, uint32_t height, symbol_t* output, int32_t priority = 0);
+    AsyncRequest PrefetchAsync(uint32_t x, uint32_t y, uint32_t width, uint32_t height, int32_t priority = 0);
+
+    // interpolated sampling, returns height * scale + offset
+    // positions are in pixels, neighbours outside the image are clamped to the edge
+    float SampleBilinear(float x, float y, float scale = 1.0f, float offset = 0.0f);
+    float SampleBicubic(float x, float y, float scale = 1.0f, float offset = 0.0f);
+    // batched versions, interpolation is done 4 samples at a time with SSE
+    void SampleBilinear(const float* xs, const float* ys, size_t count, float* output, float scale = 1.0f, float offset = 0.0f);
+    void SampleBicubic(const float* xs, const float* ys, size_t count, float* output, float scale = 1.0f, float offset = 0.0f);
+
+    // bottom-level pixels of a block from the decoded tile cache, decoding it if needed
+    // rows are GetTileStride() apart (edge blocks are padded), valid until the next call that reads pixels
+    const symbol_t* GetTile(uint32_t blockX, uint32_t blockY);
+    uint32_t GetTileStride() const;
+
+    // re-encodes the blocks overlapping a width * height region of new bottom-level pixels, and patches the file in place
+    // new bodies are appended, replaced ones are left as dead space until the file is re-serialized
+    // if the parent val image outgrows the room it has, the index + bodies are moved back to make more
+    // only works for v5+ files opened with OpenStream() without a compact index, returns false if the file wasn't changed
+    bool UpdateRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const symbol_t* pixels);
+
+    // lowest + highest pixel in a width * height region, region must be inside the image
+    // v6+ files answer from per-block bounds, only blocks partly covered by the region are decoded (and only if they could change the result)
+    // older files have no bounds, so every block in the region is decoded
+    HeightBounds GetBounds(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+    // first point along a ray that's on or under the surface, the surface is bilinear between pixels like SampleBilinear()
+    // x/y are in pixels, z is in world units (height * scale + offset, scale must be positive), the ray ends at origin + dir * maxT
+    // the ray walks the bounds quadtree front to back, and only decodes blocks it passes below the top of
+    // returns false if the ray leaves the image or reaches maxT without hitting anything
+    bool Raycast(float originX, float originY, float originZ, float dirX, float dirY, float dirZ, float maxT, RaycastHit& hit, float scale = 1.0f, float offset = 0.0f);
+    // Raycast() from one point to another, returns false if nothing is in the way
+    bool IntersectSegment(float fromX, float fromY, float fromZ, float toX, float toY, float toZ, RaycastHit& hit, float scale = 1.0f, float offset = 0.0f);
 
     // returns the level each block is decoded at
     std::vector<uint8_t> GetBlockLevels();
 
     symbol_t GetPixel(size_t x, size_t y);
+    // batched GetPixel, queries are grouped by block so each block is only visited once
+    // out-of-bounds positions return 0
+    // multithreaded decodes blocks across the worker pool, but doesn't add them to the block cache
+    void GetPixels(const uint32_t* xs, const uint32_t* ys, size_t count, symbol_t* output, bool multithreaded = false);
 
     uint32_t GetWidth() const;
     uint32_t GetHeight() const;
+    // width * height, big maps can have more than 4G pixels
+    uint64_t GetPixelCount() const;
     uint32_t GetWidthInBlocks() const;
     uint32_t GetHeightInBlocks() const;
+    // size of image returned by GetLevelPixels()
+    uint32_t GetLevelWidth(uint32_t level) const;
+    uint32_t GetLevelHeight(uint32_t level) const;
 
     uint32_t GetTopLOD() const;
 
@@ -63,25 +238,169 @@ public:
 
 private:
     std::shared_ptr<CompressedImageBlock> GetBlock(size_t index);
+    // GetTile() by block index
+    const symbol_t* GetBlockPixelData(size_t index);
+    // allocates the tile cache slab on first use
+    void AllocateTileCache();
+    // copies a decoded block into it's tile
+    const symbol_t* FillTile(uint32_t blockX, uint32_t blockY, const symbol_t* blockPixels);
+    // reads a size * size neighbourhood starting at (x, y), clamped to the image edges
+    void GetNeighbourhood(int64_t x, int64_t y, uint32_t size, symbol_t* output);
+    // creates a block reading from the given stream, doesn't touch the block cache
+    // with a level only the part of the body needed to decode down to it is read (v7+),
+    // the block can't be decoded any further than that so it mustn't be cached
+    std::shared_ptr<CompressedImageBlock> CreateBlock(size_t index, FastFileStream* stream, uint32_t level = 0);
+    // same as above, from a body that's already been read
+    std::shared_ptr<CompressedImageBlock> CreateBlock(size_t index, std::shared_ptr<const std::vector<uint8_t>> body);
+    // reads a block's body in one go, or just the start of it if it's only decoded down to level
+    std::shared_ptr<const std::vector<uint8_t>> ReadBlockBody(size_t index, FastFileStream* stream, uint32_t level = 0);
+    // bytes of a block's body needed to decode down to level
+    size_t GetBodyLength(size_t index, uint32_t level) const;
+    // read + decode of uncached blocks, they're added to the tile cache once they're all done
+    void FetchBlocks(const std::vector<size_t>& indices);
+    // fills fetchedBlocks[i] with a decoded indices[i]
+    void ReadBlocksAsync(const std::vector<size_t>& indices, std::vector<std::shared_ptr<CompressedImageBlock>>& fetchedBlocks);
+    // checks the footer (v5+) or works out the last block's length (v4)
+    bool CheckBlockData(size_t fileSize, const CompressedImageFooter& footer);
+    // false if blocks are decoded from memory
+    bool ReadsFromFile() const;
+    // builds a block's header from the per-block arrays, the tables have to be loaded
+    CompressedImageBlockHeader GetBlockHeader(size_t index) const;
+    // reads a root parent val without creating a block, the tables have to be loaded
+    symbol_t GetRootParentVal(size_t index, uint32_t rootX, uint32_t rootY) const;
+    // parses the symbol tables + parent val image the first time anything needs them, images opened from their index
+    // (v5+ OpenStream()/OpenResident()) start out without them. GetSharedBlockIndex() + CreateBlock() call this
+    void LoadTables();
+    // v6+: true if every pixel of the block is the same, these are filled in instead of decoded
+    // only v8+ drops their bodies, but the bounds are enough to spot them in older files too
+    bool IsConstantBlock(size_t index) const;
+    // value of every pixel in a constant block
+    symbol_t GetConstantValue(size_t index) const;
+    // encodes a parent val image like Serialize() does, but with the file's existing symbol table
+    // returns how many bytes it runs past the space the old one had, 0 if it fits
+    size_t EncodeParentImage(const std::vector<symbol_t>& values, std::vector<uint8_t>& parentsBytes, std::vector<uint8_t>& blockBytes);
+    // file position of a fixed-size index, right before the bodies (+ trailer)
+    size_t GetIndexStart() const;
+    // moves [start, end) of a file back by shift bytes, used to make room for a bigger parent image
+    static bool MoveFileTail(std::fstream& file, uint64_t start, uint64_t end, uint64_t shift);
+    // drops a block from the block + tile caches
+    void EvictBlock(size_t index);
+    // finds blocks that share a body, root parent vals and size with an earlier block, so they decode to the same pixels
+    void BuildBlockAliases();
+    // first block that decodes to the same pixels as this one, usually the block itself
+    size_t GetSharedBlockIndex(size_t index);
+    // block cache entry for a block, shared by all it's aliases
+    std::shared_ptr<CompressedImageBlock>& GetBlockSlot(size_t index);
+    // builds the upper levels of boundsPyramid from the block bounds
+    void BuildBoundsPyramid();
+    // re-calculates the upper levels above a block after it's bounds change
+    void UpdateBoundsPyramid(size_t index);
+    // adds the bounds of every block in [blockStart, blockEnd) under a boundsPyramid node
+    void AddCoveredBounds(uint32_t level, uint32_t nodeX, uint32_t nodeY, uint32_t blockStartX, uint32_t blockStartY, uint32_t blockEndX, uint32_t blockEndY, HeightBounds& bounds) const;
+    // adds the pixels of a block inside the region
+    void AddBlockBounds(uint32_t blockX, uint32_t blockY, uint32_t x, uint32_t y, uint32_t endX, uint32_t endY, HeightBounds& bounds);
+
+    // ray in height units, see CompressedImageRaycast.cpp
+    struct RaycastRay;
+    // level of the bounds quadtree with a single node, also used for files without bounds
+    uint32_t GetBoundsTopLevel() const;
+    // bounds of a quadtree node + the nodes right/below it, since the surface between neighbouring pixels can reach into them
+    // files without bounds return the full height range, so nothing is skipped
+    HeightBounds GetRaycastBounds(uint32_t level, uint32_t nodeX, uint32_t nodeY) const;
+    bool RaycastNode(uint32_t level, uint32_t nodeX, uint32_t nodeY, const RaycastRay& ray, RaycastHit& hit);
+    // steps through the cells of one block between tStart + tEnd
+    bool RaycastBlock(uint32_t blockX, uint32_t blockY, const RaycastRay& ray, double tStart, double tEnd, RaycastHit& hit);
+
+    // parent val image width/height for an image width/height, every block gets 2x2
+    static uint32_t GetParentValsSize(uint32_t size, uint32_t blockSize);
+    // copies a block's root parent vals into it's 2x2 of the parent val image
+    static void StoreRootParentVals(CompressedImageBlock& block, size_t blockX, size_t blockY, symbol_t* parentValues, size_t parentValsWidth);
+    // encodes + writes the parent val image with it's own symbol table, followed by the spare room for UpdateRegion()
+    static void WriteParentImage(std::vector<uint8_t>& byteStream, const std::vector<symbol_t>& parentValues, size_t parentValsWidth, size_t parentValsHeight);
 
     // generate header info from stream
     static std::shared_ptr<CompressedImage> GenerateFromStream(ByteIterator& bytes);
+    // same as above, from a buffer holding everything up to blockBodyStart
+    static std::shared_ptr<CompressedImage> GenerateFromBytes(const std::vector<uint8_t>& bytes);
+    // v5+: only reads the index, from footer.indexStart up to blockBodyStart. Returns null if it's invalid
+    static std::shared_ptr<CompressedImage> GenerateFromIndex(const CompressedImageHeader& header, const CompressedImageFooter& footer, const uint8_t* indexBytes);
+    // global symbol table + parent val image, readPos starts right after the file header
+    void ReadTables(const std::vector<uint8_t>& bytes, uint64_t& readPos);
+    // v5+ index + trailer, returns false if it doesn't match the image size
+    bool ReadIndex(const uint8_t* indexBytes, size_t indexSize);
+    // adds the per-block arrays to the memory overhead, and sizes the block cache
+    void AddIndexOverhead();
+    // OpenResident() from a whole file that's already in memory
+    static std::shared_ptr<CompressedImage> OpenResident(std::shared_ptr<const std::vector<uint8_t>> fileBytes);
 
     CompressedImageHeader header;
     // Wavelet image containing parent vals
     std::vector<std::shared_ptr<CompressedImageBlock>> compressedImageBlocks;
 
     // used for streamed decode
-    std::vector<CompressedImageBlockHeader> blockHeaders;
+    // per-block metadata, stored as flat arrays indexed by block
+    std::vector<uint64_t> blockPositions;
+    std::vector<uint32_t> blockLengths;
+    std::vector<state_t> blockRansStates;
+    // v7+: each block's levelEnds from the index, MAX_LEVEL_ENDS per block
+    // empty for older files
+    std::vector<uint16_t> blockLevelEnds;
+    // v6+: min/max quadtree, level 0 is per block, every level above merges 2x2 of the one below
+    // empty for older files
+    std::vector<std::vector<HeightBounds>> boundsPyramid;
+    // v12+: the index is a CompactBlockIndex, also picks the index Serialize() writes
+    bool compactIndex = false;
+    // GetSharedBlockIndex() of every block, empty if no blocks share a body
+    // aliases are cached + decoded once, under the index they point to
+    std::vector<uint32_t> blockAliases;
+    // root parent vals of every block as one 2D image, a block's vals start at (blockX * 2, blockY * 2)
+    // empty while they're read from parentPyramid instead
+    std::vector<symbol_t> parentVals;
+    uint32_t parentValsWidth;
+    // v11+: parent val images bigger than a pyramid block are stored as a whole nested image (opened resident),
+    // whose own parent vals can be nested again. Opening only decodes the top of the pyramid,
+    // and the blocks below are decoded the first time one of their root vals is read
+    std::shared_ptr<CompressedImage> parentPyramid;
+    // root vals are read from worker threads while blocks are created
+    mutable std::mutex parentPyramidLock;
+    // the file's parent vals are a pyramid, so updates have to re-encode them as one
+    bool hasParentPyramid = false;
+    static const uint32_t PARENT_PYRAMID_BLOCK_SIZE = 128;
     std::shared_ptr<RansTable> globalSymbolTable;
+    // used to re-encode the parent val image, null for pyramids since they have their own tables
+    std::shared_ptr<RansTable> parentSymbolTable;
+    // file positions of the parent image's parents (or the pyramid's size), and it's block header
+    size_t parentImageStart = 0;
+    size_t parentBlockHeaderStart = 0;
+    // where LoadTables() stops reading, 0 if they were loaded when the image was opened/created
+    size_t tablesEnd = 0;
+    std::once_flag tablesLoaded;
+    // spare room left after the parent image = body size / divisor + min
+    static const size_t PARENT_IMAGE_SLACK_DIVISOR = 16;
+    static const size_t PARENT_IMAGE_SLACK_MIN = 256;
+    // encoding versions of the tables above, created by the first UpdateRegion()
+    std::shared_ptr<RansTable> encodeSymbolTable;
+    std::shared_ptr<RansTable> parentEncodeSymbolTable;
     FastFileStream fileStream;
+    // created on first use
+    std::shared_ptr<AsyncFileReader> asyncReader;
+    // whole file, if opened with OpenResident()
+    std::shared_ptr<const std::vector<uint8_t>> residentFile;
+    // used to open extra streams for parallel decodes
+    std::string filename;
     size_t blockBodiesStart;
     
     // used for caching
+    // decoded bottom-level pixels, used by GetTile(), GetRegion() + sampling
+    static const size_t TILE_CACHE_BYTES = 8 * 1024 * 1024;
+    DecodedTileCache tileCache;
     // total approx. RAM usage of image stream
-    size_t currentCacheSize;
+    size_t currentCacheSize = 0;
     // min. RAM usage of image stream 
-    size_t memoryOverhead;
+    size_t memoryOverhead = 0;
 
     SymbolCountDict globalSymbolCounts;
+
+    // GetRegionAsync() + PrefetchAsync(), last so it's destroyed (waiting for the running request) before everything it reads
+    AsyncRequestQueue asyncRequests;
 };
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include "CompressedImage.h"
+
+#include "Release_Assert.h"
+
+// Coroutine versions of GetRegion() + PrefetchRegion()
+// each request is split into block rows, so the queue can check for cancelling in between
+// and a big region's reads + decodes still go through PrefetchRegion()'s async reader a row at a time
+
+AsyncRequest CompressedImage::GetRegionAsync(uint32_t x, uint32_t y, uint32_t width, uint32_t height, symbol_t* output, int32_t priority)
+{
+    assert_release(x + (uint64_t)width <= header.width && y + (uint64_t)height <= header.height);
+    uint32_t row = y;
+    uint32_t endY = y + height;
+    return asyncRequests.SubmitAsync([this, x, y, width, output, row, endY]() mutable
+    {
+        if (width == 0 || row >= endY)
+            return true;
+        uint32_t rowEnd = (uint32_t)std::min<uint64_t>(endY, ((uint64_t)row / header.blockSize + 1) * header.blockSize);
+        GetRegion(x, row, width, rowEnd - row, output + (size_t)(row - y) * width);
+        row = rowEnd;
+        return row >= endY;
+    }, priority);
+}
+
+AsyncRequest CompressedImage::PrefetchAsync(uint32_t x, uint32_t y, uint32_t width, uint32_t height, int32_t priority)
+{
+    assert_release(x + (uint64_t)width <= header.width && y + (uint64_t)height <= header.height);
+    uint32_t row = y;
+    uint32_t endY = y + height;
+    return asyncRequests.SubmitAsync([this, x, width, row, endY]() mutable
+    {
+        if (width == 0 || row >= endY)
+            return true;
+        uint32_t rowEnd = (uint32_t)std::min<uint64_t>(endY, ((uint64_t)row / header.blockSize + 1) * header.blockSize);
+        PrefetchRegion(x, row, width, rowEnd - row);
+        row = rowEnd;
+        return row >= endY;
+    }, priority);
+}
@@ -1,13 +1,17 @@
 #include "CompressedImageBlock.h"
 
 #include <iostream>
+#include <algorithm>
+#include <limits>
+#include "WaveletZeroTree.h"
 #include "Release_Assert.h"
 
 // makes serialization easy lmao
 struct CompressedImageBlockHeader::BlockHeaderHeader
 {
     // position of block in stream
-    uint32_t blockPos;
+    // 32-bit before v10, the high half was uninitialized padding
+    uint64_t blockPos;
 
     // rANS
     uint64_t finalRansState;
@@ -15,6 +19,9 @@ struct CompressedImageBlockHeader::BlockHeaderHeader
 
 CompressedImageBlock::CompressedImageBlock(std::vector<symbol_t> pixelVals, uint32_t width, uint32_t height)
 {
+    auto minMax = std::minmax_element(pixelVals.begin(), pixelVals.end());
+    minValue = *minMax.first;
+    maxValue = *minMax.second;
     encodeWaveletPyramidBottom = std::make_shared<WaveletEncodeLayer>(pixelVals, width, height);
     // get top layer
     std::shared_ptr<WaveletEncodeLayer> topLayer = encodeWaveletPyramidBottom;
@@ -46,6 +53,12 @@ CompressedImageBlock::CompressedImageBlock(CompressedImageBlockHeader header, It
     ransState = RansState(ransByteStream, header.finalRansState, symbolTable);
 }
 
+CompressedImageBlock::CompressedImageBlock(CompressedImageBlockHeader header, std::shared_ptr<const std::vector<uint8_t>> body, std::shared_ptr<RansTable> symbolTable)
+    : CompressedImageBlock(header, *StreamFromBuffer<block_t>(body, 0), symbolTable)
+{
+    bodySize = body->capacity();
+}
+
 uint32_t CompressedImageBlock::DecodeToLevel(uint32_t targetLevel)
 {
     // Check what level we're on
@@ -86,7 +99,7 @@ uint32_t CompressedImageBlock::DecodeToLevel(uint32_t targetLevel)
             rootWavelets.emplace_back(ransState.ReadSymbol());
         
         // create root layer
-        currDecodeLayer = std::make_shared<WaveletDecodeLayer>(rootWavelets, header.parentVals, rootSize.GetWidth(), rootSize.GetHeight());
+        currDecodeLayer = std::make_shared<WaveletDecodeLayer>(rootWavelets, header.GetParentVals(), rootSize.GetWidth(), rootSize.GetHeight());
 
         decodedLevel = topLayer - 1;
     }
@@ -116,9 +129,17 @@ uint32_t CompressedImageBlock::DecodeToLevel(uint32_t targetLevel)
         
         // read wavelets
         std::vector<symbol_t> wavelets;
-        wavelets.reserve(waveletsCount);
-        while (ransState.HasData() && wavelets.size() < waveletsCount)
-            wavelets.emplace_back(ransState.ReadSymbol());
+        if (header.zeroFlags)
+        {
+            if (!WaveletZeroTree(newLayerSize).Decode(ransState, wavelets))
+                wavelets.clear();
+        }
+        else
+        {
+            wavelets.reserve(waveletsCount);
+            while (ransState.HasData() && wavelets.size() < waveletsCount)
+                wavelets.emplace_back(ransState.ReadSymbol());
+        }
 
         if (wavelets.size() != waveletsCount)
         {
@@ -179,8 +200,25 @@ std::vector<symbol_t> CompressedImageBlock::GetWaveletValues()
     return blockWavelets;
 }
 
+void CompressedImageBlock::AddZeroTreeStats(WaveletZeroTreeStats& stats)
+{
+    // same layers as WriteBody()
+    std::vector<symbol_t> blockWavelets = GetWaveletValues();
+    WaveletLayerSize levelSize = WaveletLayerSize(header.width, header.height);
+    size_t levelEnd = blockWavelets.size();
+    while (!levelSize.IsRoot())
+    {
+        size_t levelStart = levelEnd - levelSize.GetWaveletCount();
+        size_t skippedWavelets;
+        double breakEvenBits = WaveletZeroTree(levelSize).GetBreakEvenBits(&blockWavelets[levelStart], skippedWavelets);
+        stats.Add(breakEvenBits, skippedWavelets);
+        levelEnd = levelStart;
+        levelSize = levelSize.GetParentSize();
+    }
+}
+
 // Writes body of block - everything needed to decode layers below root
-void CompressedImageBlock::WriteBody(std::vector<uint8_t>& outputBytes, const std::shared_ptr<RansTable> & globalSymbolTable)
+void CompressedImageBlock::WriteBody(std::vector<uint8_t>& outputBytes, const std::shared_ptr<RansTable> & globalSymbolTable, bool zeroFlags)
 {
     // add header
     //size_t headerPos = outputBytes.size();
@@ -194,12 +232,52 @@ void CompressedImageBlock::WriteBody(std::vector<uint8_t>& outputBytes, const st
     size_t waveletsHash = HashVec(blockWavelets);
     // rANS encode
     std::shared_ptr<RansState> waveletRansState = std::make_shared<RansState>(globalSymbolTable);
-    // rANS decodes backwards
-    std::reverse(blockWavelets.begin(), blockWavelets.end());
+    header.zeroFlags = zeroFlags;
+    // layers only use zero flags where they cost less than the zeros they skip
+    double zeroBits = zeroFlags ? globalSymbolTable->GetSymbolBits(0) : 0.0;
 
     //std::cout << "Starting rANS encode..." << std::endl;
-    for (auto value : blockWavelets)
-        waveletRansState->AddSymbol(value);
+    // rANS decodes backwards, so levels are encoded bottom first, each one in reverse
+    // the blocks written before a level's first wavelet aren't needed to decode down to that level
+    size_t blocksBeforeLevel[CompressedImageBlockHeader::MAX_LEVEL_ENDS + 1] = {};
+    WaveletLayerSize levelSize = WaveletLayerSize(header.width, header.height);
+    uint32_t levelCount = 0;
+    size_t levelEnd = blockWavelets.size();
+    while (levelEnd > 0)
+    {
+        if (levelCount <= CompressedImageBlockHeader::MAX_LEVEL_ENDS)
+            blocksBeforeLevel[levelCount] = waveletRansState->GetCompressedBlockCount();
+        assert_release(levelSize.GetWaveletCount() > 0 && levelSize.GetWaveletCount() <= levelEnd);
+        size_t levelStart = levelEnd - levelSize.GetWaveletCount();
+        if (zeroFlags && !levelSize.IsRoot())
+        {
+            std::vector<WaveletZeroTree::Code> codes = WaveletZeroTree(levelSize).Encode(&blockWavelets[levelStart], zeroBits);
+            for (auto code = codes.rbegin(); code != codes.rend(); ++code)
+            {
+                if (code->isFlag)
+                    waveletRansState->AddFlag(code->flag, code->probability);
+                else
+                    waveletRansState->AddSymbol(code->wavelet);
+            }
+        }
+        else
+        {
+            for (size_t valuePos = levelEnd; valuePos > levelStart; --valuePos)
+                waveletRansState->AddSymbol(blockWavelets[valuePos - 1]);
+        }
+        levelEnd = levelStart;
+        levelSize = levelSize.GetParentSize();
+        ++levelCount;
+    }
+
+    // levels above the root only need the parent vals, but the vector header is always read
+    size_t totalBlocks = waveletRansState->GetCompressedBlockCount();
+    for (uint32_t level = 1; level <= CompressedImageBlockHeader::MAX_LEVEL_ENDS; ++level)
+    {
+        size_t levelBlocks = level < levelCount ? totalBlocks - blocksBeforeLevel[level] : 0;
+        size_t levelEnd = (sizeof(VectorHeader<block_t>) + levelBlocks * sizeof(block_t)) / sizeof(block_t);
+        header.levelEnds[level - 1] = levelEnd <= std::numeric_limits<uint16_t>::max() ? (uint16_t)levelEnd : 0;
+    }
 
     size_t finalRansState = waveletRansState->GetRansState();
 
@@ -226,6 +304,16 @@ std::vector<symbol_t> CompressedImageBlock::GetBottomLevelPixels()
     return GetLevelPixels(0);
 }
 
+const symbol_t* CompressedImageBlock::GetBottomLevelData()
+{
+    uint32_t currLevel = DecodeToLevel(0);
+
+    // error-handling
+    assert_release(currLevel == 0);
+
+    return currDecodeLayer->GetPixelData();
+}
+
 symbol_t CompressedImageBlock::GetPixel(uint32_t x, uint32_t y)
 {
     // level of parent values
@@ -348,14 +436,29 @@ WaveletLayerSize CompressedImageBlock::GetSize() const
     return WaveletLayerSize(header.width, header.height);
 }
 
+symbol_t CompressedImageBlock::GetMinValue() const
+{
+    return minValue;
+}
+
+symbol_t CompressedImageBlock::GetMaxValue() const
+{
+    return maxValue;
+}
+
+bool CompressedImageBlock::IsConstant() const
+{
+    return minValue == maxValue;
+}
+
 
 size_t CompressedImageBlock::GetMemoryFootprint() const
 {
     size_t memoryUsage = 0;
-    // TODO this could be a pointer to reduce overhead
     memoryUsage += header.GetMemoryFootprint();
     // ~90% correct
     memoryUsage += sizeof(ransState);
+    memoryUsage += bodySize;
     if(currDecodeLayer)
         memoryUsage += currDecodeLayer->GetMemoryFootprint();
 
@@ -378,22 +481,40 @@ CompressedImageBlockHeader CompressedImageBlockHeader::Read(ByteIterator &bytes,
     return CompressedImageBlockHeader(headerTop, width, height, parentVals);
 }
 
+CompressedImageBlockHeader CompressedImageBlockHeader::Read(const std::vector<uint8_t>& bytes, uint64_t& readPos, std::vector<symbol_t> parentVals, uint32_t width, uint32_t height)
+{
+    BlockHeaderHeader headerTop = ReadValue<BlockHeaderHeader>(bytes, readPos);
+    return CompressedImageBlockHeader(headerTop, width, height, parentVals);
+}
+
 CompressedImageBlockHeader CompressedImageBlock::GetHeader()
 {
     return header;
 }
 
-CompressedImageBlockHeader::CompressedImageBlockHeader(BlockHeaderHeader header, uint32_t width, uint32_t height, std::vector<symbol_t> parentVals)
-    : width(width), height(height), blockPos(header.blockPos), finalRansState(header.finalRansState), parentVals(parentVals)
+CompressedImageBlockHeader::CompressedImageBlockHeader(BlockHeaderHeader header, uint32_t width, uint32_t height, const std::vector<symbol_t>& parentVals)
+    : width(width), height(height), blockPos(header.blockPos), finalRansState(header.finalRansState)
 {
+    assert_release(parentVals.size() <= MAX_PARENT_VALS);
+    std::copy(parentVals.begin(), parentVals.end(), this->parentVals);
+}
 
+CompressedImageBlockHeader::CompressedImageBlockHeader(const std::vector<symbol_t>& parentVals, uint32_t width, uint32_t height)
+    : width(width), height(height), blockPos(-1), finalRansState(0)
+{
+    assert_release(parentVals.size() <= MAX_PARENT_VALS);
+    std::copy(parentVals.begin(), parentVals.end(), this->parentVals);
 }
 
-CompressedImageBlockHeader::CompressedImageBlockHeader(std::vector<symbol_t> parentVals, uint32_t width, uint32_t height)
-    : parentVals(parentVals), width(width), height(height), blockPos(-1), finalRansState(0)
+CompressedImageBlockHeader::CompressedImageBlockHeader(uint32_t width, uint32_t height, size_t blockPos, state_t finalRansState, const symbol_t* parentVals, size_t parentValsStride, bool zeroFlags)
+    : width(width), height(height), blockPos(blockPos), finalRansState(finalRansState), zeroFlags(zeroFlags)
 {
-    
+    WaveletLayerSize parentValsSize = GetParentValsSize();
+    for (uint32_t y = 0; y < parentValsSize.GetHeight(); ++y)
+        for (uint32_t x = 0; x < parentValsSize.GetWidth(); ++x)
+            this->parentVals[y * parentValsSize.GetWidth() + x] = parentVals[y * parentValsStride + x];
 }
+
 CompressedImageBlockHeader::CompressedImageBlockHeader()
     : width(-1), height(-1), blockPos(-1), finalRansState(0)
 {
@@ -401,9 +522,9 @@ CompressedImageBlockHeader::CompressedImageBlockHeader()
 }
 
 CompressedImageBlockHeader::CompressedImageBlockHeader(CompressedImageBlockHeader header, size_t blockPos)
-    : parentVals(header.parentVals), width(header.width), height(header.height), finalRansState(header.finalRansState), blockPos(blockPos)
+    : CompressedImageBlockHeader(header)
 {
-
+    this->blockPos = blockPos;
 }
 
 size_t CompressedImageBlockHeader::GetBlockPos()
@@ -411,16 +532,30 @@ size_t CompressedImageBlockHeader::GetBlockPos()
     return blockPos;
 }
 
+state_t CompressedImageBlockHeader::GetFinalRansState() const
+{
+    return finalRansState;
+}
+
+const uint16_t* CompressedImageBlockHeader::GetLevelEnds() const
+{
+    return levelEnds;
+}
+
 size_t CompressedImageBlockHeader::GetMemoryFootprint() const
 {
-    // allocated bytes
-    size_t vectorMemoryUsage = parentVals.capacity() * sizeof(parentVals[0]);
-    return sizeof(CompressedImageBlockHeader) + vectorMemoryUsage;
+    // no allocations
+    return sizeof(CompressedImageBlockHeader);
+}
+
+std::vector<symbol_t> CompressedImageBlockHeader::GetParentVals() const
+{
+    return std::vector<symbol_t>(parentVals, parentVals + GetParentValsSize().GetPixelCount());
 }
 
-const std::vector<symbol_t>& CompressedImageBlockHeader::GetParentVals()
+WaveletLayerSize CompressedImageBlockHeader::GetParentValsSize() const
 {
-    return parentVals;
+    return WaveletLayerSize(width, height).GetRoot().GetParentSize();
 }
 
 uint32_t CompressedImageBlockHeader::getWidth()
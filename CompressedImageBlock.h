@@ -7,25 +7,40 @@
 #include "Precision.h"
 
 class CompressedImageBlock;
+class WaveletZeroTreeStats;
 
 //
 class CompressedImageBlockHeader
 {
     friend CompressedImageBlock;
 public:
+    // root layers are at most 2x2, so that's all the parent vals a block can have
+    static const uint32_t MAX_PARENT_VALS = 4;
+    // body lengths are kept for decodes down to levels 1 to MAX_LEVEL_ENDS, a 256 block has 6 levels above the bottom one
+    static constexpr uint32_t MAX_LEVEL_ENDS = 6;
+
     struct BlockHeaderHeader;
     CompressedImageBlockHeader();
-    CompressedImageBlockHeader(BlockHeaderHeader header, uint32_t width, uint32_t height, std::vector<symbol_t> parentVals);
+    CompressedImageBlockHeader(BlockHeaderHeader header, uint32_t width, uint32_t height, const std::vector<symbol_t>& parentVals);
     CompressedImageBlockHeader(CompressedImageBlockHeader header, size_t blockPos);
-    CompressedImageBlockHeader(std::vector<symbol_t> parentVals, uint32_t width, uint32_t height);
+    CompressedImageBlockHeader(const std::vector<symbol_t>& parentVals, uint32_t width, uint32_t height);
+    // parent vals are read from a 2D image with rows parentValsStride apart
+    CompressedImageBlockHeader(uint32_t width, uint32_t height, size_t blockPos, state_t finalRansState, const symbol_t* parentVals, size_t parentValsStride, bool zeroFlags = false);
     void Write(std::vector<uint8_t>& outputBytes);
     static CompressedImageBlockHeader Read(ByteIterator& bytes, std::vector<symbol_t> parentVals, uint32_t width, uint32_t height);
+    static CompressedImageBlockHeader Read(const std::vector<uint8_t>& bytes, uint64_t& readPos, std::vector<symbol_t> parentVals, uint32_t width, uint32_t height);
     size_t GetBlockPos();
+    state_t GetFinalRansState() const;
     // returns RAM usage
     size_t GetMemoryFootprint() const;
-    const std::vector<symbol_t> &GetParentVals();
+    std::vector<symbol_t> GetParentVals() const;
+    // body length needed to decode down to levels 1 to MAX_LEVEL_ENDS, in block_t's
+    // only set by CompressedImageBlock::WriteBody(), 0 if unknown
+    const uint16_t* GetLevelEnds() const;
     uint32_t getWidth();
 private:
+    WaveletLayerSize GetParentValsSize() const;
+
     // TODO possibly not needded?
     uint32_t width;
     uint32_t height;
@@ -33,8 +48,12 @@ private:
     // position of block in stream
     size_t blockPos;
     // rANS/wavelet vals
-    std::vector<symbol_t> parentVals;
+    // stored inline, a vector per block was tens of thousands of tiny allocations
+    symbol_t parentVals[MAX_PARENT_VALS];
     state_t finalRansState;
+    uint16_t levelEnds[MAX_LEVEL_ENDS] = {};
+    // layers below the root start with WaveletZeroTree flags, not stored in the header, it comes from the file version
+    bool zeroFlags = false;
 };
 
 class CompressedImageBlock
@@ -44,12 +63,19 @@ public:
     CompressedImageBlock() {};
     CompressedImageBlock(std::vector<symbol_t> pixelVals, uint32_t width, uint32_t height);
     CompressedImageBlock(CompressedImageBlockHeader header, Iterator<block_t> &blocks, std::shared_ptr<RansTable> symbolTable);
+    // decodes from a body that's already in memory, the block keeps it alive
+    CompressedImageBlock(CompressedImageBlockHeader header, std::shared_ptr<const std::vector<uint8_t>> body, std::shared_ptr<RansTable> symbolTable);
     std::vector<symbol_t> GetWaveletValues();
-    void WriteBody(std::vector<uint8_t>& outputBytes, const std::shared_ptr<RansTable>& globalSymbolTable);
+    // zeroFlags codes the layers below the root with WaveletZeroTree flags, v9+ blocks use them
+    void WriteBody(std::vector<uint8_t>& outputBytes, const std::shared_ptr<RansTable>& globalSymbolTable, bool zeroFlags = false);
+    // adds the zeros each layer's zero flags could skip, for symbol counting
+    void AddZeroTreeStats(WaveletZeroTreeStats& stats);
 
     std::vector<symbol_t> GetLevelPixels(uint32_t level);
     symbol_t GetPixel(uint32_t x, uint32_t y);
     std::vector<symbol_t> GetBottomLevelPixels();
+    // decodes to bottom level, pointer is valid for the lifetime of the block
+    const symbol_t* GetBottomLevelData();
 
     uint32_t GetLevel();
 
@@ -58,6 +84,11 @@ public:
     std::vector<symbol_t> GetParentVals();
 
     WaveletLayerSize GetSize() const;
+    // lowest/highest pixel, only set for blocks created from pixels
+    symbol_t GetMinValue() const;
+    symbol_t GetMaxValue() const;
+    // every pixel is the same, also only for blocks created from pixels
+    bool IsConstant() const;
 
     size_t GetMemoryFootprint() const;
 
@@ -70,4 +101,8 @@ private:
     RansState ransState;
     std::shared_ptr<WaveletEncodeLayer> encodeWaveletPyramidBottom;
     std::shared_ptr<WaveletDecodeLayer> currDecodeLayer;
+    // size of the in-memory body, if there is one
+    size_t bodySize = 0;
+    symbol_t minValue = 0;
+    symbol_t maxValue = 0;
 };
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "CompressedImage.h"
+
+#include "Release_Assert.h"
+
+// Height bounds queries
+// boundsPyramid[0] holds each block's bounds from the index, each level above merges 2x2 nodes of the one below
+// until a single node covers the whole image, so whole blocks inside a region are answered without decoding anything
+
+HeightBounds CompressedImage::GetBounds(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    assert_release(x + (uint64_t)width <= header.width && y + (uint64_t)height <= header.height);
+    HeightBounds bounds;
+    if (width == 0 || height == 0)
+        return bounds;
+
+    uint32_t endX = x + width;
+    uint32_t endY = y + height;
+    // blocks touched by the region
+    uint32_t firstBlockX = x / header.blockSize;
+    uint32_t firstBlockY = y / header.blockSize;
+    uint32_t lastBlockX = (endX - 1) / header.blockSize;
+    uint32_t lastBlockY = (endY - 1) / header.blockSize;
+
+    if (boundsPyramid.empty())
+    {
+        for (uint32_t blockY = firstBlockY; blockY <= lastBlockY; ++blockY)
+        {
+            for (uint32_t blockX = firstBlockX; blockX <= lastBlockX; ++blockX)
+                AddBlockBounds(blockX, blockY, x, y, endX, endY, bounds);
+        }
+        return bounds;
+    }
+
+    // blocks completely inside the region, edge blocks are covered if the region reaches the image edge
+    uint32_t coveredStartX = (x + header.blockSize - 1) / header.blockSize;
+    uint32_t coveredStartY = (y + header.blockSize - 1) / header.blockSize;
+    uint32_t coveredEndX = endX == header.width ? GetWidthInBlocks() : endX / header.blockSize;
+    uint32_t coveredEndY = endY == header.height ? GetHeightInBlocks() : endY / header.blockSize;
+    if (coveredStartX < coveredEndX && coveredStartY < coveredEndY)
+        AddCoveredBounds((uint32_t)boundsPyramid.size() - 1, 0, 0, coveredStartX, coveredStartY, coveredEndX, coveredEndY, bounds);
+
+    // partly covered blocks along the region edges are only decoded if they could widen the result
+    for (uint32_t blockY = firstBlockY; blockY <= lastBlockY; ++blockY)
+    {
+        for (uint32_t blockX = firstBlockX; blockX <= lastBlockX; ++blockX)
+        {
+            bool covered = blockX >= coveredStartX && blockX < coveredEndX && blockY >= coveredStartY && blockY < coveredEndY;
+            if (!covered && bounds.CanExtend(boundsPyramid[0][(size_t)blockY * GetWidthInBlocks() + blockX]))
+                AddBlockBounds(blockX, blockY, x, y, endX, endY, bounds);
+        }
+    }
+    return bounds;
+}
+
+void CompressedImage::BuildBoundsPyramid()
+{
+    boundsPyramid.resize(1);
+    uint32_t levelWidth = GetWidthInBlocks();
+    uint32_t levelHeight = GetHeightInBlocks();
+    while (levelWidth > 1 || levelHeight > 1)
+    {
+        const std::vector<HeightBounds>& below = boundsPyramid.back();
+        uint32_t belowWidth = levelWidth;
+        uint32_t belowHeight = levelHeight;
+        levelWidth = (levelWidth + 1) / 2;
+        levelHeight = (levelHeight + 1) / 2;
+
+        std::vector<HeightBounds> level;
+        level.resize((size_t)levelWidth * levelHeight);
+        for (uint32_t nodeY = 0; nodeY < belowHeight; ++nodeY)
+        {
+            for (uint32_t nodeX = 0; nodeX < belowWidth; ++nodeX)
+                level[(size_t)(nodeY / 2) * levelWidth + nodeX / 2].Add(below[(size_t)nodeY * belowWidth + nodeX]);
+        }
+        boundsPyramid.push_back(std::move(level));
+    }
+}
+
+void CompressedImage::UpdateBoundsPyramid(size_t index)
+{
+    uint32_t nodeX = index % GetWidthInBlocks();
+    uint32_t nodeY = (uint32_t)(index / GetWidthInBlocks());
+    uint32_t belowWidth = GetWidthInBlocks();
+    uint32_t belowHeight = GetHeightInBlocks();
+    for (size_t level = 1; level < boundsPyramid.size(); ++level)
+    {
+        // recalculated from the 4 nodes below, old values can't just be merged in since bounds can shrink
+        nodeX /= 2;
+        nodeY /= 2;
+        uint32_t levelWidth = (belowWidth + 1) / 2;
+        HeightBounds bounds;
+        for (uint32_t childY = nodeY * 2; childY < std::min(nodeY * 2 + 2, belowHeight); ++childY)
+        {
+            for (uint32_t childX = nodeX * 2; childX < std::min(nodeX * 2 + 2, belowWidth); ++childX)
+                bounds.Add(boundsPyramid[level - 1][(size_t)childY * belowWidth + childX]);
+        }
+        boundsPyramid[level][(size_t)nodeY * levelWidth + nodeX] = bounds;
+        belowWidth = levelWidth;
+        belowHeight = (belowHeight + 1) / 2;
+    }
+}
+
+void CompressedImage::AddCoveredBounds(uint32_t level, uint32_t nodeX, uint32_t nodeY, uint32_t blockStartX, uint32_t blockStartY, uint32_t blockEndX, uint32_t blockEndY, HeightBounds& bounds) const
+{
+    // blocks under this node, clipped to the image
+    uint32_t nodeStartX = nodeX << level;
+    uint32_t nodeStartY = nodeY << level;
+    uint32_t nodeEndX = std::min((nodeX + 1) << level, GetWidthInBlocks());
+    uint32_t nodeEndY = std::min((nodeY + 1) << level, GetHeightInBlocks());
+    if (nodeStartX >= blockEndX || nodeStartY >= blockEndY || nodeEndX <= blockStartX || nodeEndY <= blockStartY
+        || nodeStartX >= nodeEndX || nodeStartY >= nodeEndY)
+        return;
+
+    if (nodeStartX >= blockStartX && nodeStartY >= blockStartY && nodeEndX <= blockEndX && nodeEndY <= blockEndY)
+    {
+        uint32_t levelWidth = (GetWidthInBlocks() + (1 << level) - 1) >> level;
+        bounds.Add(boundsPyramid[level][(size_t)nodeY * levelWidth + nodeX]);
+        return;
+    }
+
+    for (uint32_t childY = nodeY * 2; childY < nodeY * 2 + 2; ++childY)
+    {
+        for (uint32_t childX = nodeX * 2; childX < nodeX * 2 + 2; ++childX)
+            AddCoveredBounds(level - 1, childX, childY, blockStartX, blockStartY, blockEndX, blockEndY, bounds);
+    }
+}
+
+void CompressedImage::AddBlockBounds(uint32_t blockX, uint32_t blockY, uint32_t x, uint32_t y, uint32_t endX, uint32_t endY, HeightBounds& bounds)
+{
+    uint32_t blockStartX = blockX * header.blockSize;
+    uint32_t blockStartY = blockY * header.blockSize;
+    uint32_t startX = std::max(x, blockStartX);
+    uint32_t startY = std::max(y, blockStartY);
+    uint32_t stopX = std::min(endX, blockStartX + header.blockSize);
+    uint32_t stopY = std::min(endY, blockStartY + header.blockSize);
+
+    const symbol_t* tile = GetTile(blockX, blockY);
+    for (uint32_t pixY = startY; pixY < stopY; ++pixY)
+    {
+        const symbol_t* row = &tile[(pixY - blockStartY) * GetTileStride()];
+        for (uint32_t pixX = startX; pixX < stopX; ++pixX)
+            bounds.Add(row[pixX - blockStartX]);
+    }
+}
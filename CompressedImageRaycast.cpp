@@ -0,0 +1,272 @@
+#include "CompressedImage.h"
+
+#include <cmath>
+#include <cstring>
+#include "Release_Assert.h"
+
+// Ray queries against the bilinear surface
+// cells are the squares between 4 neighbouring pixels, so the last pixel row/column has no cells of it's own
+// a quadtree node/block covers the cells starting inside it, the ones along it's right/bottom edge also use the next node's pixels
+
+struct CompressedImage::RaycastRay
+{
+    // clips [0, maxT] to a box, returns false if the ray misses it
+    bool Clip(double startX, double startY, double endX, double endY, double& tStart, double& tEnd) const
+    {
+        tStart = 0.0;
+        tEnd = maxT;
+        return ClipAxis(x, dirX, startX, endX, tStart, tEnd) && ClipAxis(y, dirY, startY, endY, tStart, tEnd);
+    }
+
+    static bool ClipAxis(double origin, double dir, double start, double end, double& tStart, double& tEnd)
+    {
+        if (dir == 0.0)
+            return origin >= start && origin <= end;
+        double t0 = (start - origin) / dir;
+        double t1 = (end - origin) / dir;
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tStart = std::max(tStart, t0);
+        tEnd = std::min(tEnd, t1);
+        return tStart <= tEnd;
+    }
+
+    double GetZ(double t) const
+    {
+        return z + dirZ * t;
+    }
+
+    // finds the first t in [t0, t1] where the ray is on or under a cell's surface
+    bool IntersectCell(uint32_t cellX, uint32_t cellY, const double heights[4], double t0, double t1, double& tHit) const;
+
+    double x, y, z;
+    double dirX, dirY, dirZ;
+    double maxT;
+};
+
+// along the ray the bilinear surface is a quadratic in t, so this is solved exactly
+bool CompressedImage::RaycastRay::IntersectCell(uint32_t cellX, uint32_t cellY, const double heights[4], double t0, double t1, double& tHit) const
+{
+    double cellMax = std::max(std::max(heights[0], heights[1]), std::max(heights[2], heights[3]));
+    if (std::min(GetZ(t0), GetZ(t1)) > cellMax)
+        return false;
+
+    // surface = a + b*u + c*v + e*u*v, u/v relative to the cell
+    double a = heights[0];
+    double b = heights[1] - heights[0];
+    double c = heights[2] - heights[0];
+    double e = heights[0] - heights[1] - heights[2] + heights[3];
+    double u = x + dirX * t0 - cellX;
+    double v = y + dirY * t0 - cellY;
+
+    // height above the surface at t0 + s = f0 + f1*s + f2*s^2
+    double f0 = GetZ(t0) - (a + b * u + c * v + e * u * v);
+    double f1 = dirZ - (b * dirX + c * dirY + e * (u * dirY + v * dirX));
+    double f2 = -e * dirX * dirY;
+    if (f0 <= 0.0)
+    {
+        tHit = t0;
+        return true;
+    }
+
+    double length = t1 - t0;
+    double s = -1.0;
+    if (std::fabs(f2) < 1e-12)
+    {
+        if (f1 < 0.0)
+            s = -f0 / f1;
+    }
+    else
+    {
+        double discriminant = f1 * f1 - 4.0 * f2 * f0;
+        if (discriminant < 0.0)
+            return false;
+        double root = std::sqrt(discriminant);
+        double s0 = (-f1 - root) / (2.0 * f2);
+        double s1 = (-f1 + root) / (2.0 * f2);
+        if (s0 > s1)
+            std::swap(s0, s1);
+        // f0 > 0, so the first crossing is the smallest non-negative root
+        s = s0 >= 0.0 ? s0 : s1;
+    }
+    if (s < 0.0 || s > length)
+        return false;
+    tHit = t0 + s;
+    return true;
+}
+
+bool CompressedImage::Raycast(float originX, float originY, float originZ, float dirX, float dirY, float dirZ, float maxT, RaycastHit& hit, float scale, float offset)
+{
+    assert_release(scale > 0.0f);
+    // no cells
+    if (header.width < 2 || header.height < 2)
+        return false;
+
+    // heights are compared in file units
+    RaycastRay ray;
+    ray.x = originX;
+    ray.y = originY;
+    ray.z = (originZ - (double)offset) / scale;
+    ray.dirX = dirX;
+    ray.dirY = dirY;
+    ray.dirZ = dirZ / (double)scale;
+    ray.maxT = maxT;
+    if (!RaycastNode(GetBoundsTopLevel(), 0, 0, ray, hit))
+        return false;
+    hit.z = hit.z * scale + offset;
+    return true;
+}
+
+bool CompressedImage::IntersectSegment(float fromX, float fromY, float fromZ, float toX, float toY, float toZ, RaycastHit& hit, float scale, float offset)
+{
+    return Raycast(fromX, fromY, fromZ, toX - fromX, toY - fromY, toZ - fromZ, 1.0f, hit, scale, offset);
+}
+
+uint32_t CompressedImage::GetBoundsTopLevel() const
+{
+    if (!boundsPyramid.empty())
+        return (uint32_t)boundsPyramid.size() - 1;
+    uint32_t level = 0;
+    while (((GetWidthInBlocks() - 1) >> level) > 0 || ((GetHeightInBlocks() - 1) >> level) > 0)
+        ++level;
+    return level;
+}
+
+HeightBounds CompressedImage::GetRaycastBounds(uint32_t level, uint32_t nodeX, uint32_t nodeY) const
+{
+    HeightBounds bounds;
+    if (boundsPyramid.empty())
+    {
+        bounds.minValue = 0;
+        bounds.maxValue = std::numeric_limits<symbol_t>::max();
+        return bounds;
+    }
+
+    uint32_t levelWidth = (GetWidthInBlocks() + (1 << level) - 1) >> level;
+    uint32_t levelHeight = (GetHeightInBlocks() + (1 << level) - 1) >> level;
+    for (uint32_t y = nodeY; y < std::min(nodeY + 2, levelHeight); ++y)
+    {
+        for (uint32_t x = nodeX; x < std::min(nodeX + 2, levelWidth); ++x)
+            bounds.Add(boundsPyramid[level][(size_t)y * levelWidth + x]);
+    }
+    return bounds;
+}
+
+bool CompressedImage::RaycastNode(uint32_t level, uint32_t nodeX, uint32_t nodeY, const RaycastRay& ray, RaycastHit& hit)
+{
+    uint64_t nodePixels = (uint64_t)header.blockSize << level;
+    uint64_t cellStartX = nodeX * nodePixels;
+    uint64_t cellStartY = nodeY * nodePixels;
+    uint64_t cellEndX = std::min<uint64_t>(cellStartX + nodePixels, header.width - 1);
+    uint64_t cellEndY = std::min<uint64_t>(cellStartY + nodePixels, header.height - 1);
+    if (cellStartX >= cellEndX || cellStartY >= cellEndY)
+        return false;
+
+    double tStart, tEnd;
+    if (!ray.Clip((double)cellStartX, (double)cellStartY, (double)cellEndX, (double)cellEndY, tStart, tEnd))
+        return false;
+    // ray stays above everything under the node
+    if (std::min(ray.GetZ(tStart), ray.GetZ(tEnd)) > GetRaycastBounds(level, nodeX, nodeY).maxValue)
+        return false;
+
+    if (level == 0)
+        return RaycastBlock(nodeX, nodeY, ray, tStart, tEnd, hit);
+
+    // children nearest the ray origin first, so the first hit found is the closest
+    // a ray can't pass through both of the other two, so their order doesn't matter
+    uint32_t nearX = ray.dirX < 0.0 ? 1 : 0;
+    uint32_t nearY = ray.dirY < 0.0 ? 1 : 0;
+    const uint32_t childOrder[4][2] = { { nearX, nearY }, { 1 - nearX, nearY }, { nearX, 1 - nearY }, { 1 - nearX, 1 - nearY } };
+    for (auto& child : childOrder)
+    {
+        if (RaycastNode(level - 1, nodeX * 2 + child[0], nodeY * 2 + child[1], ray, hit))
+            return true;
+    }
+    return false;
+}
+
+bool CompressedImage::RaycastBlock(uint32_t blockX, uint32_t blockY, const RaycastRay& ray, double tStart, double tEnd, RaycastHit& hit)
+{
+    uint32_t blockSize = header.blockSize;
+    uint32_t blockStartX = blockX * blockSize;
+    uint32_t blockStartY = blockY * blockSize;
+    uint32_t blockW = std::min(header.width - blockStartX, blockSize);
+    uint32_t blockH = std::min(header.height - blockStartY, blockSize);
+    uint32_t cellEndX = std::min(blockStartX + blockSize, header.width - 1);
+    uint32_t cellEndY = std::min(blockStartY + blockSize, header.height - 1);
+
+    // block pixels + the first column/row of the blocks right + below, which are only read if the ray reaches the edge cells
+    // copied out since reading neighbours can evict this block's tile
+    uint32_t cornerStride = blockSize + 1;
+    std::vector<symbol_t> corners;
+    corners.resize((size_t)cornerStride * cornerStride);
+    const symbol_t* tile = GetTile(blockX, blockY);
+    for (uint32_t pixY = 0; pixY < blockH; ++pixY)
+        memcpy(&corners[pixY * cornerStride], &tile[pixY * GetTileStride()], blockW * sizeof(symbol_t));
+    bool rightLoaded = false;
+    bool belowLoaded = false;
+    bool diagonalLoaded = false;
+
+    int32_t stepX = ray.dirX > 0.0 ? 1 : -1;
+    int32_t stepY = ray.dirY > 0.0 ? 1 : -1;
+    double startX = ray.x + ray.dirX * tStart;
+    double startY = ray.y + ray.dirY * tStart;
+    int64_t cellX = std::min<int64_t>(std::max<int64_t>((int64_t)std::floor(startX), blockStartX), cellEndX - 1);
+    int64_t cellY = std::min<int64_t>(std::max<int64_t>((int64_t)std::floor(startY), blockStartY), cellEndY - 1);
+
+    double t = tStart;
+    while (true)
+    {
+        // where the ray leaves the cell
+        double nextX = ray.dirX == 0.0 ? INFINITY : ((stepX > 0 ? cellX + 1 : cellX) - ray.x) / ray.dirX;
+        double nextY = ray.dirY == 0.0 ? INFINITY : ((stepY > 0 ? cellY + 1 : cellY) - ray.y) / ray.dirY;
+        double cellT = std::min(std::min(nextX, nextY), tEnd);
+
+        uint32_t localX = (uint32_t)(cellX - blockStartX);
+        uint32_t localY = (uint32_t)(cellY - blockStartY);
+        if (localX + 1 == blockSize && !rightLoaded)
+        {
+            const symbol_t* right = GetTile(blockX + 1, blockY);
+            for (uint32_t pixY = 0; pixY < blockH; ++pixY)
+                corners[pixY * cornerStride + blockSize] = right[pixY * GetTileStride()];
+            rightLoaded = true;
+        }
+        if (localY + 1 == blockSize && !belowLoaded)
+        {
+            const symbol_t* below = GetTile(blockX, blockY + 1);
+            memcpy(&corners[blockSize * cornerStride], below, blockW * sizeof(symbol_t));
+            belowLoaded = true;
+        }
+        if (localX + 1 == blockSize && localY + 1 == blockSize && !diagonalLoaded)
+        {
+            corners[blockSize * cornerStride + blockSize] = GetTile(blockX + 1, blockY + 1)[0];
+            diagonalLoaded = true;
+        }
+
+        const symbol_t* cell = &corners[localY * cornerStride + localX];
+        double heights[4] = { (double)cell[0], (double)cell[1], (double)cell[cornerStride], (double)cell[cornerStride + 1] };
+        double tHit;
+        if (ray.IntersectCell((uint32_t)cellX, (uint32_t)cellY, heights, t, cellT, tHit))
+        {
+            double u = std::min(std::max(ray.x + ray.dirX * tHit - cellX, 0.0), 1.0);
+            double v = std::min(std::max(ray.y + ray.dirY * tHit - cellY, 0.0), 1.0);
+            double top = heights[0] + (heights[1] - heights[0]) * u;
+            double bottom = heights[2] + (heights[3] - heights[2]) * u;
+            hit.t = (float)tHit;
+            hit.x = (float)(ray.x + ray.dirX * tHit);
+            hit.y = (float)(ray.y + ray.dirY * tHit);
+            hit.z = (float)(top + (bottom - top) * v);
+            return true;
+        }
+
+        if (cellT >= tEnd)
+            return false;
+        if (nextX < nextY)
+            cellX += stepX;
+        else
+            cellY += stepY;
+        if (cellX < blockStartX || cellX >= cellEndX || cellY < blockStartY || cellY >= cellEndY)
+            return false;
+        t = cellT;
+    }
+}
@@ -0,0 +1,188 @@
+#include "CompressedImage.h"
+
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+
+// Interpolated sampling of the bottom level
+// Neighbourhoods are fetched straight from the decoded block where possible, only
+// neighbourhoods that cross block/image edges fall back to per-pixel reads
+
+void CompressedImage::GetNeighbourhood(int64_t x, int64_t y, uint32_t size, symbol_t* output)
+{
+    int64_t endX = x + size - 1;
+    int64_t endY = y + size - 1;
+
+    // fast path - whole neighbourhood is inside one block
+    if (x >= 0 && y >= 0 && endX < header.width && endY < header.height
+        && x / header.blockSize == endX / header.blockSize
+        && y / header.blockSize == endY / header.blockSize)
+    {
+        uint32_t blockX = x / header.blockSize;
+        uint32_t blockY = y / header.blockSize;
+        uint32_t blockStartX = blockX * header.blockSize;
+        uint32_t blockStartY = blockY * header.blockSize;
+        // tiles are padded, rows are GetTileStride() apart even for edge blocks
+        uint32_t stride = GetTileStride();
+        const symbol_t* blockPixels = GetBlockPixelData(blockY * GetWidthInBlocks() + blockX);
+        const symbol_t* row = &blockPixels[(y - blockStartY) * stride + (x - blockStartX)];
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            memcpy(&output[i * size], row, size * sizeof(symbol_t));
+            row += stride;
+        }
+        return;
+    }
+
+    // slow path - clamp each pixel, remembering the last block since neighbours usually share one
+    size_t lastBlockIdx = -1;
+    const symbol_t* blockPixels = nullptr;
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        uint32_t pixY = (uint32_t)std::min<int64_t>(std::max<int64_t>(y + i, 0), header.height - 1);
+        for (uint32_t j = 0; j < size; ++j)
+        {
+            uint32_t pixX = (uint32_t)std::min<int64_t>(std::max<int64_t>(x + j, 0), header.width - 1);
+            uint32_t blockX = pixX / header.blockSize;
+            uint32_t blockY = pixY / header.blockSize;
+            size_t blockIdx = blockY * GetWidthInBlocks() + blockX;
+            if (blockIdx != lastBlockIdx)
+            {
+                blockPixels = GetBlockPixelData(blockIdx);
+                lastBlockIdx = blockIdx;
+            }
+            output[i * size + j] = blockPixels[(pixY % header.blockSize) * GetTileStride() + (pixX % header.blockSize)];
+        }
+    }
+}
+
+// Catmull-Rom weights for 4 samples at once
+static void CubicWeights(__m128 t, __m128 weights[4])
+{
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 t2 = _mm_mul_ps(t, t);
+    __m128 t3 = _mm_mul_ps(t2, t);
+    // -0.5t^3 + t^2 - 0.5t
+    weights[0] = _mm_sub_ps(_mm_sub_ps(t2, _mm_mul_ps(half, t3)), _mm_mul_ps(half, t));
+    // 1.5t^3 - 2.5t^2 + 1
+    weights[1] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(1.5f), t3), _mm_mul_ps(_mm_set1_ps(2.5f), t2)), _mm_set1_ps(1.0f));
+    // -1.5t^3 + 2t^2 + 0.5t
+    weights[2] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(2.0f), t2), _mm_mul_ps(_mm_set1_ps(1.5f), t3)), _mm_mul_ps(half, t));
+    // 0.5t^3 - 0.5t^2
+    weights[3] = _mm_mul_ps(half, _mm_sub_ps(t3, t2));
+}
+
+void CompressedImage::SampleBilinear(const float* xs, const float* ys, size_t count, float* output, float scale, float offset)
+{
+    // neighbourhoods are gathered into SoA layout: taps[tap][sample]
+    alignas(16) float taps[4][4];
+    alignas(16) float fracX[4];
+    alignas(16) float fracY[4];
+    alignas(16) float results[4];
+    symbol_t neighbourhood[4];
+
+    for (size_t groupStart = 0; groupStart < count; groupStart += 4)
+    {
+        size_t groupSize = std::min<size_t>(4, count - groupStart);
+        for (size_t sample = 0; sample < 4; ++sample)
+        {
+            // pad out the last group by repeating the final sample
+            if (sample >= groupSize)
+            {
+                for (size_t tap = 0; tap < 4; ++tap)
+                    taps[tap][sample] = taps[tap][groupSize - 1];
+                fracX[sample] = fracX[groupSize - 1];
+                fracY[sample] = fracY[groupSize - 1];
+                continue;
+            }
+            size_t sampleIdx = groupStart + sample;
+            float floorX = std::floor(xs[sampleIdx]);
+            float floorY = std::floor(ys[sampleIdx]);
+            GetNeighbourhood((int64_t)floorX, (int64_t)floorY, 2, neighbourhood);
+            for (size_t tap = 0; tap < 4; ++tap)
+                taps[tap][sample] = neighbourhood[tap];
+            fracX[sample] = xs[sampleIdx] - floorX;
+            fracY[sample] = ys[sampleIdx] - floorY;
+        }
+
+        __m128 tx = _mm_load_ps(fracX);
+        __m128 ty = _mm_load_ps(fracY);
+        __m128 topLeft = _mm_load_ps(taps[0]);
+        __m128 topRight = _mm_load_ps(taps[1]);
+        __m128 bottomLeft = _mm_load_ps(taps[2]);
+        __m128 bottomRight = _mm_load_ps(taps[3]);
+        __m128 top = _mm_add_ps(topLeft, _mm_mul_ps(_mm_sub_ps(topRight, topLeft), tx));
+        __m128 bottom = _mm_add_ps(bottomLeft, _mm_mul_ps(_mm_sub_ps(bottomRight, bottomLeft), tx));
+        __m128 result = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), ty));
+        result = _mm_add_ps(_mm_mul_ps(result, _mm_set1_ps(scale)), _mm_set1_ps(offset));
+        _mm_store_ps(results, result);
+
+        memcpy(&output[groupStart], results, groupSize * sizeof(float));
+    }
+}
+
+void CompressedImage::SampleBicubic(const float* xs, const float* ys, size_t count, float* output, float scale, float offset)
+{
+    alignas(16) float taps[16][4];
+    alignas(16) float fracX[4];
+    alignas(16) float fracY[4];
+    alignas(16) float results[4];
+    symbol_t neighbourhood[16];
+
+    for (size_t groupStart = 0; groupStart < count; groupStart += 4)
+    {
+        size_t groupSize = std::min<size_t>(4, count - groupStart);
+        for (size_t sample = 0; sample < 4; ++sample)
+        {
+            // pad out the last group by repeating the final sample
+            if (sample >= groupSize)
+            {
+                for (size_t tap = 0; tap < 16; ++tap)
+                    taps[tap][sample] = taps[tap][groupSize - 1];
+                fracX[sample] = fracX[groupSize - 1];
+                fracY[sample] = fracY[groupSize - 1];
+                continue;
+            }
+            size_t sampleIdx = groupStart + sample;
+            float floorX = std::floor(xs[sampleIdx]);
+            float floorY = std::floor(ys[sampleIdx]);
+            GetNeighbourhood((int64_t)floorX - 1, (int64_t)floorY - 1, 4, neighbourhood);
+            for (size_t tap = 0; tap < 16; ++tap)
+                taps[tap][sample] = neighbourhood[tap];
+            fracX[sample] = xs[sampleIdx] - floorX;
+            fracY[sample] = ys[sampleIdx] - floorY;
+        }
+
+        __m128 weightsX[4];
+        __m128 weightsY[4];
+        CubicWeights(_mm_load_ps(fracX), weightsX);
+        CubicWeights(_mm_load_ps(fracY), weightsY);
+
+        __m128 result = _mm_setzero_ps();
+        for (size_t row = 0; row < 4; ++row)
+        {
+            __m128 rowResult = _mm_setzero_ps();
+            for (size_t column = 0; column < 4; ++column)
+                rowResult = _mm_add_ps(rowResult, _mm_mul_ps(_mm_load_ps(taps[row * 4 + column]), weightsX[column]));
+            result = _mm_add_ps(result, _mm_mul_ps(rowResult, weightsY[row]));
+        }
+        result = _mm_add_ps(_mm_mul_ps(result, _mm_set1_ps(scale)), _mm_set1_ps(offset));
+        _mm_store_ps(results, result);
+
+        memcpy(&output[groupStart], results, groupSize * sizeof(float));
+    }
+}
+
+float CompressedImage::SampleBilinear(float x, float y, float scale, float offset)
+{
+    float result;
+    SampleBilinear(&x, &y, 1, &result, scale, offset);
+    return result;
+}
+
+float CompressedImage::SampleBicubic(float x, float y, float scale, float offset)
+{
+    float result;
+    SampleBicubic(&x, &y, 1, &result, scale, offset);
+    return result;
+}
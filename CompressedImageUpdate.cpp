@@ -0,0 +1,312 @@
+#include "CompressedImage.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include "Release_Assert.h"
+#include "WorkerPool.h"
+#include "AsyncFileReader.h"
+
+// In-place updates of a streamed file
+// Changed blocks are re-encoded against the symbol table already in the file (anything missing from it is
+// written raw), so the rest of the file stays valid. New bodies overwrite the footer, the footer is
+// re-written after them, and the fixed-size index entries are patched where they are
+// A parent image that outgrows it's slack moves the index + bodies back to make room, like CompressedImageWriter does
+
+bool CompressedImage::UpdateRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const symbol_t* pixels)
+{
+    if (!ReadsFromFile() || header.version < 0x0005)
+    {
+        std::cerr << "CompressedImage::UpdateRegion() needs a v5+ file opened with OpenStream()" << std::endl;
+        return false;
+    }
+    if (compactIndex)
+    {
+        // entries can't be patched in place, they aren't a fixed size
+        std::cerr << "CompressedImage::UpdateRegion() can't update a file with a compact index, it needs to be re-serialized" << std::endl;
+        return false;
+    }
+    LoadTables();
+    assert_release(x + width <= header.width && y + height <= header.height);
+    if (width == 0 || height == 0)
+        return true;
+
+    if (!encodeSymbolTable)
+    {
+        encodeSymbolTable = std::make_shared<RansTable>(globalSymbolTable->GenerateGroupCDFs(), PROBABILITY_RES);
+        encodeSymbolTable->GenerateEncodingTables();
+        // pyramids are re-encoded with their own tables
+        if (parentSymbolTable)
+        {
+            parentEncodeSymbolTable = std::make_shared<RansTable>(parentSymbolTable->GenerateGroupCDFs(), PROBABILITY_RES);
+            parentEncodeSymbolTable->GenerateEncodingTables();
+        }
+    }
+
+    // new pixels of every block the region touches, blocks that are only partly covered start from their old pixels
+    uint32_t endX = x + width;
+    uint32_t endY = y + height;
+    std::vector<size_t> dirtyBlocks;
+    std::vector<std::vector<symbol_t>> dirtyPixels;
+    for (uint32_t blockStartY = (y / header.blockSize) * header.blockSize; blockStartY < endY; blockStartY += header.blockSize)
+    {
+        for (uint32_t blockStartX = (x / header.blockSize) * header.blockSize; blockStartX < endX; blockStartX += header.blockSize)
+        {
+            uint32_t blockX = blockStartX / header.blockSize;
+            uint32_t blockY = blockStartY / header.blockSize;
+            uint32_t blockW = std::min(header.width - blockStartX, header.blockSize);
+            uint32_t blockH = std::min(header.height - blockStartY, header.blockSize);
+
+            std::vector<symbol_t> blockValues;
+            blockValues.resize(blockW * blockH);
+            bool covered = x <= blockStartX && y <= blockStartY && endX >= blockStartX + blockW && endY >= blockStartY + blockH;
+            if (!covered)
+            {
+                const symbol_t* tile = GetTile(blockX, blockY);
+                for (uint32_t pixY = 0; pixY < blockH; ++pixY)
+                    memcpy(&blockValues[pixY * blockW], &tile[pixY * header.blockSize], blockW * sizeof(symbol_t));
+            }
+
+            // overlap of block + region
+            uint32_t copyStartX = std::max(x, blockStartX);
+            uint32_t copyEndX = std::min(endX, blockStartX + blockW);
+            uint32_t copyStartY = std::max(y, blockStartY);
+            uint32_t copyEndY = std::min(endY, blockStartY + blockH);
+            for (uint32_t pixY = copyStartY; pixY < copyEndY; ++pixY)
+            {
+                memcpy(&blockValues[(pixY - blockStartY) * blockW + (copyStartX - blockStartX)],
+                    &pixels[(size_t)(pixY - y) * width + (copyStartX - x)],
+                    (copyEndX - copyStartX) * sizeof(symbol_t));
+            }
+
+            dirtyBlocks.push_back(blockY * GetWidthInBlocks() + blockX);
+            dirtyPixels.push_back(std::move(blockValues));
+        }
+    }
+
+    // encode, blocks don't depend on each other
+    std::vector<std::shared_ptr<CompressedImageBlock>> newBlocks;
+    std::vector<std::vector<uint8_t>> newBodies;
+    newBlocks.resize(dirtyBlocks.size());
+    newBodies.resize(dirtyBlocks.size());
+    WorkerPool::GetShared().ParallelFor(dirtyBlocks.size(), [&](size_t start, size_t end)
+    {
+        for (size_t i = start; i < end; ++i)
+        {
+            uint32_t blockX = dirtyBlocks[i] % GetWidthInBlocks();
+            uint32_t blockY = (uint32_t)(dirtyBlocks[i] / GetWidthInBlocks());
+            uint32_t blockW = std::min(header.width - blockX * header.blockSize, header.blockSize);
+            uint32_t blockH = std::min(header.height - blockY * header.blockSize, header.blockSize);
+            newBlocks[i] = std::make_shared<CompressedImageBlock>(dirtyPixels[i], blockW, blockH);
+            // older files always have a body, v8+ leaves it out for constant blocks, v9+ codes zero flags
+            // this secretly updates the header
+            if (header.version < 0x0008 || !newBlocks[i]->IsConstant())
+                newBlocks[i]->WriteBody(newBodies[i], encodeSymbolTable, header.version >= 0x0009);
+        }
+    });
+
+    // the parent val image only needs re-encoding if a root val changed
+    std::vector<symbol_t> newParentVals;
+    for (size_t i = 0; i < dirtyBlocks.size(); ++i)
+    {
+        uint32_t blockX = dirtyBlocks[i] % GetWidthInBlocks();
+        uint32_t blockY = (uint32_t)(dirtyBlocks[i] / GetWidthInBlocks());
+        symbol_t rootVals[4];
+        StoreRootParentVals(*newBlocks[i], 0, 0, rootVals, 2);
+        for (uint32_t rootY = 0; rootY < 2; ++rootY)
+        {
+            for (uint32_t rootX = 0; rootX < 2; ++rootX)
+            {
+                size_t parentValIdx = (blockY * 2 + rootY) * parentValsWidth + (blockX * 2 + rootX);
+                symbol_t newVal = rootVals[rootY * 2 + rootX];
+                if (newParentVals.empty() && GetRootParentVal(dirtyBlocks[i], rootX, rootY) == newVal)
+                    continue;
+                if (newParentVals.empty())
+                    newParentVals = parentPyramid ? parentPyramid->GetBottomLevelPixels() : parentVals;
+                newParentVals[parentValIdx] = newVal;
+            }
+        }
+    }
+
+    // everything is encoded before the file is touched, so a failure leaves it as it was
+    // (unless the parent image has to be given more room, the move can't be undone)
+    std::vector<uint8_t> parentsBytes;
+    std::vector<uint8_t> parentBlockBytes;
+    size_t parentOverflow = 0;
+    if (!newParentVals.empty())
+        parentOverflow = EncodeParentImage(newParentVals, parentsBytes, parentBlockBytes);
+
+    std::fstream file(filename, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file)
+        return false;
+    if (parentOverflow > 0)
+    {
+        // the room grows by at least the parent image's size each time, so a file that keeps being edited only moves a few times
+        size_t parentSize = parentBlockBytes.empty() ? parentsBytes.size() : parentBlockBytes.size();
+        size_t shift = parentOverflow + parentSize + PARENT_IMAGE_SLACK_MIN;
+        size_t indexStart = GetIndexStart();
+        std::cout << "Parent image doesn't fit, moving the index + block bodies back " << shift << " bytes..." << std::endl;
+        file.seekg(0, std::ios::end);
+        uint64_t fileEnd = file.tellg();
+        if (!MoveFileTail(file, indexStart, fileEnd, shift))
+        {
+            std::cerr << "CompressedImage::UpdateRegion() failed moving the block bodies in " << filename << std::endl;
+            return false;
+        }
+        header.blockBodyStart += shift;
+        blockBodiesStart += shift;
+        file.seekp(0);
+        file.write((const char*)&header, sizeof(header));
+    }
+    file.seekp(0, std::ios::end);
+    uint64_t writePos = (uint64_t)file.tellp() - sizeof(CompressedImageFooter);
+
+    // append bodies
+    std::vector<CompressedImageBlockIndexEntry> newEntries;
+    for (size_t i = 0; i < dirtyBlocks.size(); ++i)
+    {
+        CompressedImageBlockIndexEntry entry;
+        entry.offset = writePos - blockBodiesStart;
+        entry.length = newBodies[i].size();
+        entry.finalRansState = newBlocks[i]->GetHeader().GetFinalRansState();
+        entry.flags = newBodies[i].empty() ? CompressedImageBlockIndexEntry::FLAG_CONSTANT : 0;
+        entry.minValue = newBlocks[i]->GetMinValue();
+        entry.maxValue = newBlocks[i]->GetMaxValue();
+        // left as v6's reserved bytes in older files
+        memset(entry.levelEnds, 0, sizeof(entry.levelEnds));
+        if (header.version >= 0x0007)
+            memcpy(entry.levelEnds, newBlocks[i]->GetHeader().GetLevelEnds(), sizeof(entry.levelEnds));
+        newEntries.push_back(entry);
+
+        file.seekp(writePos);
+        file.write((const char*)newBodies[i].data(), newBodies[i].size());
+        writePos += newBodies[i].size();
+    }
+
+    // entries are written in the file's own layout, so v5 files stay v5
+    size_t entrySize = CompressedImageBlockIndexEntry::GetSize(header.version);
+    size_t blockCount = blockPositions.size();
+    CompressedImageFooter footer;
+    footer.indexStart = GetIndexStart();
+    footer.blockCount = blockCount;
+    footer.version = header.version;
+    file.seekp(writePos);
+    file.write((const char*)&footer, sizeof(footer));
+
+    // patch index
+    for (size_t i = 0; i < dirtyBlocks.size(); ++i)
+    {
+        file.seekp(footer.indexStart + dirtyBlocks[i] * entrySize);
+        file.write((const char*)&newEntries[i], entrySize);
+    }
+
+    // patch parent image, the symbol table between the two parts is unchanged
+    // a pyramid is written whole into parentsBytes
+    if (!newParentVals.empty())
+    {
+        file.seekp(parentImageStart);
+        file.write((const char*)parentsBytes.data(), parentsBytes.size());
+        if (!parentBlockBytes.empty())
+        {
+            file.seekp(parentBlockHeaderStart);
+            file.write((const char*)parentBlockBytes.data(), parentBlockBytes.size());
+        }
+    }
+
+    file.flush();
+    if (!file)
+    {
+        std::cerr << "CompressedImage::UpdateRegion() failed writing to " << filename << std::endl;
+        return false;
+    }
+    file.close();
+
+    // update in-memory copies to match
+    for (size_t i = 0; i < dirtyBlocks.size(); ++i)
+    {
+        blockPositions[dirtyBlocks[i]] = newEntries[i].offset;
+        blockLengths[dirtyBlocks[i]] = newEntries[i].length;
+        blockRansStates[dirtyBlocks[i]] = newEntries[i].finalRansState;
+        EvictBlock(dirtyBlocks[i]);
+        if (!blockLevelEnds.empty())
+            memcpy(&blockLevelEnds[dirtyBlocks[i] * CompressedImageBlockHeader::MAX_LEVEL_ENDS], newEntries[i].levelEnds, sizeof(newEntries[i].levelEnds));
+        if (!boundsPyramid.empty())
+        {
+            boundsPyramid[0][dirtyBlocks[i]].minValue = newEntries[i].minValue;
+            boundsPyramid[0][dirtyBlocks[i]].maxValue = newEntries[i].maxValue;
+            UpdateBoundsPyramid(dirtyBlocks[i]);
+        }
+    }
+    if (!newParentVals.empty() && parentPyramid)
+    {
+        // reopened from the new bytes, minus the size in front of them
+        std::lock_guard<std::mutex> guard(parentPyramidLock);
+        parentPyramid = OpenResident(std::make_shared<std::vector<uint8_t>>(parentsBytes.begin() + sizeof(uint64_t), parentsBytes.end()));
+        assert_release(parentPyramid);
+    }
+    else if (!newParentVals.empty())
+    {
+        parentVals = std::move(newParentVals);
+    }
+    // updated blocks have their own body now, so they stop sharing
+    // the caches are still right, aliases of an updated block keep the pixels it used to have
+    BuildBlockAliases();
+
+    // streams may have buffered the old data
+    fileStream = FastFileStream(filename);
+    asyncReader.reset();
+
+    return true;
+}
+
+size_t CompressedImage::EncodeParentImage(const std::vector<symbol_t>& values, std::vector<uint8_t>& parentsBytes, std::vector<uint8_t>& blockBytes)
+{
+    uint32_t parentValsHeight = values.size() / parentValsWidth;
+    size_t indexStart = GetIndexStart();
+    if (hasParentPyramid)
+    {
+        // the pyramid is small next to the image, so it's simply re-encoded whole into the slack
+        CompressedImage pyramid(values, parentValsWidth, parentValsHeight, PARENT_PYRAMID_BLOCK_SIZE);
+        pyramid.SetCompactIndex(true);
+        std::vector<uint8_t> pyramidBytes = pyramid.Serialize();
+        WriteValue(parentsBytes, (uint64_t)pyramidBytes.size());
+        parentsBytes.insert(parentsBytes.end(), pyramidBytes.begin(), pyramidBytes.end());
+        return std::max<size_t>(parentImageStart + parentsBytes.size(), indexStart) - indexStart;
+    }
+
+    std::shared_ptr<CompressedImageBlock> parentValsImage = std::make_shared<CompressedImageBlock>(values, parentValsWidth, parentValsHeight);
+
+    WriteVector(parentsBytes, parentValsImage->GetParentVals());
+
+    std::vector<uint8_t> bodyBytes;
+    parentValsImage->WriteBody(bodyBytes, parentEncodeSymbolTable);
+    CompressedImageBlockHeader(parentValsImage->GetHeader(), 0).Write(blockBytes);
+    blockBytes.insert(blockBytes.end(), bodyBytes.begin(), bodyBytes.end());
+
+    // parents are a fixed size for a given image size, the body has to fit in front of the index
+    return std::max<size_t>(parentBlockHeaderStart + blockBytes.size(), indexStart) - indexStart;
+}
+
+size_t CompressedImage::GetIndexStart() const
+{
+    return blockBodiesStart - CompressedImageIndexTrailer::GetSize(header.version) - blockPositions.size() * CompressedImageBlockIndexEntry::GetSize(header.version);
+}
+
+bool CompressedImage::MoveFileTail(std::fstream& file, uint64_t start, uint64_t end, uint64_t shift)
+{
+    // last chunk first so nothing is overwritten before it's read
+    std::vector<char> chunk;
+    chunk.resize(1024 * 1024);
+    uint64_t chunkEnd = end;
+    while (chunkEnd > start)
+    {
+        size_t chunkSize = std::min<uint64_t>(chunk.size(), chunkEnd - start);
+        uint64_t chunkStart = chunkEnd - chunkSize;
+        file.seekg(chunkStart);
+        file.read(&chunk[0], chunkSize);
+        file.seekp(chunkStart + shift);
+        file.write(&chunk[0], chunkSize);
+        chunkEnd = chunkStart;
+    }
+    return !file.fail();
+}
@@ -0,0 +1,348 @@
+#include "CompressedImageWriter.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include "WorkerPool.h"
+#include "WaveletZeroTree.h"
+#include "BlockBodyDedup.h"
+#include "CompactBlockIndex.h"
+
+CompressedImageWriter::CompressedImageWriter(ScanlineSource& source, uint32_t blockSize)
+    : source(source), header(source.GetWidth(), source.GetHeight())
+{
+    header.blockSize = blockSize;
+    widthInBlocks = (header.width + blockSize - 1) / blockSize;
+    heightInBlocks = (header.height + blockSize - 1) / blockSize;
+}
+
+bool CompressedImageWriter::Write(const std::string& filename)
+{
+    size_t parentValsWidth = CompressedImage::GetParentValsSize(header.width, header.blockSize);
+    size_t parentValsHeight = CompressedImage::GetParentValsSize(header.height, header.blockSize);
+    std::vector<symbol_t> parentValues;
+    parentValues.resize(parentValsWidth * parentValsHeight);
+
+    std::shared_ptr<RansTable> symbolTable = trainedTable;
+    if (!symbolTable)
+    {
+        SymbolCountDict symbolCounts;
+        std::cout << "Generating symbol counts..." << std::endl;
+        if (!GatherSymbols(symbolCounts, parentValues))
+        {
+            std::cerr << "CompressedImageWriter::Write() failed to read source rows" << std::endl;
+            return false;
+        }
+        std::cout << "Unique symbols: " << symbolCounts.size() << std::endl;
+
+        // generate rANS symbol table (currently costly)
+        symbolTable = std::make_shared<RansTable>(symbolCounts, PROBABILITY_RES);
+    }
+    lastSymbolTable = symbolTable;
+    // the parent image is only known up front if every block was counted
+    bool singlePass = trainedTable || sampleInterval > 1;
+
+    // everything before the index is small, so it's built in memory like Serialize() does
+    // header is filled in at the end
+    std::vector<uint8_t> byteStream;
+    byteStream.resize(sizeof(header));
+    std::cout << "Writing symbol table..." << std::endl;
+    WriteSymbolTable(byteStream, symbolTable->GenerateGroupCDFs());
+    size_t parentImageStart = byteStream.size();
+    size_t parentImageReserve = 0;
+    if (singlePass)
+    {
+        parentImageReserve = GetParentImageReserve(parentValues.size());
+        byteStream.resize(byteStream.size() + parentImageReserve);
+    }
+    else
+    {
+        CompressedImage::WriteParentImage(byteStream, parentValues, parentValsWidth, parentValsHeight);
+    }
+
+    size_t blockCount = (size_t)widthInBlocks * heightInBlocks;
+    CompressedImageFooter footer;
+    footer.indexStart = byteStream.size();
+    footer.blockCount = blockCount;
+    header.version = CompressedImageHeader::CURR_VERSION;
+    size_t entrySize = CompressedImageBlockIndexEntry::GetSize(header.version);
+    header.blockBodyStart = byteStream.size() + blockCount * entrySize + sizeof(CompressedImageIndexTrailer);
+
+    std::fstream file(filename, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "CompressedImageWriter::Write() couldn't open " << filename << std::endl;
+        return false;
+    }
+    file.write((const char*)&byteStream[0], byteStream.size());
+
+    // index is written once the bodies are done, leave room for it
+    std::vector<CompressedImageBlockIndexEntry> blockIndex;
+    blockIndex.resize(blockCount);
+    std::vector<uint8_t> indexBytes;
+    indexBytes.resize(header.blockBodyStart - footer.indexStart);
+    file.write((const char*)&indexBytes[0], indexBytes.size());
+
+    // bodies are encoded a block row at a time in parallel and written in order
+    std::cout << "Generating block bodies and index..." << std::endl;
+    uint64_t bodyWritePos = 0;
+    std::vector<std::shared_ptr<CompressedImageBlock>> blocks;
+    std::vector<std::vector<uint8_t>> bodies;
+    // bodies aren't kept once they're written, so possible duplicates are read back from the file to check them
+    BlockBodyDedup bodyDedup;
+    std::vector<uint8_t> earlierBody;
+    bodies.resize(widthInBlocks);
+    for (uint32_t blockY = 0; blockY < heightInBlocks; ++blockY)
+    {
+        if (!ReadBlockRow(blockY, blocks))
+        {
+            std::cerr << "CompressedImageWriter::Write() failed to read source rows" << std::endl;
+            return false;
+        }
+
+        WorkerPool::GetShared().ParallelFor(widthInBlocks, [&](size_t start, size_t end)
+        {
+            for (size_t blockX = start; blockX < end; ++blockX)
+            {
+                if (singlePass)
+                    CompressedImage::StoreRootParentVals(*blocks[blockX], blockX, blockY, &parentValues[0], parentValsWidth);
+                bodies[blockX].clear();
+                // constant blocks don't get a body, like Serialize()
+                // this secretly updates the header
+                if (!blocks[blockX]->IsConstant())
+                    blocks[blockX]->WriteBody(bodies[blockX], symbolTable, true);
+            }
+        });
+
+        for (uint32_t blockX = 0; blockX < widthInBlocks; ++blockX)
+        {
+            CompressedImageBlockIndexEntry& entry = blockIndex[(size_t)blockY * widthInBlocks + blockX];
+            entry.offset = bodyWritePos;
+            entry.length = bodies[blockX].size();
+            entry.finalRansState = blocks[blockX]->GetHeader().GetFinalRansState();
+            entry.minValue = blocks[blockX]->GetMinValue();
+            entry.maxValue = blocks[blockX]->GetMaxValue();
+            memcpy(entry.levelEnds, blocks[blockX]->GetHeader().GetLevelEnds(), sizeof(entry.levelEnds));
+            entry.flags = blocks[blockX]->IsConstant() ? CompressedImageBlockIndexEntry::FLAG_CONSTANT : 0;
+
+            // same as Serialize(), bodies that have already been written are shared
+            auto sameBody = [&](uint64_t offset)
+            {
+                earlierBody.resize(bodies[blockX].size());
+                file.seekg(header.blockBodyStart + offset);
+                file.read((char*)earlierBody.data(), earlierBody.size());
+                file.seekp(header.blockBodyStart + bodyWritePos);
+                return earlierBody == bodies[blockX];
+            };
+            if (bodyDedup.Find(bodies[blockX], entry.offset, sameBody))
+            {
+                bodyDedup.AddSavedBytes(bodies[blockX].size());
+                continue;
+            }
+            bodyDedup.Add(bodies[blockX], bodyWritePos);
+            file.write((const char*)bodies[blockX].data(), bodies[blockX].size());
+            bodyWritePos += bodies[blockX].size();
+        }
+    }
+    std::cout << "Block bodies size: " << bodyWritePos << " (" << bodyDedup.GetSavedBytes() << " bytes of duplicates shared)" << std::endl;
+
+    // a compact index goes at the end of the room left, right before the trailer
+    CompressedImageIndexTrailer trailer;
+    size_t indexRoom = indexBytes.size() - sizeof(trailer);
+    indexBytes.clear();
+    if (compactIndex)
+    {
+        CompactBlockIndex::Write(blockIndex, indexBytes);
+        if (indexBytes.size() <= indexRoom)
+        {
+            trailer.compactIndexSize = indexBytes.size();
+            footer.indexStart += indexRoom - indexBytes.size();
+        }
+        else
+        {
+            std::cout << "Compact index is bigger than fixed-size entries, writing those instead" << std::endl;
+            indexBytes.clear();
+        }
+    }
+    if (trailer.compactIndexSize == 0)
+    {
+        indexBytes.resize(blockCount * entrySize);
+        memcpy(&indexBytes[0], &blockIndex[0], indexBytes.size());
+    }
+    WriteValue(indexBytes, trailer);
+
+    file.write((const char*)&footer, sizeof(footer));
+
+    if (singlePass && !WriteReservedParentImage(file, parentImageStart, parentImageReserve, parentValues, footer))
+    {
+        std::cerr << "CompressedImageWriter::Write() failed writing the parent image" << std::endl;
+        return false;
+    }
+
+    std::cout << "Writing block index..." << std::endl;
+    file.seekp(footer.indexStart);
+    file.write((const char*)&indexBytes[0], indexBytes.size());
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+    file.close();
+    if (file.fail())
+    {
+        std::cerr << "CompressedImageWriter::Write() failed writing " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Final size: " << header.blockBodyStart + bodyWritePos + sizeof(footer) << std::endl;
+    return true;
+}
+
+void CompressedImageWriter::SetSampleInterval(uint32_t sampleInterval)
+{
+    this->sampleInterval = std::max(sampleInterval, 1u);
+}
+
+bool CompressedImageWriter::LoadSymbolTable(const std::string& tableFilename)
+{
+    std::ifstream file(tableFilename, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "CompressedImageWriter::LoadSymbolTable() couldn't open " << tableFilename << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (bytes.size() < sizeof(uint16_t) * 2)
+        return false;
+
+    uint64_t readPos = 0;
+    uint16_t magic = ReadValue<uint16_t>(bytes, readPos);
+    uint16_t version = ReadValue<uint16_t>(bytes, readPos);
+    if (magic != SYMBOL_TABLE_MAGIC || version > CompressedImageHeader::CURR_VERSION)
+    {
+        std::cerr << "CompressedImageWriter::LoadSymbolTable() " << tableFilename << " isn't a symbol table" << std::endl;
+        return false;
+    }
+    TableGroupList groupList = ReadSymbolTable(bytes, readPos);
+
+    // same checks as the decoding CDFTable, without asserting
+    // CDFs have to increase, and end with a non-empty escape
+    bool valid = groupList.size() >= 2 && groupList.back().second.empty() && groupList.back().first == (1 << PROBABILITY_RES) - 1;
+    for (size_t group = 1; valid && group < groupList.size(); ++group)
+        valid = groupList[group].first > groupList[group - 1].first;
+    if (!valid)
+    {
+        std::cerr << "CompressedImageWriter::LoadSymbolTable() " << tableFilename << " is invalid" << std::endl;
+        return false;
+    }
+
+    trainedTable = std::make_shared<RansTable>(groupList, PROBABILITY_RES);
+    trainedTable->GenerateEncodingTables();
+    return true;
+}
+
+bool CompressedImageWriter::SaveSymbolTable(const std::string& tableFilename) const
+{
+    if (!lastSymbolTable)
+        return false;
+
+    std::vector<uint8_t> bytes;
+    WriteValue(bytes, SYMBOL_TABLE_MAGIC);
+    WriteValue(bytes, CompressedImageHeader::CURR_VERSION);
+    WriteSymbolTable(bytes, lastSymbolTable->GenerateGroupCDFs());
+
+    std::ofstream file(tableFilename, std::ios::binary);
+    file.write((const char*)&bytes[0], bytes.size());
+    return file.good();
+}
+
+void CompressedImageWriter::SetCompactIndex(bool compact)
+{
+    compactIndex = compact;
+}
+
+bool CompressedImageWriter::ReadBlockRow(uint32_t blockY, std::vector<std::shared_ptr<CompressedImageBlock>>& blocks)
+{
+    uint32_t startRow = blockY * header.blockSize;
+    uint32_t blockH = std::min(header.height - startRow, header.blockSize);
+    rowPixels.resize((size_t)header.width * blockH);
+    if (!source.ReadRows(startRow, blockH, &rowPixels[0]))
+        return false;
+
+    blocks.resize(widthInBlocks);
+    WorkerPool::GetShared().ParallelFor(widthInBlocks, [&](size_t start, size_t end)
+    {
+        std::vector<symbol_t> blockValues;
+        for (size_t blockX = start; blockX < end; ++blockX)
+        {
+            uint32_t blockStartX = (uint32_t)blockX * header.blockSize;
+            uint32_t blockW = std::min(header.width - blockStartX, header.blockSize);
+            // Copy block values
+            blockValues.resize((size_t)blockW * blockH);
+            for (uint32_t pixY = 0; pixY < blockH; ++pixY)
+                memcpy(&blockValues[(size_t)pixY * blockW], &rowPixels[(size_t)pixY * header.width + blockStartX], blockW * sizeof(symbol_t));
+            blocks[blockX] = std::make_shared<CompressedImageBlock>(blockValues, blockW, blockH);
+        }
+    });
+    return true;
+}
+
+bool CompressedImageWriter::GatherSymbols(SymbolCountDict& symbolCounts, std::vector<symbol_t>& parentValues)
+{
+    size_t parentValsWidth = CompressedImage::GetParentValsSize(header.width, header.blockSize);
+    std::vector<std::shared_ptr<CompressedImageBlock>> blocks;
+    WaveletZeroTreeStats zeroTreeStats;
+    // sampled rows are spread evenly, starting half an interval in
+    uint32_t firstRow = std::min(sampleInterval / 2, heightInBlocks - 1);
+    for (uint32_t blockY = firstRow; blockY < heightInBlocks; blockY += sampleInterval)
+    {
+        if (!ReadBlockRow(blockY, blocks))
+            return false;
+
+        for (uint32_t blockX = 0; blockX < widthInBlocks; ++blockX)
+        {
+            CompressedImage::StoreRootParentVals(*blocks[blockX], blockX, blockY, &parentValues[0], parentValsWidth);
+            for (symbol_t symbol : blocks[blockX]->GetWaveletValues())
+                symbolCounts[symbol] += 1;
+            blocks[blockX]->AddZeroTreeStats(zeroTreeStats);
+        }
+    }
+    // same as the CompressedImage constructor
+    zeroTreeStats.AdjustCounts(symbolCounts);
+    return true;
+}
+
+size_t CompressedImageWriter::GetParentImageReserve(size_t parentValCount) const
+{
+    // parent vals are smooth, and usually compress to well under half their size
+    // anything bigger is handled by WriteReservedParentImage(), it just costs a move of the bodies
+    size_t estimatedSize = parentValCount * sizeof(symbol_t) / 2;
+    return estimatedSize + estimatedSize / CompressedImage::PARENT_IMAGE_SLACK_DIVISOR + CompressedImage::PARENT_IMAGE_SLACK_MIN;
+}
+
+bool CompressedImageWriter::WriteReservedParentImage(std::fstream& file, size_t parentImageStart, size_t reservedSize, const std::vector<symbol_t>& parentValues, CompressedImageFooter& footer)
+{
+    size_t parentValsWidth = CompressedImage::GetParentValsSize(header.width, header.blockSize);
+    size_t parentValsHeight = CompressedImage::GetParentValsSize(header.height, header.blockSize);
+    std::vector<uint8_t> parentBytes;
+    CompressedImage::WriteParentImage(parentBytes, parentValues, parentValsWidth, parentValsHeight);
+
+    if (parentBytes.size() > reservedSize)
+    {
+        // move everything after the reserved room back
+        size_t shift = parentBytes.size() - reservedSize;
+        std::cout << "Parent image doesn't fit, moving block bodies back " << shift << " bytes..." << std::endl;
+        file.seekg(0, std::ios::end);
+        uint64_t moveEnd = file.tellg();
+        CompressedImage::MoveFileTail(file, footer.indexStart, moveEnd, shift);
+        footer.indexStart += shift;
+        header.blockBodyStart += shift;
+        file.seekp(moveEnd + shift - sizeof(footer));
+        file.write((const char*)&footer, sizeof(footer));
+    }
+    else
+    {
+        // anything left over is extra slack for UpdateRegion()
+        parentBytes.resize(reservedSize);
+    }
+
+    file.seekp(parentImageStart);
+    file.write((const char*)&parentBytes[0], parentBytes.size());
+    return !file.fail();
+}
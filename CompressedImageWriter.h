@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <fstream>
+
+#include "CompressedImage.h"
+#include "ScanlineSource.h"
+
+// Encodes a ScanlineSource straight to a file, giving the same bytes as CompressedImage::Serialize()
+// the source is read twice, one block row at a time:
+// the first pass builds the symbol counts + root parent vals, the second encodes block bodies and streams them to disk
+// memory use is a block row of pixels + bodies, the symbol counts and the block index, not the whole image
+// with a sampled or trained symbol table, blocks are transformed + encoded in a single pass instead
+class CompressedImageWriter
+{
+public:
+    CompressedImageWriter(ScanlineSource& source, uint32_t blockSize);
+    bool Write(const std::string& filename);
+
+    // builds the symbol table from every sampleInterval'th block row, then encodes everything in one pass
+    // symbols missing from the sample are escaped + written raw, 1 = count every block (default)
+    void SetSampleInterval(uint32_t sampleInterval);
+    // encodes in one pass with a table saved by SaveSymbolTable(), usually from a similar image
+    bool LoadSymbolTable(const std::string& tableFilename);
+    // saves the symbol table used by the last Write()
+    bool SaveSymbolTable(const std::string& tableFilename) const;
+    // writes a CompactBlockIndex, like CompressedImage::SetCompactIndex()
+    // the room for a fixed-size index is left before the bodies are written, so the compact one is padded out to that size on disk
+    void SetCompactIndex(bool compact);
+
+private:
+    // reads block row blockY, and splits it into blocks
+    bool ReadBlockRow(uint32_t blockY, std::vector<std::shared_ptr<CompressedImageBlock>>& blocks);
+    // first pass, only every sampleInterval'th row is counted
+    bool GatherSymbols(SymbolCountDict& symbolCounts, std::vector<symbol_t>& parentValues);
+    // single pass: the parent image isn't known until every block has been encoded, so room is left for it
+    // returns the room to leave, the real size is usually a lot smaller
+    size_t GetParentImageReserve(size_t parentValCount) const;
+    // writes the parent image into the reserved room, moving the index + bodies further back if it doesn't fit
+    bool WriteReservedParentImage(std::fstream& file, size_t parentImageStart, size_t reservedSize, const std::vector<symbol_t>& parentValues, CompressedImageFooter& footer);
+
+    ScanlineSource& source;
+    CompressedImageHeader header;
+    uint32_t widthInBlocks;
+    uint32_t heightInBlocks;
+    uint32_t sampleInterval = 1;
+    bool compactIndex = false;
+    // loaded with LoadSymbolTable()
+    std::shared_ptr<RansTable> trainedTable;
+    // table used by the last Write()
+    std::shared_ptr<RansTable> lastSymbolTable;
+    // one block row of pixels
+    std::vector<symbol_t> rowPixels;
+
+    // first bytes of a saved symbol table
+    static const uint16_t SYMBOL_TABLE_MAGIC = 0xFEDE;
+};
@@ -0,0 +1,101 @@
+#include "DecodedTileCache.h"
+
+DecodedTileCache::DecodedTileCache()
+    : tileSize(0), windowSize(0)
+{
+
+}
+
+void DecodedTileCache::Resize(uint32_t tileSize, size_t tileCount)
+{
+    this->tileSize = tileSize;
+
+    // power of 4 so the slots cover a square window
+    windowSize = 1;
+    while ((size_t)windowSize * 2 * windowSize * 2 <= tileCount)
+        windowSize *= 2;
+
+    size_t slotCount = (size_t)windowSize * windowSize;
+    slab.clear();
+    slab.shrink_to_fit();
+    slab.resize(slotCount * tileSize * tileSize);
+    slotBlocks.assign(slotCount, -1);
+}
+
+symbol_t* DecodedTileCache::Find(uint32_t blockX, uint32_t blockY, size_t blockIdx)
+{
+    if (slotBlocks.empty())
+        return nullptr;
+
+    size_t slot = GetSlot(blockX, blockY);
+    if (slotBlocks[slot] != blockIdx)
+        return nullptr;
+    return &slab[slot * tileSize * tileSize];
+}
+
+symbol_t* DecodedTileCache::Insert(uint32_t blockX, uint32_t blockY, size_t blockIdx)
+{
+    size_t slot = GetSlot(blockX, blockY);
+    slotBlocks[slot] = blockIdx;
+    return &slab[slot * tileSize * tileSize];
+}
+
+void DecodedTileCache::Erase(uint32_t blockX, uint32_t blockY, size_t blockIdx)
+{
+    if (slotBlocks.empty())
+        return;
+
+    size_t slot = GetSlot(blockX, blockY);
+    if (slotBlocks[slot] == blockIdx)
+        slotBlocks[slot] = -1;
+}
+
+void DecodedTileCache::Clear()
+{
+    slab.clear();
+    slab.shrink_to_fit();
+    slotBlocks.clear();
+    slotBlocks.shrink_to_fit();
+}
+
+bool DecodedTileCache::IsAllocated() const
+{
+    return !slotBlocks.empty();
+}
+
+uint32_t DecodedTileCache::GetTileSize() const
+{
+    return tileSize;
+}
+
+uint32_t DecodedTileCache::GetWindowSize() const
+{
+    return windowSize;
+}
+
+size_t DecodedTileCache::GetMemoryFootprint() const
+{
+    return slab.capacity() * sizeof(symbol_t) + slotBlocks.capacity() * sizeof(size_t);
+}
+
+uint32_t DecodedTileCache::MortonCode(uint32_t x, uint32_t y)
+{
+    // spread the bottom 16 bits out to every other bit
+    auto Spread = [](uint32_t value)
+    {
+        value &= 0x0000FFFF;
+        value = (value | (value << 8)) & 0x00FF00FF;
+        value = (value | (value << 4)) & 0x0F0F0F0F;
+        value = (value | (value << 2)) & 0x33333333;
+        value = (value | (value << 1)) & 0x55555555;
+        return value;
+    };
+    return Spread(x) | (Spread(y) << 1);
+}
+
+size_t DecodedTileCache::GetSlot(uint32_t blockX, uint32_t blockY) const
+{
+    // the low bits of the Morton code only depend on the low bits of x and y,
+    // so blocks less than a window apart never share a slot
+    return MortonCode(blockX, blockY) & (slotBlocks.size() - 1);
+}
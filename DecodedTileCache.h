@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include "Precision.h"
+
+// Fixed-size cache of decoded bottom-level blocks ("tiles"), all stored in one slab
+// Slots are picked by the Morton (Z-order) code of the block position, so blocks that are
+// close in the image are close in memory, and any window of GetWindowSize()^2 blocks fits without evictions
+class DecodedTileCache
+{
+public:
+    DecodedTileCache();
+    // tiles are tileSize * tileSize, tileCount is rounded down to a power of 4
+    void Resize(uint32_t tileSize, size_t tileCount);
+    // returns the block's tile, or nullptr if it isn't cached
+    symbol_t* Find(uint32_t blockX, uint32_t blockY, size_t blockIdx);
+    // returns the slot for the block, evicting whatever was there before
+    symbol_t* Insert(uint32_t blockX, uint32_t blockY, size_t blockIdx);
+    // drops the block's tile if it's cached
+    void Erase(uint32_t blockX, uint32_t blockY, size_t blockIdx);
+    // frees the slab
+    void Clear();
+
+    bool IsAllocated() const;
+    uint32_t GetTileSize() const;
+    // width/height in blocks of windows that map to distinct slots
+    uint32_t GetWindowSize() const;
+    size_t GetMemoryFootprint() const;
+
+    static uint32_t MortonCode(uint32_t x, uint32_t y);
+
+private:
+    size_t GetSlot(uint32_t blockX, uint32_t blockY) const;
+
+    uint32_t tileSize;
+    uint32_t windowSize;
+    std::vector<symbol_t> slab;
+    // block in each slot, -1 if empty
+    std::vector<size_t> slotBlocks;
+};
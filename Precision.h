@@ -5,6 +5,6 @@ typedef uint16_t symbol_t;
 typedef uint16_t prob_t;
 typedef uint16_t symidx_t;
 typedef uint16_t group_t;
-typedef uint32_t count_t;
+typedef uint64_t count_t;
 typedef uint32_t block_t;
 typedef uint64_t state_t;
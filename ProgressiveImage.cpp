@@ -0,0 +1,332 @@
+#include "ProgressiveImage.h"
+
+#include <cmath>
+#include <cstring>
+#include "WorkerPool.h"
+#include "Release_Assert.h"
+
+// level of a block's root parent vals, same as CompressedImage::GetLevelPixels() works it out
+static uint32_t GetRootLevel(uint32_t width, uint32_t height)
+{
+    WaveletLayerSize rootSize = WaveletLayerSize(width, height);
+    uint32_t rootLevel = 1;
+    while (!rootSize.IsRoot())
+    {
+        rootSize = rootSize.GetParentSize();
+        ++rootLevel;
+    }
+    return rootLevel;
+}
+
+ProgressiveImage::ProgressiveImage(std::shared_ptr<CompressedImage> image)
+    : image(image), refined(false), stopping(false)
+{
+    blockSize = image->header.blockSize;
+    widthInBlocks = image->GetWidthInBlocks();
+    heightInBlocks = image->GetHeightInBlocks();
+    // everything starts out as root parent vals, so they're needed straight away
+    image->LoadTables();
+
+    size_t blockCount = (size_t)widthInBlocks * heightInBlocks;
+    blockLevels.resize(blockCount);
+    blockSamples.resize(blockCount);
+    blockRequested.resize(blockCount, false);
+    for (size_t blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+    {
+        uint32_t blockW = std::min(image->GetWidth() - (uint32_t)(blockIdx % widthInBlocks) * blockSize, blockSize);
+        uint32_t blockH = std::min(image->GetHeight() - (uint32_t)(blockIdx / widthInBlocks) * blockSize, blockSize);
+        // constant blocks are exact from the start, and never get any samples
+        blockLevels[blockIdx] = image->IsConstantBlock(blockIdx) ? 0 : (uint8_t)GetRootLevel(blockW, blockH);
+    }
+
+    // the coarse pass gives each block a few samples per root val, small blocks skip it
+    uint32_t rootLevel = GetRootLevel(blockSize, blockSize);
+    coarseLevel = rootLevel >= 3 ? rootLevel - 2 : 0;
+    passLevel = coarseLevel;
+
+    focusX = image->GetWidth() / 2;
+    focusY = image->GetHeight() / 2;
+    SortRefineOrder();
+
+    refiner = std::thread(&ProgressiveImage::RefineLoop, this);
+}
+
+ProgressiveImage::~ProgressiveImage()
+{
+    stopping = true;
+    refiner.join();
+}
+
+symbol_t ProgressiveImage::GetPixel(uint32_t x, uint32_t y)
+{
+    assert_release(x < image->GetWidth() && y < image->GetHeight());
+    uint32_t blockX = x / blockSize;
+    uint32_t blockY = y / blockSize;
+    size_t index = (size_t)blockY * widthInBlocks + blockX;
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (blockLevels[index] == 0)
+        return GetLevelSample(index, x % blockSize, y % blockSize);
+    RequestBlock(index);
+    return (symbol_t)std::lround(EstimatePixel(blockX, blockY, x % blockSize, y % blockSize));
+}
+
+void ProgressiveImage::GetRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, symbol_t* output)
+{
+    assert_release(x + (uint64_t)width <= image->GetWidth() && y + (uint64_t)height <= image->GetHeight());
+    if (width == 0 || height == 0)
+        return;
+
+    uint32_t endX = x + width;
+    uint32_t endY = y + height;
+    std::lock_guard<std::mutex> guard(lock);
+    for (uint32_t blockY = y / blockSize; blockY <= (endY - 1) / blockSize; ++blockY)
+    {
+        for (uint32_t blockX = x / blockSize; blockX <= (endX - 1) / blockSize; ++blockX)
+        {
+            size_t index = (size_t)blockY * widthInBlocks + blockX;
+            uint32_t blockStartX = blockX * blockSize;
+            uint32_t blockStartY = blockY * blockSize;
+            uint32_t copyStartX = std::max(x, blockStartX);
+            uint32_t copyStartY = std::max(y, blockStartY);
+            uint32_t copyEndX = std::min(endX, blockStartX + blockSize);
+            uint32_t copyEndY = std::min(endY, blockStartY + blockSize);
+
+            if (image->IsConstantBlock(index))
+            {
+                for (uint32_t pixY = copyStartY; pixY < copyEndY; ++pixY)
+                    std::fill_n(&output[(size_t)(pixY - y) * width + (copyStartX - x)], copyEndX - copyStartX, image->GetConstantValue(index));
+                continue;
+            }
+            if (blockLevels[index] == 0)
+            {
+                uint32_t blockW = std::min(image->GetWidth() - blockStartX, blockSize);
+                for (uint32_t pixY = copyStartY; pixY < copyEndY; ++pixY)
+                {
+                    memcpy(&output[(size_t)(pixY - y) * width + (copyStartX - x)],
+                        &blockSamples[index][(pixY - blockStartY) * blockW + (copyStartX - blockStartX)], (copyEndX - copyStartX) * sizeof(symbol_t));
+                }
+                continue;
+            }
+
+            RequestBlock(index);
+            for (uint32_t pixY = copyStartY; pixY < copyEndY; ++pixY)
+            {
+                for (uint32_t pixX = copyStartX; pixX < copyEndX; ++pixX)
+                    output[(size_t)(pixY - y) * width + (pixX - x)] = (symbol_t)std::lround(EstimatePixel(blockX, blockY, pixX - blockStartX, pixY - blockStartY));
+            }
+        }
+    }
+}
+
+void ProgressiveImage::SetFocus(uint32_t x, uint32_t y)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    focusX = x;
+    focusY = y;
+    SortRefineOrder();
+}
+
+bool ProgressiveImage::IsRefined() const
+{
+    return refined;
+}
+
+std::vector<uint8_t> ProgressiveImage::GetBlockLevels()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return blockLevels;
+}
+
+size_t ProgressiveImage::GetMemoryUsage()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    size_t memoryUsage = image->GetMemoryUsage();
+    memoryUsage += blockLevels.capacity() + blockRequested.capacity() / 8 + refineOrder.capacity() * sizeof(size_t);
+    for (auto& samples : blockSamples)
+        memoryUsage += sizeof(samples) + samples.capacity() * sizeof(symbol_t);
+    return memoryUsage;
+}
+
+std::shared_ptr<CompressedImage> ProgressiveImage::GetImage() const
+{
+    return image;
+}
+
+void ProgressiveImage::RefineLoop()
+{
+    // small batches, so blocks that get read don't wait long to jump the queue
+    size_t batchSize = (WorkerPool::GetShared().GetThreadCount() + 1) * 4;
+    std::vector<size_t> indices;
+    std::vector<uint32_t> levels;
+    std::vector<std::vector<symbol_t>> samples;
+    while (!stopping)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            NextBlocks(batchSize, indices, levels);
+        }
+        if (indices.empty())
+            break;
+
+        // decoded without the lock, reads carry on with the current levels meanwhile
+        samples.resize(indices.size());
+        WorkerPool::GetShared().ParallelFor(indices.size(), [&](size_t start, size_t end)
+        {
+            // the image's own stream belongs to whoever's using it, each range gets it's own
+            FastFileStream rangeStream;
+            if (image->ReadsFromFile())
+                rangeStream = FastFileStream(image->filename);
+            for (size_t i = start; i < end; ++i)
+                samples[i] = image->CreateBlock(indices[i], &rangeStream, levels[i])->GetLevelPixels(levels[i]);
+        });
+
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            if (levels[i] < blockLevels[indices[i]])
+            {
+                blockLevels[indices[i]] = (uint8_t)levels[i];
+                blockSamples[indices[i]] = std::move(samples[i]);
+            }
+        }
+    }
+    refined = indices.empty();
+}
+
+void ProgressiveImage::NextBlocks(size_t count, std::vector<size_t>& indices, std::vector<uint32_t>& levels)
+{
+    indices.clear();
+    levels.clear();
+    auto AddBlock = [&](size_t index, uint32_t level)
+    {
+        if (blockLevels[index] <= level)
+            return;
+        // a block can come up twice in one batch, e.g. at the end of the coarse pass and the start of pass 0
+        // it's decoded once, to the finer level, otherwise the pass would move past it
+        auto queued = std::find(indices.begin(), indices.end(), index);
+        if (queued != indices.end())
+        {
+            uint32_t& queuedLevel = levels[queued - indices.begin()];
+            queuedLevel = std::min(queuedLevel, level);
+            return;
+        }
+        indices.push_back(index);
+        levels.push_back(level);
+    };
+
+    // blocks that have been read go straight to level 0
+    while (indices.size() < count && !requestedBlocks.empty())
+    {
+        size_t index = requestedBlocks.front();
+        requestedBlocks.pop_front();
+        blockRequested[index] = false;
+        AddBlock(index, 0);
+    }
+
+    while (indices.size() < count)
+    {
+        if (refinePosition == refineOrder.size())
+        {
+            if (passLevel == 0)
+                break;
+            passLevel = 0;
+            refinePosition = 0;
+            continue;
+        }
+        AddBlock(refineOrder[refinePosition++], passLevel);
+    }
+}
+
+void ProgressiveImage::SortRefineOrder()
+{
+    refineOrder.resize((size_t)widthInBlocks * heightInBlocks);
+    for (size_t blockIdx = 0; blockIdx < refineOrder.size(); ++blockIdx)
+        refineOrder[blockIdx] = blockIdx;
+
+    auto DistanceSquared = [&](size_t index)
+    {
+        int64_t dx = (int64_t)(index % widthInBlocks) * blockSize + blockSize / 2 - focusX;
+        int64_t dy = (int64_t)(index / widthInBlocks) * blockSize + blockSize / 2 - focusY;
+        return dx * dx + dy * dy;
+    };
+    std::sort(refineOrder.begin(), refineOrder.end(), [&](size_t a, size_t b)
+    {
+        return DistanceSquared(a) < DistanceSquared(b);
+    });
+    // blocks already at the pass level are skipped, so the pass can just start over
+    refinePosition = 0;
+}
+
+float ProgressiveImage::EstimatePixel(uint32_t blockX, uint32_t blockY, uint32_t localX, uint32_t localY)
+{
+    uint32_t blockW = std::min(image->GetWidth() - blockX * blockSize, blockSize);
+    uint32_t blockH = std::min(image->GetHeight() - blockY * blockSize, blockSize);
+    if (localX >= blockW)
+    {
+        if (blockX + 1 < widthInBlocks)
+            return EstimatePixel(blockX + 1, blockY, localX - blockW, localY);
+        localX = blockW - 1;
+    }
+    if (localY >= blockH)
+    {
+        if (blockY + 1 < heightInBlocks)
+            return EstimatePixel(blockX, blockY + 1, localX, localY - blockH);
+        localY = blockH - 1;
+    }
+
+    size_t index = (size_t)blockY * widthInBlocks + blockX;
+    uint32_t level = blockLevels[index];
+    uint32_t stride = 1 << level;
+    uint32_t offsetX = localX & (stride - 1);
+    uint32_t offsetY = localY & (stride - 1);
+    if (offsetX == 0 && offsetY == 0)
+        return GetLevelSample(index, localX >> level, localY >> level);
+
+    // the next sample can be in the next block, there's nothing past the image edge so that side is held flat
+    uint32_t x0 = localX - offsetX;
+    uint32_t y0 = localY - offsetY;
+    uint32_t x1 = x0 + stride;
+    uint32_t y1 = y0 + stride;
+    float fx = offsetX / (float)stride;
+    float fy = offsetY / (float)stride;
+    if (x1 >= blockW && blockX + 1 >= widthInBlocks)
+    {
+        x1 = x0;
+        fx = 0.0f;
+    }
+    if (y1 >= blockH && blockY + 1 >= heightInBlocks)
+    {
+        y1 = y0;
+        fy = 0.0f;
+    }
+
+    float topLeft = EstimatePixel(blockX, blockY, x0, y0);
+    float topRight = EstimatePixel(blockX, blockY, x1, y0);
+    float bottomLeft = EstimatePixel(blockX, blockY, x0, y1);
+    float bottomRight = EstimatePixel(blockX, blockY, x1, y1);
+    float top = topLeft + (topRight - topLeft) * fx;
+    float bottom = bottomLeft + (bottomRight - bottomLeft) * fx;
+    return top + (bottom - top) * fy;
+}
+
+symbol_t ProgressiveImage::GetLevelSample(size_t index, uint32_t sampleX, uint32_t sampleY) const
+{
+    if (image->IsConstantBlock(index))
+        return image->GetConstantValue(index);
+    if (blockSamples[index].empty())
+        return image->GetRootParentVal(index, sampleX, sampleY);
+
+    uint32_t blockW = std::min(image->GetWidth() - (uint32_t)(index % widthInBlocks) * blockSize, blockSize);
+    uint32_t level = blockLevels[index];
+    uint32_t samplesX = (blockW + (1 << level) - 1) >> level;
+    return blockSamples[index][(size_t)sampleY * samplesX + sampleX];
+}
+
+void ProgressiveImage::RequestBlock(size_t index)
+{
+    if (blockRequested[index])
+        return;
+    blockRequested[index] = true;
+    requestedBlocks.push_back(index);
+}
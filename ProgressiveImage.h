@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "CompressedImage.h"
+
+// Non-blocking reads from a streamed image, refined in the background
+// every block starts at it's root parent vals, which are already in memory after OpenStream()
+// a background thread decodes blocks to a coarse level and then to level 0, nearest the focus point first,
+// and blocks that get read jump the queue. Reads never wait for a decode, they interpolate
+// between the samples of the best level each block has so far
+// once refined the whole image is held decoded, like the lib's Preload mode
+class ProgressiveImage
+{
+public:
+    // image has to be opened with OpenStream() or OpenResident(), and not used directly while refining
+    ProgressiveImage(std::shared_ptr<CompressedImage> image);
+    // stops the refiner, waiting for the blocks it's decoding
+    ~ProgressiveImage();
+
+    // exact once a pixel's block is at level 0, interpolated before then
+    symbol_t GetPixel(uint32_t x, uint32_t y);
+    // region must be inside the image
+    void GetRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, symbol_t* output);
+
+    // blocks nearest here are refined first, defaults to the middle of the image
+    void SetFocus(uint32_t x, uint32_t y);
+    // true once every block is at level 0
+    bool IsRefined() const;
+    // level each block is at, like CompressedImage::GetBlockLevels()
+    std::vector<uint8_t> GetBlockLevels();
+    size_t GetMemoryUsage();
+
+    std::shared_ptr<CompressedImage> GetImage() const;
+
+private:
+    void RefineLoop();
+    // picks up to count blocks to decode next, and the level to decode each to
+    void NextBlocks(size_t count, std::vector<size_t>& indices, std::vector<uint32_t>& levels);
+    // refine order for the current pass, nearest the focus point first
+    void SortRefineOrder();
+    // value at a position inside a block, or just past it's right/bottom edge (read from the neighbour)
+    // interpolated from the block's current level, falling back to neighbours for samples past the edge
+    float EstimatePixel(uint32_t blockX, uint32_t blockY, uint32_t localX, uint32_t localY);
+    // a sample of the block's current level
+    symbol_t GetLevelSample(size_t index, uint32_t sampleX, uint32_t sampleY) const;
+    // queues a block that's being read for refining ahead of everything else
+    void RequestBlock(size_t index);
+
+    std::shared_ptr<CompressedImage> image;
+    uint32_t blockSize;
+    uint32_t widthInBlocks;
+    uint32_t heightInBlocks;
+
+    // guards everything below
+    std::mutex lock;
+    // current level of each block, root level = parent vals only
+    std::vector<uint8_t> blockLevels;
+    // samples of each block's current level, empty at the root level and for constant blocks
+    std::vector<std::vector<symbol_t>> blockSamples;
+    // blocks that have been read before they were refined
+    std::deque<size_t> requestedBlocks;
+    std::vector<bool> blockRequested;
+    // blocks are decoded to coarseLevel in the first pass and level 0 in the second
+    uint32_t coarseLevel;
+    uint32_t passLevel;
+    std::vector<size_t> refineOrder;
+    size_t refinePosition = 0;
+    uint32_t focusX;
+    uint32_t focusY;
+
+    std::atomic<bool> refined;
+    std::atomic<bool> stopping;
+    std::thread refiner;
+};
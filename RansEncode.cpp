@@ -2,6 +2,7 @@
 #include "Release_Assert.h"
 #include <iostream>
 #include <algorithm>
+#include <limits>
 
 #include "RansEncode.h"
 
@@ -146,6 +147,9 @@ CDFTable::CDFTable(const SymbolCountDict& unquantizedCounts, uint16_t probabilit
 	// TODO this isn't the "ideal" value, but it's close enough, and equal to the equation used in the preceding heuristic
 	// this number isn't allowed to change
 	prob_t noCompressPDF = (rawSymbolCount * probabilityRange) / countsSum;
+	// always keep an escape, even if nothing was culled - symbols missing from the counts are written raw
+	// the last CDF entry is 1 short of probabilityRange, so 2 is the smallest usable PDF
+	noCompressPDF = std::max<prob_t>(noCompressPDF, 2);
 
 	// this is needed for GetSymbolGroup optimizations to work
 	assert_release(noCompressPDF > 0);
@@ -181,7 +185,8 @@ CDFTable::CDFTable(const SymbolCountDict& unquantizedCounts, uint16_t probabilit
 	// TODO https://cbloomrants.blogspot.com/2014/02/02-11-14-understanding-ans-10.html
 	while (quantizedGroupPDFsSum > probabilityRange)
 	{
-		double smallestError = probabilityRange;
+		// the error is in bits over the whole stream, with big counts it's way over probabilityRange
+		double smallestError = std::numeric_limits<double>::infinity();
 		group_t smallestErrorGroup = -1;
 		for (auto quantizedPDF : quantizedGroupPDFs)
 		{
@@ -209,7 +214,7 @@ CDFTable::CDFTable(const SymbolCountDict& unquantizedCounts, uint16_t probabilit
 		// we now have the symbol that gives the smallest-entropy error
 		// when subtracting one from it's quantized count/probability
 		// TODO ERROR
-		assert_release(smallestErrorGroup != -1);
+		assert_release(smallestErrorGroup != (group_t)-1);
 
 		// subtract one from probability
 		quantizedGroupPDFs[smallestErrorGroup] -= 1;
@@ -233,7 +238,7 @@ CDFTable::CDFTable(const SymbolCountDict& unquantizedCounts, uint16_t probabilit
 				biggestGainGroup = quantizedPDF.first;
 			}
 		}
-		assert_release(biggestGainGroup != -1);
+		assert_release(biggestGainGroup != (group_t)-1);
 
 		// Add one to probability
 		quantizedGroupPDFs[biggestGainGroup] += 1;
@@ -334,6 +339,9 @@ CDFTable::CDFTable(const SymbolCountDict& unquantizedCounts, uint16_t probabilit
 		{
 			pivotIdx = groupCDFs.size();
 			pivotCDF = finalCDF;
+			// a group start of 0 means fast path, so with no fast path groups the first slow one can't start there
+			if (symbols.empty())
+				symbols.push_back(0);
 		}
 		count_t groupSymbolCount = finalGroupSymbolCounts[groupPDF.symbol];
 		finalSymbols += groupEntryCount;
@@ -376,6 +384,12 @@ CDFTable::CDFTable(const SymbolCountDict& unquantizedCounts, uint16_t probabilit
 		assert_release(groupSymbolCount == checkedCount);
 	}
 	finalCount += rawSymbolCount;
+	// every group has 1 symbol, put the pivot at the end so everything takes the fast path
+	if (pivotIdx == PIVOT_INVALID)
+	{
+		pivotIdx = groupCDFs.size();
+		pivotCDF = finalCDF;
+	}
 	rawCDF = finalCDF;
 	finalCDF += noCompressPDF;
 	finalEntropy += rawValuesEntropy;
@@ -404,45 +418,7 @@ CDFTable::CDFTable(const SymbolCountDict& unquantizedCounts, uint16_t probabilit
 	assert_release(countsSum == finalCount);
 	assert_release(probabilityRange == finalCDF);
 
-	// generate encoding tables
-	prob_t lastCDF = 0;
-	for (int i = 0; i < groupCDFs.size() - 1;++i)
-	{
-		prob_t groupCDF = groupCDFs[i];
-		prob_t groupPDF = groupCDF - lastCDF;
-
-		assert_release(lastCDF != rawCDF);
-
-		// fast path
-		symidx_t groupEntryCount = 1;
-		symidx_t groupStart = i;
-
-		// slow path
-		if (i >= pivotIdx)
-		{
-			// convert to group start index
-			groupStart -= pivotIdx;
-			symidx_t nextGroupStart = symbols.size();
-			if (groupStart < groupStarts.size() - 1)
-				nextGroupStart = groupStarts[groupStart + 1];
-			// get actual start
-			groupStart = groupStarts[groupStart];
-			assert_release(nextGroupStart > groupStart);
-			groupEntryCount = nextGroupStart - groupStart;
-		}
-
-		for (int j = 0; j < groupEntryCount; ++j)
-		{
-			symbol_t symbol = symbols[groupStart + j];
-			symbolGroupsOut[symbol] = RansGroup(groupStart, groupEntryCount, groupPDF, lastCDF);
-			symbolSubIdxOut[symbol] = j;
-		}
-
-		lastCDF = groupCDF;
-	}
-
-	// remaining CDF should be raw
-	assert_release(lastCDF == rawCDF);
+	GenerateEncodingTables(symbolGroupsOut, symbolSubIdxOut);
 
 	// check all symbols encode/decode correctly
 	for (auto symbolCount : unquantizedCounts)
@@ -509,6 +485,9 @@ CDFTable::CDFTable(const TableGroupList& groupList, uint32_t probabilityRes)
 			pivotIdx = groupCDFs.size();
 			if(group > 0)
 				pivotCDF = groupList[group - 1].first;
+			// same padding as the encoder
+			if (symbols.empty())
+				symbols.push_back(0);
 		}
 
 		if (pivotIdx != PIVOT_INVALID)
@@ -531,6 +510,12 @@ CDFTable::CDFTable(const TableGroupList& groupList, uint32_t probabilityRes)
 	}
 
 	rawCDF = groupCDFs.back();
+	// same as the encoder, a table with no multi-symbol groups is all fast path
+	if (pivotIdx == PIVOT_INVALID)
+	{
+		pivotIdx = groupCDFs.size();
+		pivotCDF = rawCDF;
+	}
 
 	assert_release(groupList.back().second.size() == 0);
 	groupCDFs.push_back(groupList.back().first);
@@ -616,6 +601,48 @@ symbol_t CDFTable::GetSymbol(group_packed_t group, symidx_t symbolIndex)
 	return symbols[((group >> 32) & 0xFFFF) + symbolIndex];
 }
 
+void CDFTable::GenerateEncodingTables(std::unordered_map<symbol_t, RansGroup>& symbolGroupsOut, std::unordered_map<symbol_t, symidx_t>& symbolSubIdxOut) const
+{
+	prob_t lastCDF = 0;
+	for (int i = 0; i < groupCDFs.size() - 1;++i)
+	{
+		prob_t groupCDF = groupCDFs[i];
+		prob_t groupPDF = groupCDF - lastCDF;
+
+		assert_release(lastCDF != rawCDF);
+
+		// fast path
+		symidx_t groupEntryCount = 1;
+		symidx_t groupStart = i;
+
+		// slow path
+		if (i >= pivotIdx)
+		{
+			// convert to group start index
+			groupStart -= pivotIdx;
+			symidx_t nextGroupStart = symbols.size();
+			if (groupStart < groupStarts.size() - 1)
+				nextGroupStart = groupStarts[groupStart + 1];
+			// get actual start
+			groupStart = groupStarts[groupStart];
+			assert_release(nextGroupStart > groupStart);
+			groupEntryCount = nextGroupStart - groupStart;
+		}
+
+		for (int j = 0; j < groupEntryCount; ++j)
+		{
+			symbol_t symbol = symbols[groupStart + j];
+			symbolGroupsOut[symbol] = RansGroup(groupStart, groupEntryCount, groupPDF, lastCDF);
+			symbolSubIdxOut[symbol] = j;
+		}
+
+		lastCDF = groupCDF;
+	}
+
+	// remaining CDF should be raw
+	assert_release(lastCDF == rawCDF);
+}
+
 TableGroupList CDFTable::GenerateGroupCDFs()
 {
 	TableGroupList groupList;
@@ -654,6 +681,7 @@ TableGroupList CDFTable::GenerateGroupCDFs()
 RansTable::RansTable(SymbolCountDict unquantizedCounts, uint32_t probabilityRes)
 {
 	cdfTable = CDFTable(unquantizedCounts, probabilityRes, symbolGroups, symbolSubIdx);
+	rawGroup = GetRawGroup(cdfTable.GenerateGroupCDFs());
 }
 
 RansTable::RansTable(const TableGroupList& groupList, uint32_t probabilityRes)
@@ -661,6 +689,22 @@ RansTable::RansTable(const TableGroupList& groupList, uint32_t probabilityRes)
 	cdfTable = CDFTable(groupList, probabilityRes);
 }
 
+void RansTable::GenerateEncodingTables()
+{
+	symbolGroups.clear();
+	symbolSubIdx.clear();
+	cdfTable.GenerateEncodingTables(symbolGroups, symbolSubIdx);
+	rawGroup = GetRawGroup(cdfTable.GenerateGroupCDFs());
+}
+
+RansGroup RansTable::GetRawGroup(const TableGroupList& groupList)
+{
+	// last entry is the end of the raw range, the one before it is the start
+	assert_release(groupList.size() >= 2);
+	prob_t rawCDF = groupList[groupList.size() - 2].first;
+	return RansGroup(-1, -1, groupList.back().first - rawCDF, rawCDF);
+}
+
 TableGroupList RansTable::GenerateGroupCDFs()
 {
 	return cdfTable.GenerateGroupCDFs();
@@ -668,7 +712,11 @@ TableGroupList RansTable::GenerateGroupCDFs()
 
 RansGroup RansTable::GetSymbolGroup(symbol_t symbol)
 {
-	return symbolGroups[symbol];
+	auto foundGroup = symbolGroups.find(symbol);
+	// escape - symbols missing from the table are written raw
+	if (foundGroup == symbolGroups.end())
+		return rawGroup;
+	return foundGroup->second;
 }
 
 symidx_t RansTable::GetSymbolSubIdx(const symbol_t symbol)
@@ -687,6 +735,19 @@ symbol_t RansTable::GetSymbolFromGroup(const group_packed_t group, const symidx_
 	return cdfTable.GetSymbol(group, subIndex);
 }
 
+double RansTable::GetSymbolBits(symbol_t symbol)
+{
+	RansGroup group = GetSymbolGroup(symbol);
+	double bits = -log2(double(group.pdf) / (1 << PROBABILITY_RES));
+	// raw symbols are written as a whole block
+	if (group.start == (symidx_t)-1)
+		return bits + 8 * sizeof(block_t);
+	// + sub-index in the group
+	if (group.start != 0 && group.count > 1)
+		bits += log2(double(group.count));
+	return bits;
+}
+
 size_t RansTable::GetMemoryFootprint() const
 {
 	// this isn't that accurate
@@ -1004,6 +1065,34 @@ void RansState::AddSymbol(symbol_t symbol)
 	*/
 }
 
+void RansState::AddFlag(bool flag, prob_t setProbability)
+{
+	// set = [0, setProbability), not set = [setProbability, PROBABILITY_RANGE)
+	assert_release(setProbability > 0);
+	if (flag)
+		AddGroup(RansGroup(0, 0, setProbability, 0));
+	else
+		AddGroup(RansGroup(0, 0, PROBABILITY_RANGE - setProbability, setProbability));
+}
+
+bool RansState::ReadFlag(prob_t setProbability)
+{
+	prob_t cumulativeProb = ransState % PROBABILITY_RANGE;
+	bool flag = cumulativeProb < setProbability;
+	state_t pdf = flag ? setProbability : PROBABILITY_RANGE - setProbability;
+	state_t cdf = flag ? 0 : setProbability;
+	ransState = (ransState / PROBABILITY_RANGE) * pdf + cumulativeProb - cdf;
+
+	// feed data into state as needed
+	while (ransState < STATE_MIN)
+	{
+		ransState *= BLOCK_SIZE;
+		ransState += compressedBlocks->back();
+		compressedBlocks->pop_back();
+	}
+	return flag;
+}
+
 // Decode symbol
 symbol_t RansState::ReadSymbol()
 {
@@ -1123,6 +1212,11 @@ const std::vector<block_t> RansState::GetCompressedBlocks()
 	return compressedBlocks->get_vec();
 }
 
+size_t RansState::GetCompressedBlockCount()
+{
+	return compressedBlocks->size();
+}
+
 
 uint64_t RansState::GetRansState()
 {
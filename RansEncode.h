@@ -86,6 +86,8 @@ public:
 	// used for writing to disk
 	// [group](PDF, symbols[])
 	TableGroupList GenerateGroupCDFs();
+	// symbol -> group + sub-index maps for encoding, from the same symbols[] layout GetSymbol() decodes with
+	void GenerateEncodingTables(std::unordered_map<symbol_t, RansGroup>& symbolGroupsOut, std::unordered_map<symbol_t, symidx_t>& symbolSubIdxOut) const;
 
 private:
 	// set to group idx of lowest group with >1 count
@@ -112,6 +114,9 @@ public:
 	// decoding
 	RansTable(const TableGroupList &unquantizedCounts, uint32_t probabilityRes);
 
+	// fills in the encoding maps of a decoding table, so new data can be encoded against a table read from disk
+	void GenerateEncodingTables();
+
 	inline RansGroup GetSymbolGroup(const symbol_t symbol);
 	inline symidx_t GetSymbolSubIdx(const symbol_t symbol);
 	// this doesn't get inlined - we return an int so it at least returns in a register
@@ -122,6 +127,9 @@ public:
 	// [group](PDF, symbols[])
 	TableGroupList GenerateGroupCDFs();
 
+	// roughly what encoding a symbol costs, needs the encoding tables
+	double GetSymbolBits(symbol_t symbol);
+
 	// Get RAM usage
 	size_t GetMemoryFootprint() const;
 
@@ -130,6 +138,9 @@ private:
 	// TODO do we need both of these? used for encoding
 	std::unordered_map<symbol_t, RansGroup> symbolGroups;
 	std::unordered_map<symbol_t, symidx_t> symbolSubIdx;
+	// used for symbols that aren't in symbolGroups, they're written out uncompressed
+	RansGroup rawGroup = RansGroup(-1, -1, 0, 0);
+	static RansGroup GetRawGroup(const TableGroupList& groupList);
 };
 
 class RansState
@@ -150,14 +161,26 @@ public:
 	// Decode symbol
 	symbol_t ReadSymbol();
 
+	// Encode a yes/no flag, setProbability is the chance of it being set out of 1 << PROBABILITY_RES
+	// doesn't touch the symbol table, so the probability can change from flag to flag
+	void AddFlag(bool flag, prob_t setProbability);
+	// Decode flag, probability has to match the one it was encoded with
+	bool ReadFlag(prob_t setProbability);
+
 	// this isn't really const...
 	const std::vector<block_t> GetCompressedBlocks();
+	// blocks written so far, without copying them
+	size_t GetCompressedBlockCount();
 	state_t GetRansState();
 	bool HasData();
 
 	// true if initialized properly
 	bool IsValid();
 
+	// bits + bytes that can hold any state, STATE_MAX below is (1 << STATE_BITS) - 1
+	static constexpr uint32_t STATE_BITS = PROBABILITY_RES + 8 * sizeof(block_t);
+	static constexpr uint32_t STATE_BYTES = (STATE_BITS + 7) / 8;
+
 private:
 	// TODO used to work around bad math
 	void AddGroup(RansGroup group);
@@ -167,6 +190,7 @@ private:
 	static constexpr state_t STATE_MIN = PROBABILITY_RANGE;
 	static constexpr state_t STATE_MAX = (STATE_MIN * BLOCK_SIZE) - 1;
 	static_assert(STATE_MIN < STATE_MAX, "STATE_MIN larger than STATE_MAX");
+	static_assert((STATE_MAX >> STATE_BITS) == 0, "STATE_BITS too small for STATE_MAX");
 	state_t ransState;
 	std::shared_ptr<VectorStream<block_t>> compressedBlocks;
 	// so we can reuse one hunk of memory
@@ -0,0 +1,312 @@
+#include "ScanlineSource.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+MemoryScanlineSource::MemoryScanlineSource(const std::vector<symbol_t>& values, uint32_t width, uint32_t height)
+    : values(values), width(width), height(height)
+{
+
+}
+
+uint32_t MemoryScanlineSource::GetWidth() const
+{
+    return width;
+}
+
+uint32_t MemoryScanlineSource::GetHeight() const
+{
+    return height;
+}
+
+bool MemoryScanlineSource::ReadRows(uint32_t startRow, uint32_t rowCount, symbol_t* output)
+{
+    if (startRow + (uint64_t)rowCount > height)
+        return false;
+    memcpy(output, &values[(size_t)startRow * width], (size_t)rowCount * width * sizeof(symbol_t));
+    return true;
+}
+
+// TIFF tags used
+enum TiffTag : uint16_t
+{
+    TIFF_IMAGE_WIDTH = 256,
+    TIFF_IMAGE_LENGTH = 257,
+    TIFF_BITS_PER_SAMPLE = 258,
+    TIFF_COMPRESSION = 259,
+    TIFF_STRIP_OFFSETS = 273,
+    TIFF_SAMPLES_PER_PIXEL = 277,
+    TIFF_ROWS_PER_STRIP = 278,
+    TIFF_STRIP_BYTE_COUNTS = 279,
+    TIFF_TILE_WIDTH = 322,
+    TIFF_TILE_LENGTH = 323,
+    TIFF_TILE_OFFSETS = 324,
+    TIFF_TILE_BYTE_COUNTS = 325,
+    TIFF_SAMPLE_FORMAT = 339
+};
+
+// TIFF field types used
+enum TiffType : uint16_t
+{
+    TIFF_SHORT = 3,
+    TIFF_LONG = 4
+};
+
+TiffScanlineSource::TiffScanlineSource(const std::string& filename)
+    : file(filename, std::ios::binary)
+{
+    if (file.is_open())
+        valid = ReadDirectory();
+}
+
+bool TiffScanlineSource::IsValid() const
+{
+    return valid;
+}
+
+uint32_t TiffScanlineSource::GetWidth() const
+{
+    return width;
+}
+
+uint32_t TiffScanlineSource::GetHeight() const
+{
+    return height;
+}
+
+bool TiffScanlineSource::ReadRows(uint32_t startRow, uint32_t rowCount, symbol_t* output)
+{
+    if (!valid || startRow + (uint64_t)rowCount > height)
+        return false;
+
+    uint32_t row = startRow;
+    uint32_t endRow = startRow + rowCount;
+    while (row < endRow)
+    {
+        uint32_t chunkRow = row / chunkHeight;
+        uint32_t rowInChunk = row % chunkHeight;
+        uint32_t rowsToCopy = std::min(endRow - row, chunkHeight - rowInChunk);
+        symbol_t* rowOutput = &output[(size_t)(row - startRow) * width];
+        if (tiled)
+        {
+            if (chunkRow != cachedTileRow && !ReadTileRow(chunkRow))
+                return false;
+            memcpy(rowOutput, &chunkRowPixels[(size_t)rowInChunk * width], (size_t)rowsToCopy * width * sizeof(symbol_t));
+        }
+        else
+        {
+            // strip rows are contiguous, so they can be read straight into the output
+            uint64_t position = chunkOffsets[chunkRow] + (uint64_t)rowInChunk * width * sizeof(symbol_t);
+            if (!ReadPixels(position, (size_t)rowsToCopy * width, rowOutput))
+                return false;
+        }
+        row += rowsToCopy;
+    }
+    return true;
+}
+
+bool TiffScanlineSource::ReadDirectory()
+{
+    uint8_t fileHeader[8];
+    if (!ReadBytes(0, sizeof(fileHeader), fileHeader))
+        return false;
+    if (fileHeader[0] == 'I' && fileHeader[1] == 'I')
+        bigEndian = false;
+    else if (fileHeader[0] == 'M' && fileHeader[1] == 'M')
+        bigEndian = true;
+    else
+        return false;
+    // 43 is BigTIFF, which isn't supported
+    if (ToShort(&fileHeader[2]) != 42)
+        return false;
+
+    uint32_t directoryStart = ToLong(&fileHeader[4]);
+    uint8_t entryCountBytes[2];
+    if (!ReadBytes(directoryStart, sizeof(entryCountBytes), entryCountBytes))
+        return false;
+    uint16_t entryCount = ToShort(entryCountBytes);
+    if (entryCount == 0)
+        return false;
+    std::vector<uint8_t> entries;
+    entries.resize(entryCount * 12);
+    if (!ReadBytes(directoryStart + 2, entries.size(), &entries[0]))
+        return false;
+
+    // defaults from the spec
+    uint32_t bitsPerSample = 1;
+    uint32_t compression = 1;
+    uint32_t samplesPerPixel = 1;
+    uint32_t rowsPerStrip = -1;
+    uint32_t sampleFormat = 1;
+    uint32_t tileWidth = 0;
+    uint32_t tileHeight = 0;
+    for (uint16_t entryIdx = 0; entryIdx < entryCount; ++entryIdx)
+    {
+        const uint8_t* entry = &entries[entryIdx * 12];
+        uint16_t tag = ToShort(&entry[0]);
+        uint16_t type = ToShort(&entry[2]);
+        uint32_t count = ToLong(&entry[4]);
+
+        std::vector<uint32_t> values;
+        switch (tag)
+        {
+        case TIFF_IMAGE_WIDTH:
+        case TIFF_IMAGE_LENGTH:
+        case TIFF_BITS_PER_SAMPLE:
+        case TIFF_COMPRESSION:
+        case TIFF_SAMPLES_PER_PIXEL:
+        case TIFF_ROWS_PER_STRIP:
+        case TIFF_TILE_WIDTH:
+        case TIFF_TILE_LENGTH:
+        case TIFF_SAMPLE_FORMAT:
+            if (!ReadTagValues(type, count, &entry[8], values) || values.empty())
+                return false;
+            break;
+        case TIFF_STRIP_OFFSETS:
+        case TIFF_TILE_OFFSETS:
+            if (!ReadTagValues(type, count, &entry[8], chunkOffsets))
+                return false;
+            break;
+        case TIFF_STRIP_BYTE_COUNTS:
+        case TIFF_TILE_BYTE_COUNTS:
+            if (!ReadTagValues(type, count, &entry[8], chunkByteCounts))
+                return false;
+            break;
+        default:
+            break;
+        }
+
+        switch (tag)
+        {
+        case TIFF_IMAGE_WIDTH: width = values[0]; break;
+        case TIFF_IMAGE_LENGTH: height = values[0]; break;
+        case TIFF_BITS_PER_SAMPLE: bitsPerSample = values[0]; break;
+        case TIFF_COMPRESSION: compression = values[0]; break;
+        case TIFF_SAMPLES_PER_PIXEL: samplesPerPixel = values[0]; break;
+        case TIFF_ROWS_PER_STRIP: rowsPerStrip = values[0]; break;
+        case TIFF_TILE_WIDTH: tileWidth = values[0]; break;
+        case TIFF_TILE_LENGTH: tileHeight = values[0]; break;
+        case TIFF_SAMPLE_FORMAT: sampleFormat = values[0]; break;
+        case TIFF_TILE_OFFSETS: tiled = true; break;
+        default: break;
+        }
+    }
+
+    // 16-bit unsigned/signed greyscale, stored as-is
+    if (width == 0 || height == 0 || bitsPerSample != 16 || samplesPerPixel != 1 || compression != 1 || sampleFormat > 2)
+        return false;
+
+    if (tiled)
+    {
+        if (tileWidth == 0 || tileHeight == 0)
+            return false;
+        chunkWidth = tileWidth;
+        chunkHeight = tileHeight;
+    }
+    else
+    {
+        chunkWidth = width;
+        chunkHeight = std::min(rowsPerStrip, height);
+        if (chunkHeight == 0)
+            return false;
+    }
+
+    // every chunk has to be there, and big enough to hold it's pixels
+    uint32_t chunksAcross = (width + chunkWidth - 1) / chunkWidth;
+    uint32_t chunksDown = (height + chunkHeight - 1) / chunkHeight;
+    if (chunkOffsets.size() < (size_t)chunksAcross * chunksDown || chunkByteCounts.size() != chunkOffsets.size())
+        return false;
+    for (uint32_t chunkY = 0; chunkY < chunksDown; ++chunkY)
+    {
+        // only the last strip can be short, tiles are always full size
+        uint32_t chunkRows = tiled ? chunkHeight : std::min(chunkHeight, height - chunkY * chunkHeight);
+        for (uint32_t chunkX = 0; chunkX < chunksAcross; ++chunkX)
+        {
+            if (chunkByteCounts[chunkY * chunksAcross + chunkX] < (uint64_t)chunkWidth * chunkRows * sizeof(symbol_t))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool TiffScanlineSource::ReadTagValues(uint16_t type, uint32_t count, const uint8_t* valueField, std::vector<uint32_t>& values)
+{
+    size_t valueSize;
+    if (type == TIFF_SHORT)
+        valueSize = sizeof(uint16_t);
+    else if (type == TIFF_LONG)
+        valueSize = sizeof(uint32_t);
+    else
+        return false;
+
+    std::vector<uint8_t> valueBytes;
+    valueBytes.resize((size_t)count * valueSize);
+    if (valueBytes.size() <= 4)
+        memcpy(valueBytes.data(), valueField, valueBytes.size());
+    else if (!ReadBytes(ToLong(valueField), valueBytes.size(), &valueBytes[0]))
+        return false;
+
+    values.resize(count);
+    for (uint32_t valueIdx = 0; valueIdx < count; ++valueIdx)
+    {
+        if (type == TIFF_SHORT)
+            values[valueIdx] = ToShort(&valueBytes[valueIdx * valueSize]);
+        else
+            values[valueIdx] = ToLong(&valueBytes[valueIdx * valueSize]);
+    }
+    return true;
+}
+
+bool TiffScanlineSource::ReadBytes(uint64_t position, size_t count, void* output)
+{
+    file.clear();
+    file.seekg(position);
+    file.read((char*)output, count);
+    return file.gcount() == (std::streamsize)count;
+}
+
+uint16_t TiffScanlineSource::ToShort(const uint8_t* bytes) const
+{
+    if (bigEndian)
+        return (uint16_t)((bytes[0] << 8) | bytes[1]);
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+uint32_t TiffScanlineSource::ToLong(const uint8_t* bytes) const
+{
+    if (bigEndian)
+        return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+    return bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+bool TiffScanlineSource::ReadPixels(uint64_t position, size_t count, symbol_t* output)
+{
+    if (!ReadBytes(position, count * sizeof(symbol_t), output))
+        return false;
+    if (bigEndian)
+    {
+        for (size_t i = 0; i < count; ++i)
+            output[i] = (symbol_t)((output[i] >> 8) | (output[i] << 8));
+    }
+    return true;
+}
+
+bool TiffScanlineSource::ReadTileRow(uint32_t tileRow)
+{
+    uint32_t tilesAcross = (width + chunkWidth - 1) / chunkWidth;
+    chunkRowPixels.resize((size_t)width * chunkHeight);
+    std::vector<symbol_t> tilePixels;
+    tilePixels.resize((size_t)chunkWidth * chunkHeight);
+    for (uint32_t tileX = 0; tileX < tilesAcross; ++tileX)
+    {
+        if (!ReadPixels(chunkOffsets[tileRow * tilesAcross + tileX], tilePixels.size(), &tilePixels[0]))
+            return false;
+        // edge tiles are padded past the image
+        uint32_t copyWidth = std::min(chunkWidth, width - tileX * chunkWidth);
+        for (uint32_t y = 0; y < chunkHeight; ++y)
+            memcpy(&chunkRowPixels[(size_t)y * width + tileX * chunkWidth], &tilePixels[(size_t)y * chunkWidth], copyWidth * sizeof(symbol_t));
+    }
+    cachedTileRow = tileRow;
+    return true;
+}
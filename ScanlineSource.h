@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <stdint.h>
+
+#include "Precision.h"
+
+// Source of image rows for CompressedImageWriter, so the whole image never has to be in memory
+// rows can be read more than once, in any order
+class ScanlineSource
+{
+public:
+    virtual ~ScanlineSource() {}
+    virtual uint32_t GetWidth() const = 0;
+    virtual uint32_t GetHeight() const = 0;
+    // copies rowCount rows starting at startRow to output, rows are GetWidth() apart
+    virtual bool ReadRows(uint32_t startRow, uint32_t rowCount, symbol_t* output) = 0;
+};
+
+// rows from an image that's already in memory
+class MemoryScanlineSource : public ScanlineSource
+{
+public:
+    MemoryScanlineSource(const std::vector<symbol_t>& values, uint32_t width, uint32_t height);
+    uint32_t GetWidth() const override;
+    uint32_t GetHeight() const override;
+    bool ReadRows(uint32_t startRow, uint32_t rowCount, symbol_t* output) override;
+
+private:
+    const std::vector<symbol_t>& values;
+    uint32_t width;
+    uint32_t height;
+};
+
+// rows read straight from an uncompressed 16-bit greyscale TIFF, strip or tile layout
+// only the strip/tile row being read is kept in memory
+class TiffScanlineSource : public ScanlineSource
+{
+public:
+    TiffScanlineSource(const std::string& filename);
+    // false if the file couldn't be opened, or isn't a TIFF this can read (compressed, not 16-bit greyscale etc.)
+    bool IsValid() const;
+    uint32_t GetWidth() const override;
+    uint32_t GetHeight() const override;
+    bool ReadRows(uint32_t startRow, uint32_t rowCount, symbol_t* output) override;
+
+private:
+    // reads the header + first image directory, checks the layout is one that can be read
+    bool ReadDirectory();
+    // reads a tag's values, short + long types only
+    // values are in the 4-byte field if they fit, otherwise it holds their position
+    bool ReadTagValues(uint16_t type, uint32_t count, const uint8_t* valueField, std::vector<uint32_t>& values);
+    bool ReadBytes(uint64_t position, size_t count, void* output);
+    // converts from the file's byte order
+    uint16_t ToShort(const uint8_t* bytes) const;
+    uint32_t ToLong(const uint8_t* bytes) const;
+    // reads pixels + converts them from the file's byte order
+    bool ReadPixels(uint64_t position, size_t count, symbol_t* output);
+    // reads a row of tiles into chunkRowPixels
+    bool ReadTileRow(uint32_t tileRow);
+
+    std::ifstream file;
+    bool valid = false;
+    bool bigEndian = false;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // strips are treated as tiles the width of the image
+    bool tiled = false;
+    uint32_t chunkWidth = 0;
+    uint32_t chunkHeight = 0;
+    std::vector<uint32_t> chunkOffsets;
+    std::vector<uint32_t> chunkByteCounts;
+    // last row of tiles read, tiles usually cover several block rows
+    uint32_t cachedTileRow = -1;
+    std::vector<symbol_t> chunkRowPixels;
+};
@@ -37,6 +37,14 @@ size_t FastFileStream::GetPosition() const
     return position;
 }
 
+size_t FastFileStream::GetSize()
+{
+    fileStream.seekg(0, std::ios::end);
+    size_t size = fileStream.tellg();
+    fileStream.seekg(position);
+    return size;
+}
+
 void FastFileStream::Read(void* dest, size_t length)
 {
     fileStream.read(reinterpret_cast<uint8_t*>(dest), length);
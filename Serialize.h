@@ -4,6 +4,8 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <cstring>
 #include "Release_Assert.h"
 #include "Precision.h"
 
@@ -37,6 +39,8 @@ public:
     FastFileStream(std::string filename);
     void Seek(size_t newPosition);
     size_t GetPosition() const;
+    // total file size, doesn't move the stream
+    size_t GetSize();
     void Read(void* dest, size_t length);
     void Close();
     bool Failed();
@@ -54,6 +58,8 @@ public:
     virtual void operator--() = 0;
     virtual void operator+=(size_t count) = 0;
     virtual void operator-=(size_t count) = 0;
+    // copies the next count values into dest and moves past them
+    virtual void Read(T* dest, size_t count) = 0;
     // clone stream at position
     virtual std::shared_ptr<Stream<T>> clone() = 0;
     virtual Stream<block_t>* castToBlocks() = 0;
@@ -72,6 +78,12 @@ public:
         : input(input), position(position)
     {
 
+    }
+    // keeps the vector alive for as long as this stream or any of it's clones exist
+    VectorIOStream(std::shared_ptr<const std::vector<uint8_t>> ownedInput, size_t position)
+        : input(ownedInput.get()), ownedInput(ownedInput), position(position)
+    {
+
     }
     T operator*() override
     {
@@ -94,17 +106,33 @@ public:
     {
         position -= count * sizeof(T);
     }
+    void Read(T* dest, size_t count) override
+    {
+        assert_release(position + count * sizeof(T) <= input->size());
+        if (count > 0)
+            memcpy(dest, input->data() + position, count * sizeof(T));
+        position += count * sizeof(T);
+    }
     std::shared_ptr<Stream<T>> clone() override
     {
-        return std::shared_ptr<Stream<T>>(new VectorIOStream<T>(input, position));
+        return std::shared_ptr<Stream<T>>(new VectorIOStream<T>(input, ownedInput, position));
     }
     // clone stream at position
     Stream<block_t>* castToBlocks()
     {
-        return new VectorIOStream<block_t>(input, position);
+        return new VectorIOStream<block_t>(input, ownedInput, position);
     }
 private:
+    template<typename>
+    friend class VectorIOStream;
+    VectorIOStream(const std::vector<uint8_t>* input, std::shared_ptr<const std::vector<uint8_t>> ownedInput, size_t position)
+        : input(input), ownedInput(ownedInput), position(position)
+    {
+
+    }
     const std::vector<uint8_t>* input;
+    // null if the vector is owned by someone else
+    std::shared_ptr<const std::vector<uint8_t>> ownedInput;
     size_t position;
 };
 
@@ -146,6 +174,12 @@ public:
     {
         position -= count * sizeof(T);
     }
+    void Read(T* dest, size_t count) override
+    {
+        bytes->Seek(position);
+        bytes->Read(dest, count * sizeof(T));
+        position += count * sizeof(T);
+    }
     std::shared_ptr<Stream<T>> clone() override
     {
         return std::shared_ptr<Stream<T>>(new FileIOStream<T>(bytes, position));
@@ -174,6 +208,18 @@ IteratorPtr<T> StreamFromVector(const std::vector<uint8_t>* input)
     return IteratorPtr<T>(new VectorIOStream<T>(input));
 }
 
+template <typename T>
+IteratorPtr<T> StreamFromVector(const std::vector<uint8_t>* input, size_t position)
+{
+    return IteratorPtr<T>(new VectorIOStream<T>(input, position));
+}
+
+template <typename T>
+IteratorPtr<T> StreamFromBuffer(std::shared_ptr<const std::vector<uint8_t>> input, size_t position)
+{
+    return IteratorPtr<T>(new VectorIOStream<T>(input, position));
+}
+
 template <typename T>
 IteratorPtr<T> StreamFromFile(FastFileStream* bytes)
 {
@@ -191,15 +237,7 @@ T ReadValue(Iterator<BT> &input)
 {
     assert_release(sizeof(T) % sizeof(BT) == 0);
     T value;
-    BT* valueBlocks = reinterpret_cast<BT*>(&value);
-
-    // basically memcpy
-    for (size_t blockPos = 0; blockPos < (sizeof(value) / sizeof(BT)); ++blockPos)
-    {
-        *valueBlocks = *input;
-        ++valueBlocks;
-        ++input;
-    }
+    input.Read(reinterpret_cast<BT*>(&value), sizeof(value) / sizeof(BT));
 
     return value;
 }
@@ -246,7 +284,7 @@ std::vector<T> ReadVector(const std::vector<uint8_t>& inputBytes, uint64_t& read
     std::vector<T> outputVector;
     outputVector.resize(vectorHeader.count);
     uint64_t vectorSize = outputVector.size() * sizeof(T);
-    memcpy(&outputVector[0], &inputBytes[readPos], vectorSize);
+    memcpy(outputVector.data(), inputBytes.data() + readPos, vectorSize);
     readPos += vectorSize;
 
     return std::move(outputVector);
@@ -263,15 +301,7 @@ std::vector<T> ReadVector(ByteIterator &bytes)
     std::vector<T> outputVector;
     outputVector.resize(vectorHeader.count);
     uint64_t vectorSize = outputVector.size() * sizeof(T);
-
-    uint8_t* valuesBytes = reinterpret_cast<uint8_t*>(&outputVector[0]);
-    // basically memcpy
-    for (size_t bytePos = 0; bytePos < vectorSize; ++bytePos)
-    {
-        *valuesBytes = *bytes;
-        ++valuesBytes;
-        ++bytes;
-    }
+    bytes.Read(reinterpret_cast<uint8_t*>(outputVector.data()), vectorSize);
 
     return std::move(outputVector);
 }
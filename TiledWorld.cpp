@@ -0,0 +1,378 @@
+#include "TiledWorld.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "WorkerPool.h"
+
+std::shared_ptr<TiledWorld> TiledWorld::Open(const std::string& manifestFilename)
+{
+    std::ifstream manifest(manifestFilename);
+    if (!manifest)
+    {
+        std::cerr << "Couldn't open world manifest " << manifestFilename << std::endl;
+        return std::shared_ptr<TiledWorld>();
+    }
+    // tile filenames are relative to the manifest's folder
+    size_t folderEnd = manifestFilename.find_last_of("/\\");
+    std::string folder = folderEnd == std::string::npos ? "" : manifestFilename.substr(0, folderEnd + 1);
+
+    std::shared_ptr<TiledWorld> world = std::make_shared<TiledWorld>();
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(manifest, line))
+    {
+        ++lineNumber;
+        size_t lineStart = line.find_first_not_of(" \t\r");
+        if (lineStart == std::string::npos || line[lineStart] == '#')
+            continue;
+
+        Tile tile;
+        std::istringstream fields(line);
+        std::string filename;
+        bool validNumbers = (bool)(fields >> tile.x >> tile.y >> tile.width >> tile.height);
+        std::getline(fields >> std::ws, filename);
+        // filenames can have spaces, but not trailing ones
+        filename.erase(filename.find_last_not_of(" \t\r") + 1);
+        if (!validNumbers || filename.empty() || tile.width == 0 || tile.height == 0
+            || (uint64_t)tile.x + tile.width > std::numeric_limits<uint32_t>::max()
+            || (uint64_t)tile.y + tile.height > std::numeric_limits<uint32_t>::max())
+        {
+            std::cerr << "Invalid tile on line " << lineNumber << " of world manifest " << manifestFilename << std::endl;
+            return std::shared_ptr<TiledWorld>();
+        }
+        bool absolute = filename[0] == '/' || filename[0] == '\\' || (filename.size() > 1 && filename[1] == ':');
+        tile.filename = absolute ? filename : folder + filename;
+        world->tiles.push_back(tile);
+    }
+
+    if (!world->BuildIndex())
+    {
+        std::cerr << "Overlapping tiles in world manifest " << manifestFilename << std::endl;
+        return std::shared_ptr<TiledWorld>();
+    }
+    return world;
+}
+
+bool TiledWorld::BuildIndex()
+{
+    uint32_t smallestSide = std::numeric_limits<uint32_t>::max();
+    for (const Tile& tile : tiles)
+    {
+        width = std::max(width, tile.x + tile.width);
+        height = std::max(height, tile.y + tile.height);
+        smallestSide = std::min(smallestSide, std::min(tile.width, tile.height));
+    }
+    if (tiles.empty())
+        return true;
+
+    // cells about the size of the smallest tile, so each only lists a few tiles
+    // but not so many of them that sparse worlds waste memory on empty cells
+    cellShift = 0;
+    while (cellShift < 31 && (2u << cellShift) <= smallestSide)
+        ++cellShift;
+    uint64_t maxCells = std::max<uint64_t>(tiles.size() * 4, 1024);
+    while (cellShift < 31 && (((uint64_t)width >> cellShift) + 1) * (((uint64_t)height >> cellShift) + 1) > maxCells)
+        ++cellShift;
+    cellsWidth = (uint32_t)(((uint64_t)width + (1ull << cellShift) - 1) >> cellShift);
+    cellsHeight = (uint32_t)(((uint64_t)height + (1ull << cellShift) - 1) >> cellShift);
+    cellTiles.assign((size_t)cellsWidth * cellsHeight, std::vector<uint32_t>());
+
+    for (uint32_t index = 0; index < tiles.size(); ++index)
+    {
+        const Tile& tile = tiles[index];
+        for (uint32_t cellY = tile.y >> cellShift; cellY <= (tile.y + tile.height - 1) >> cellShift; ++cellY)
+        {
+            for (uint32_t cellX = tile.x >> cellShift; cellX <= (tile.x + tile.width - 1) >> cellShift; ++cellX)
+            {
+                std::vector<uint32_t>& cell = cellTiles[(size_t)cellY * cellsWidth + cellX];
+                // overlapping tiles always share a cell
+                for (uint32_t otherIndex : cell)
+                {
+                    const Tile& other = tiles[otherIndex];
+                    if (tile.x < other.x + other.width && other.x < tile.x + tile.width
+                        && tile.y < other.y + other.height && other.y < tile.y + tile.height)
+                        return false;
+                }
+                cell.push_back(index);
+            }
+        }
+    }
+    return true;
+}
+
+size_t TiledWorld::FindTile(uint32_t x, uint32_t y) const
+{
+    if (x >= width || y >= height)
+        return NO_TILE;
+    for (uint32_t index : cellTiles[(size_t)(y >> cellShift) * cellsWidth + (x >> cellShift)])
+    {
+        const Tile& tile = tiles[index];
+        if (x >= tile.x && x - tile.x < tile.width && y >= tile.y && y - tile.y < tile.height)
+            return index;
+    }
+    return NO_TILE;
+}
+
+void TiledWorld::FindTiles(uint32_t x, uint32_t y, uint32_t width, uint32_t height, std::vector<size_t>& indices) const
+{
+    indices.clear();
+    if (width == 0 || height == 0 || x >= this->width || y >= this->height)
+        return;
+    uint32_t endX = (uint32_t)std::min<uint64_t>((uint64_t)x + width, this->width);
+    uint32_t endY = (uint32_t)std::min<uint64_t>((uint64_t)y + height, this->height);
+    for (uint32_t cellY = y >> cellShift; cellY <= (endY - 1) >> cellShift; ++cellY)
+    {
+        for (uint32_t cellX = x >> cellShift; cellX <= (endX - 1) >> cellShift; ++cellX)
+        {
+            for (uint32_t index : cellTiles[(size_t)cellY * cellsWidth + cellX])
+            {
+                const Tile& tile = tiles[index];
+                if (x < tile.x + tile.width && tile.x < endX && y < tile.y + tile.height && tile.y < endY)
+                    indices.push_back(index);
+            }
+        }
+    }
+    // tiles covering more than one cell are listed in each
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+}
+
+void TiledWorld::GetOverlap(const Tile& tile, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t& startX, uint32_t& startY, uint32_t& endX, uint32_t& endY)
+{
+    startX = std::max(x, tile.x);
+    startY = std::max(y, tile.y);
+    endX = (uint32_t)std::min<uint64_t>((uint64_t)x + width, (uint64_t)tile.x + tile.width);
+    endY = (uint32_t)std::min<uint64_t>((uint64_t)y + height, (uint64_t)tile.y + tile.height);
+}
+
+CompressedImage* TiledWorld::UseTile(size_t index)
+{
+    Tile& tile = tiles[index];
+    tile.lastUse = currentUse;
+    if (tile.image || tile.failed)
+        return tile.image.get();
+
+    tile.image = CompressedImage::OpenStream(tile.filename);
+    if (tile.image && (tile.image->GetWidth() != tile.width || tile.image->GetHeight() != tile.height))
+    {
+        std::cerr << "Tile " << tile.filename << " is " << tile.image->GetWidth() << "x" << tile.image->GetHeight()
+            << ", the world manifest says " << tile.width << "x" << tile.height << std::endl;
+        tile.image.reset();
+    }
+    if (!tile.image)
+    {
+        std::cerr << "Couldn't open world tile " << tile.filename << ", it will read as 0" << std::endl;
+        tile.failed = true;
+        return nullptr;
+    }
+    openTiles.push_back(index);
+    tile.memoryUsage = 0;
+    UpdateTileMemory(index);
+    return tile.image.get();
+}
+
+void TiledWorld::UpdateTileMemory(size_t index)
+{
+    Tile& tile = tiles[index];
+    size_t memoryUsage = tile.image->GetMemoryUsage();
+    openTilesMemory = openTilesMemory + memoryUsage - tile.memoryUsage;
+    tile.memoryUsage = memoryUsage;
+    if (openTilesMemory > cacheBudget)
+        EnforceCacheBudget();
+}
+
+void TiledWorld::EnforceCacheBudget()
+{
+    // least recently used first
+    std::sort(openTiles.begin(), openTiles.end(), [&](size_t a, size_t b) { return tiles[a].lastUse < tiles[b].lastUse; });
+    size_t closeCount = 0;
+    while (closeCount < openTiles.size() && openTilesMemory > cacheBudget && tiles[openTiles[closeCount]].lastUse != currentUse)
+    {
+        Tile& tile = tiles[openTiles[closeCount]];
+        openTilesMemory -= tile.memoryUsage;
+        tile.memoryUsage = 0;
+        tile.image.reset();
+        ++closeCount;
+    }
+    openTiles.erase(openTiles.begin(), openTiles.begin() + closeCount);
+}
+
+symbol_t TiledWorld::GetPixel(uint32_t x, uint32_t y)
+{
+    ++currentUse;
+    size_t index = FindTile(x, y);
+    if (index == NO_TILE)
+        return 0;
+    CompressedImage* image = UseTile(index);
+    if (!image)
+        return 0;
+    symbol_t value = image->GetPixel(x - tiles[index].x, y - tiles[index].y);
+    UpdateTileMemory(index);
+    return value;
+}
+
+void TiledWorld::GetPixels(const uint32_t* xs, const uint32_t* ys, size_t count, symbol_t* output, bool multithreaded)
+{
+    ++currentUse;
+    // (tile, query) pairs, sorting groups them by tile
+    std::vector<std::pair<size_t, size_t>> tileQueries;
+    tileQueries.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t index = FindTile(xs[i], ys[i]);
+        if (index == NO_TILE)
+            output[i] = 0;
+        else
+            tileQueries.emplace_back(index, i);
+    }
+    std::sort(tileQueries.begin(), tileQueries.end());
+    // so opening one of them can't close another
+    for (const auto& tileQuery : tileQueries)
+        tiles[tileQuery.first].lastUse = currentUse;
+
+    std::vector<uint32_t> tileXs;
+    std::vector<uint32_t> tileYs;
+    std::vector<symbol_t> tileOutput;
+    size_t groupStart = 0;
+    while (groupStart < tileQueries.size())
+    {
+        size_t index = tileQueries[groupStart].first;
+        size_t groupEnd = groupStart;
+        tileXs.clear();
+        tileYs.clear();
+        for (; groupEnd < tileQueries.size() && tileQueries[groupEnd].first == index; ++groupEnd)
+        {
+            size_t queryIdx = tileQueries[groupEnd].second;
+            tileXs.push_back(xs[queryIdx] - tiles[index].x);
+            tileYs.push_back(ys[queryIdx] - tiles[index].y);
+        }
+
+        tileOutput.assign(tileXs.size(), 0);
+        CompressedImage* image = UseTile(index);
+        if (image)
+        {
+            image->GetPixels(tileXs.data(), tileYs.data(), tileXs.size(), tileOutput.data(), multithreaded);
+            UpdateTileMemory(index);
+        }
+        for (size_t i = groupStart; i < groupEnd; ++i)
+            output[tileQueries[i].second] = tileOutput[i - groupStart];
+        groupStart = groupEnd;
+    }
+}
+
+void TiledWorld::GetRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, symbol_t* output)
+{
+    ++currentUse;
+    // gaps between tiles
+    std::fill_n(output, (size_t)width * height, (symbol_t)0);
+
+    std::vector<size_t> indices;
+    FindTiles(x, y, width, height, indices);
+    for (size_t index : indices)
+        tiles[index].lastUse = currentUse;
+
+    std::vector<symbol_t> tilePixels;
+    for (size_t index : indices)
+    {
+        CompressedImage* image = UseTile(index);
+        if (!image)
+            continue;
+        const Tile& tile = tiles[index];
+        uint32_t startX, startY, endX, endY;
+        GetOverlap(tile, x, y, width, height, startX, startY, endX, endY);
+        uint32_t copyWidth = endX - startX;
+        uint32_t copyHeight = endY - startY;
+        symbol_t* copyStart = &output[(size_t)(startY - y) * width + (startX - x)];
+        if (copyWidth == width)
+        {
+            // rows are already the right distance apart
+            image->GetRegion(startX - tile.x, startY - tile.y, copyWidth, copyHeight, copyStart);
+        }
+        else
+        {
+            tilePixels.resize((size_t)copyWidth * copyHeight);
+            image->GetRegion(startX - tile.x, startY - tile.y, copyWidth, copyHeight, tilePixels.data());
+            for (uint32_t row = 0; row < copyHeight; ++row)
+                memcpy(&copyStart[(size_t)row * width], &tilePixels[(size_t)row * copyWidth], copyWidth * sizeof(symbol_t));
+        }
+        UpdateTileMemory(index);
+    }
+}
+
+void TiledWorld::PrefetchRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    ++currentUse;
+    std::vector<size_t> indices;
+    FindTiles(x, y, width, height, indices);
+    for (size_t index : indices)
+        tiles[index].lastUse = currentUse;
+
+    // opening can close other tiles, so it's done up front on this thread
+    std::vector<size_t> openIndices;
+    for (size_t index : indices)
+    {
+        if (UseTile(index))
+            openIndices.push_back(index);
+    }
+
+    // every tile has it's own file + async reader, so they can all have reads in flight at once
+    WorkerPool::GetShared().ParallelFor(openIndices.size(), [&](size_t start, size_t end)
+    {
+        for (size_t i = start; i < end; ++i)
+        {
+            const Tile& tile = tiles[openIndices[i]];
+            uint32_t startX, startY, endX, endY;
+            GetOverlap(tile, x, y, width, height, startX, startY, endX, endY);
+            tile.image->PrefetchRegion(startX - tile.x, startY - tile.y, endX - startX, endY - startY);
+        }
+    });
+
+    for (size_t index : openIndices)
+        UpdateTileMemory(index);
+}
+
+void TiledWorld::SetCacheBudget(size_t bytes)
+{
+    cacheBudget = bytes;
+    // nothing is in use between queries
+    ++currentUse;
+    if (openTilesMemory > cacheBudget)
+        EnforceCacheBudget();
+}
+
+size_t TiledWorld::GetCacheBudget() const
+{
+    return cacheBudget;
+}
+
+size_t TiledWorld::GetMemoryUsage() const
+{
+    size_t indexSize = tiles.capacity() * sizeof(Tile) + cellTiles.capacity() * sizeof(cellTiles[0]);
+    for (const std::vector<uint32_t>& cell : cellTiles)
+        indexSize += cell.capacity() * sizeof(uint32_t);
+    return openTilesMemory + indexSize;
+}
+
+uint32_t TiledWorld::GetWidth() const
+{
+    return width;
+}
+
+uint32_t TiledWorld::GetHeight() const
+{
+    return height;
+}
+
+size_t TiledWorld::GetTileCount() const
+{
+    return tiles.size();
+}
+
+size_t TiledWorld::GetOpenTileCount() const
+{
+    return openTiles.size();
+}
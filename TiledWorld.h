@@ -0,0 +1,93 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "CompressedImage.h"
+
+// Many .cif tiles placed in one world, read through one set of pixel queries in world coordinates
+// the manifest is a text file with one tile per line: "x y width height filename", x/y being the tile's top left in world pixels
+// filenames are relative to the manifest, blank lines and lines starting with # are skipped
+// tiles are opened with OpenStream() the first time a query touches them, and the least recently used ones are
+// closed again once the open tiles use more than the cache budget between them. Positions no tile covers read as 0
+// like CompressedImage, a world can only be used from one thread at a time
+class TiledWorld
+{
+public:
+    // reads the manifest, returns nullptr if it can't be read or tiles overlap
+    // no tile files are opened yet
+    static std::shared_ptr<TiledWorld> Open(const std::string& manifestFilename);
+
+    symbol_t GetPixel(uint32_t x, uint32_t y);
+    // batched GetPixel, queries are grouped by tile and passed on to each tile's GetPixels()
+    void GetPixels(const uint32_t* xs, const uint32_t* ys, size_t count, symbol_t* output, bool multithreaded = false);
+    // copies a width * height region, it can cross tile edges and gaps between tiles
+    void GetRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, symbol_t* output);
+    // opens every tile under the region, then prefetches them in parallel on the shared worker pool
+    void PrefetchRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+    // memory all open tiles can use between them, tiles the current query touches are never closed so big queries can go over it
+    void SetCacheBudget(size_t bytes);
+    size_t GetCacheBudget() const;
+    size_t GetMemoryUsage() const;
+
+    // right/bottom edge of the furthest tile
+    uint32_t GetWidth() const;
+    uint32_t GetHeight() const;
+    size_t GetTileCount() const;
+    size_t GetOpenTileCount() const;
+
+    static const size_t DEFAULT_CACHE_BUDGET = 256 * 1024 * 1024;
+
+private:
+    struct Tile
+    {
+        std::string filename;
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+        // null until first touched, and again after being closed
+        std::shared_ptr<CompressedImage> image;
+        // GetMemoryUsage() of the image when it was last checked
+        size_t memoryUsage = 0;
+        // query the tile was last touched by, for picking tiles to close
+        uint64_t lastUse = 0;
+        // set if the file couldn't be opened or didn't match the manifest, so it isn't retried on every query
+        bool failed = false;
+    };
+
+    // builds the spatial index, returns false if tiles overlap
+    bool BuildIndex();
+    // tile covering a world position, NO_TILE if there isn't one
+    size_t FindTile(uint32_t x, uint32_t y) const;
+    // tiles overlapping a region, in manifest order
+    void FindTiles(uint32_t x, uint32_t y, uint32_t width, uint32_t height, std::vector<size_t>& indices) const;
+    // part of a region inside a tile, in world pixels
+    static void GetOverlap(const Tile& tile, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t& startX, uint32_t& startY, uint32_t& endX, uint32_t& endY);
+    // opens the tile if it isn't already + marks it used by the current query, returns null if it can't be opened
+    CompressedImage* UseTile(size_t index);
+    // picks up changes in a tile's memory use, closing other tiles if that takes the world over budget
+    void UpdateTileMemory(size_t index);
+    // closes least recently used tiles, that the current query hasn't touched, until the open ones fit the budget
+    void EnforceCacheBudget();
+
+    static const size_t NO_TILE = (size_t)-1;
+
+    std::vector<Tile> tiles;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    // spatial index, a grid of cells 1 << cellShift pixels across, each listing the tiles overlapping it
+    uint32_t cellShift = 0;
+    uint32_t cellsWidth = 0;
+    uint32_t cellsHeight = 0;
+    std::vector<std::vector<uint32_t>> cellTiles;
+
+    std::vector<size_t> openTiles;
+    // sum of memoryUsage over openTiles
+    size_t openTilesMemory = 0;
+    size_t cacheBudget = DEFAULT_CACHE_BUDGET;
+    // bumped by every public query
+    uint64_t currentUse = 0;
+};
@@ -5,7 +5,7 @@
 WaveletDecodeLayer::WaveletDecodeLayer(const std::vector<symbol_t>& wavelets, const std::vector<symbol_t>& parentVals, uint32_t width, uint32_t height)
     : size(width, height) 
 {
-    pixelVals.resize(size.GetWidth() * size.GetHeight());
+    pixelVals.resize(size.GetPixelCount());
 
     auto currWavelet = wavelets.begin();
 
@@ -35,10 +35,10 @@ WaveletDecodeLayer::WaveletDecodeLayer(const std::vector<symbol_t>& wavelets, co
             int32_t parentY = y / 2;
 
             // Top left is guaranteed
-            symbol_t TL = parentVals[parentY * size.GetParentWidth() + parentX];
+            symbol_t TL = parentVals[(size_t)parentY * size.GetParentWidth() + parentX];
 
             // Parent transform is TL, so no wavelet needed
-            pixelVals[y * size.GetWidth() + x] = TL;
+            pixelVals[(size_t)y * size.GetWidth() + x] = TL;
 
             // for prediction values shared between outputs
             // number of values used in prediction
@@ -55,19 +55,19 @@ WaveletDecodeLayer::WaveletDecodeLayer(const std::vector<symbol_t>& wavelets, co
                 // Add TR parent if possible
                 if (parentX + 1 < size.GetParentWidth())
                 {
-                    predicted += parentVals[parentY * size.GetParentWidth() + parentX + 1];
+                    predicted += parentVals[(size_t)parentY * size.GetParentWidth() + parentX + 1];
                     ++predictionCount;
                 }
 
                 // Add BL parent if possible
                 if (parentY + 1 < size.GetParentHeight())
                 {
-                    predicted += parentVals[(parentY + 1) * size.GetParentWidth() + parentX];
+                    predicted += parentVals[(size_t)(parentY + 1) * size.GetParentWidth() + parentX];
                     ++predictionCount;
                     // Add BR parent if possible
                     if (parentX + 1 < size.GetParentWidth())
                     {
-                        predicted += parentVals[(parentY + 1) * size.GetParentWidth() + parentX + 1];
+                        predicted += parentVals[(size_t)(parentY + 1) * size.GetParentWidth() + parentX + 1];
                         ++predictionCount;
                     }
                 }
@@ -83,7 +83,7 @@ WaveletDecodeLayer::WaveletDecodeLayer(const std::vector<symbol_t>& wavelets, co
 
                 // add wavelet to get final value
                 symbol_t outputVal = predicted + *currWavelet;
-                pixelVals[(y + 1) * size.GetWidth() + x + 1] = outputVal;
+                pixelVals[(size_t)(y + 1) * size.GetWidth() + x + 1] = outputVal;
                 ++currWavelet;
 
                 // Diag is used as input to other output predictions
@@ -102,14 +102,14 @@ WaveletDecodeLayer::WaveletDecodeLayer(const std::vector<symbol_t>& wavelets, co
                 // Add right parent if possible
                 if (parentX + 1 < size.GetParentWidth())
                 {
-                    predicted += parentVals[parentY * size.GetParentWidth() + parentX + 1];
+                    predicted += parentVals[(size_t)parentY * size.GetParentWidth() + parentX + 1];
                     ++predictionCount;
                 }
 
                 // Add top (diag of above block) if possible
                 if (y - 1 > 0)
                 {
-                    predicted += pixelVals[(y - 1) * size.GetHeight() + x + 1];
+                    predicted += pixelVals[(size_t)(y - 1) * size.GetWidth() + x + 1];
                     ++predictionCount;
                 }
 
@@ -119,7 +119,7 @@ WaveletDecodeLayer::WaveletDecodeLayer(const std::vector<symbol_t>& wavelets, co
                 // average
                 predicted = predicted / predictionCount;
 
-                pixelVals[y * size.GetWidth() + x + 1] = predicted + *currWavelet;
+                pixelVals[(size_t)y * size.GetWidth() + x + 1] = predicted + *currWavelet;
                 ++currWavelet;
             }
 
@@ -134,14 +134,14 @@ WaveletDecodeLayer::WaveletDecodeLayer(const std::vector<symbol_t>& wavelets, co
                 // Add bottom parent if possible
                 if (parentY + 1 < size.GetParentHeight())
                 {
-                    predicted += parentVals[(parentY + 1) * size.GetParentWidth() + parentX];
+                    predicted += parentVals[(size_t)(parentY + 1) * size.GetParentWidth() + parentX];
                     ++predictionCount;
                 }
 
                 // Add left (diag of previous block) if possible
                 if (x - 1 > 0)
                 {
-                    predicted += pixelVals[(y + 1) * size.GetWidth() + (x - 1)];
+                    predicted += pixelVals[(size_t)(y + 1) * size.GetWidth() + (x - 1)];
                     ++predictionCount;
                 }
 
@@ -151,7 +151,7 @@ WaveletDecodeLayer::WaveletDecodeLayer(const std::vector<symbol_t>& wavelets, co
                 // average
                 predicted = predicted / predictionCount;
 
-                pixelVals[(y + 1) * size.GetWidth() + x] = predicted + *currWavelet;
+                pixelVals[(size_t)(y + 1) * size.GetWidth() + x] = predicted + *currWavelet;
                 ++currWavelet;
             }
         }
@@ -164,6 +164,11 @@ std::vector<symbol_t> WaveletDecodeLayer::GetPixels() const
     return pixelVals;
 }
 
+const symbol_t* WaveletDecodeLayer::GetPixelData() const
+{
+    return pixelVals.data();
+}
+
 // does inverse parent transform to get parent values
 std::vector<symbol_t> WaveletDecodeLayer::GetParentLevelPixels(uint32_t level) const
 {
@@ -180,7 +185,7 @@ std::vector<symbol_t> WaveletDecodeLayer::GetParentLevelPixels(uint32_t level) c
         {
             uint32_t parentX = x << level;
             uint32_t parentY = y << level;
-            parentVals[y * targetSize.GetWidth() + x] = pixelVals[parentY * GetWidth() + parentX];
+            parentVals[(size_t)y * targetSize.GetWidth() + x] = pixelVals[(size_t)parentY * GetWidth() + parentX];
         }
     }
 
@@ -199,7 +204,7 @@ uint32_t WaveletDecodeLayer::GetHeight() const
 
 symbol_t WaveletDecodeLayer::GetPixelAt(uint32_t x, uint32_t y) const
 {
-    return pixelVals[y * GetWidth() + x];
+    return pixelVals[(size_t)y * GetWidth() + x];
 }
 
 bool WaveletDecodeLayer::IsRoot() const
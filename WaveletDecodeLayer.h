@@ -12,6 +12,8 @@ public:
     symbol_t GetPixelAt(uint32_t x, uint32_t y) const;
     // TODO is this actually const?
     std::vector<symbol_t> GetPixels() const;
+    // row-major, avoids copying the layer for bulk reads
+    const symbol_t* GetPixelData() const;
     std::vector<symbol_t> GetParentLevelPixels(uint32_t level) const;
     uint32_t GetWidth() const;
     uint32_t GetHeight() const;
@@ -6,10 +6,10 @@
 WaveletEncodeLayer::WaveletEncodeLayer(std::vector<uint16_t> values, uint32_t width, uint32_t height)
     : size(width, height)
 {
-    assert_release(values.size() == width * height);
+    assert_release(values.size() == (size_t)width * height);
     //  Initialize + prealloc memory
     wavelets.resize(size.GetWaveletCount());
-    uint32_t parentReserveCount = size.GetParentSize().GetPixelCount();
+    size_t parentReserveCount = size.GetParentSize().GetPixelCount();
     parentVals.resize(parentReserveCount);
 
     auto currWavelet = wavelets.begin();
@@ -39,10 +39,10 @@ WaveletEncodeLayer::WaveletEncodeLayer(std::vector<uint16_t> values, uint32_t wi
             int32_t parentY = y / 2;
 
             // Top left is guaranteed
-            uint16_t TL = values[y * width + x];
+            uint16_t TL = values[(size_t)y * width + x];
 
             // Parent transform is TL, so no wavelet needed
-            parentVals[parentY * size.GetParentWidth() + parentX] = TL;
+            parentVals[(size_t)parentY * size.GetParentWidth() + parentX] = TL;
 
             // Diagonal gets decoded first
             // X-shaped averaging
@@ -55,21 +55,21 @@ WaveletEncodeLayer::WaveletEncodeLayer(std::vector<uint16_t> values, uint32_t wi
                 // TR
                 if (x + 2 < width)
                 {
-                    prediction += values[y * width + x + 2];
+                    prediction += values[(size_t)y * width + x + 2];
                     ++predictionCount;
                 }
 
                 // BL
                 if (y + 2 < height)
                 {
-                    prediction += values[(y + 2) * width + x];
+                    prediction += values[(size_t)(y + 2) * width + x];
                     ++predictionCount;
                 }
 
                 // BR
                 if (x + 2 < width && y + 2 < height)
                 {
-                    prediction += values[(y + 2) * width + x + 2];
+                    prediction += values[(size_t)(y + 2) * width + x + 2];
                     ++predictionCount;
                 }
 
@@ -82,7 +82,7 @@ WaveletEncodeLayer::WaveletEncodeLayer(std::vector<uint16_t> values, uint32_t wi
                 // average
                 prediction = prediction / predictionCount;
 
-                *currWavelet = values[(y + 1) * width + x + 1] - prediction;
+                *currWavelet = values[(size_t)(y + 1) * width + x + 1] - prediction;
                 ++currWavelet;
             }
 
@@ -97,21 +97,21 @@ WaveletEncodeLayer::WaveletEncodeLayer(std::vector<uint16_t> values, uint32_t wi
                 // Right
                 if (x + 2 < width)
                 {
-                    prediction += values[y * width + x + 2];
+                    prediction += values[(size_t)y * width + x + 2];
                     ++predictionCount;
                 }
 
                 // Top
                 if (y - 1 > 0)
                 {
-                    prediction += values[(y - 1) * width + x + 1];
+                    prediction += values[(size_t)(y - 1) * width + x + 1];
                     ++predictionCount;
                 }
 
                 // Bottom
                 if (y + 1 < height)
                 {
-                    prediction += values[(y + 1) * width + x + 1];
+                    prediction += values[(size_t)(y + 1) * width + x + 1];
                     ++predictionCount;
                 }
 
@@ -121,7 +121,7 @@ WaveletEncodeLayer::WaveletEncodeLayer(std::vector<uint16_t> values, uint32_t wi
                 // average
                 prediction = prediction / predictionCount;
 
-                *currWavelet = values[y * width + x + 1] - prediction;
+                *currWavelet = values[(size_t)y * width + x + 1] - prediction;
                 ++currWavelet;
             }
 
@@ -136,21 +136,21 @@ WaveletEncodeLayer::WaveletEncodeLayer(std::vector<uint16_t> values, uint32_t wi
                 // Bottom
                 if (y + 2 < height)
                 {
-                    prediction += values[(y + 2) * width + x];
+                    prediction += values[(size_t)(y + 2) * width + x];
                     ++predictionCount;
                 }
 
                 // Left
                 if (x - 1 > 0)
                 {
-                    prediction += values[(y + 1) * width + (x - 1)];
+                    prediction += values[(size_t)(y + 1) * width + (x - 1)];
                     ++predictionCount;
                 }
 
                 // right
                 if (x + 1 < width)
                 {
-                    prediction += values[(y + 1) * width + x + 1];
+                    prediction += values[(size_t)(y + 1) * width + x + 1];
                     ++predictionCount;
                 }
 
@@ -160,7 +160,7 @@ WaveletEncodeLayer::WaveletEncodeLayer(std::vector<uint16_t> values, uint32_t wi
                 // average
                 prediction = prediction / predictionCount;
 
-                *currWavelet = values[(y + 1) * width + x] - prediction;
+                *currWavelet = values[(size_t)(y + 1) * width + x] - prediction;
                 ++currWavelet;
             }
         }
@@ -186,7 +186,7 @@ uint32_t WaveletEncodeLayer::GetHeight() const
     return size.GetHeight();
 }
 
-uint32_t WaveletEncodeLayer::GetWaveletCount() const
+uint64_t WaveletEncodeLayer::GetWaveletCount() const
 {
     return size.GetWaveletCount();
 }
@@ -16,7 +16,7 @@ public:
     const std::vector<symbol_t> GetParentVals() const;
     uint32_t GetWidth() const;
     uint32_t GetHeight() const;
-    uint32_t GetWaveletCount() const;
+    uint64_t GetWaveletCount() const;
     std::shared_ptr<WaveletEncodeLayer> GetParentLayer() const;
 
 private:
@@ -18,12 +18,12 @@ uint32_t  WaveletLayerSize::GetWidth() const
 }
 
 
-uint32_t WaveletLayerSize::GetPixelCount() const
+uint64_t WaveletLayerSize::GetPixelCount() const
 {
-    return width * height;
+    return (uint64_t)width * height;
 }
 
-uint32_t WaveletLayerSize::GetWaveletCount() const
+uint64_t WaveletLayerSize::GetWaveletCount() const
 {
     return GetPixelCount() - (GetParentSize().GetPixelCount());
 }
@@ -13,8 +13,9 @@ public:
     WaveletLayerSize GetParentSize() const;
     uint32_t GetWidth() const;
     uint32_t GetHeight() const;
-    uint32_t GetPixelCount() const;
-    uint32_t GetWaveletCount() const;
+    // 64-bit, parent val images of big maps can have more than 4G pixels
+    uint64_t GetPixelCount() const;
+    uint64_t GetWaveletCount() const;
     bool IsRoot() const;
     WaveletLayerSize GetRoot() const;
 
@@ -0,0 +1,241 @@
+#include "WaveletZeroTree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Release_Assert.h"
+
+static const uint32_t FLAG_RANGE = 1 << PROBABILITY_RES;
+
+WaveletZeroTree::WaveletZeroTree(WaveletLayerSize size)
+    : size(size), cellsWidth(size.GetParentWidth()), cellsHeight(size.GetParentHeight()), rootSize(1)
+{
+    while (rootSize < cellsWidth || rootSize < cellsHeight)
+        rootSize *= 2;
+}
+
+uint32_t WaveletZeroTree::GetCellWaveletCount(uint32_t cellX, uint32_t cellY) const
+{
+    // diagonal, right, bottom
+    bool hasRight = cellX * 2 + 1 < size.GetWidth();
+    bool hasBottom = cellY * 2 + 1 < size.GetHeight();
+    return (hasRight && hasBottom) + hasRight + hasBottom;
+}
+
+prob_t WaveletZeroTree::GetZeroProbability(uint32_t depth) const
+{
+    // starts at 1/2, never 0 or 1 so both flags can always be coded
+    uint32_t probability = (uint32_t)(((uint64_t)zeroCounts[depth] + 1) * FLAG_RANGE / (nodeCounts[depth] + 2));
+    return (prob_t)std::min(std::max(probability, 1u), FLAG_RANGE - 1);
+}
+
+template<typename ReadFlag>
+bool WaveletZeroTree::VisitNode(uint32_t nodeX, uint32_t nodeY, uint32_t nodeSize, uint32_t depth, bool impliedNonZero, ReadFlag& readFlag)
+{
+    assert_release(depth < MAX_DEPTH);
+    uint32_t endX = std::min(nodeX + nodeSize, cellsWidth);
+    uint32_t endY = std::min(nodeY + nodeSize, cellsHeight);
+
+    // if the other children of a non-zero node are zero, this one can't be, so it's flag isn't coded
+    if (!impliedNonZero)
+    {
+        bool zero = readFlag(nodeX, nodeY, endX, endY, GetZeroProbability(depth));
+        ++nodeCounts[depth];
+        if (zero)
+        {
+            ++zeroCounts[depth];
+            for (uint32_t cellY = nodeY; cellY < endY; ++cellY)
+                std::fill_n(&zeroCells[(size_t)cellY * cellsWidth + nodeX], endX - nodeX, 1);
+            return true;
+        }
+    }
+    if (nodeSize == 1)
+        return false;
+
+    // children inside the layer
+    uint32_t childSize = nodeSize / 2;
+    uint32_t children[4][2];
+    uint32_t childCount = 0;
+    for (uint32_t childY = nodeY; childY < std::min(nodeY + nodeSize, cellsHeight); childY += childSize)
+    {
+        for (uint32_t childX = nodeX; childX < std::min(nodeX + nodeSize, cellsWidth); childX += childSize)
+        {
+            children[childCount][0] = childX;
+            children[childCount][1] = childY;
+            ++childCount;
+        }
+    }
+
+    bool allZero = true;
+    for (uint32_t child = 0; child < childCount; ++child)
+    {
+        bool last = child + 1 == childCount;
+        allZero = VisitNode(children[child][0], children[child][1], childSize, depth + 1, last && allZero, readFlag) && allZero;
+    }
+    return false;
+}
+
+std::vector<WaveletZeroTree::Code> WaveletZeroTree::BuildFlags(const symbol_t* wavelets, std::vector<size_t>& cellStarts, double& flagBits, size_t& skippedWavelets)
+{
+    // zero cells + where each cell's wavelets start
+    std::vector<uint8_t> cellIsZero;
+    cellIsZero.resize((size_t)cellsWidth * cellsHeight);
+    cellStarts.resize((size_t)cellsWidth * cellsHeight + 1);
+    size_t waveletPos = 0;
+    for (uint32_t cellY = 0; cellY < cellsHeight; ++cellY)
+    {
+        for (uint32_t cellX = 0; cellX < cellsWidth; ++cellX)
+        {
+            size_t cellIdx = (size_t)cellY * cellsWidth + cellX;
+            uint32_t cellCount = GetCellWaveletCount(cellX, cellY);
+            cellStarts[cellIdx] = waveletPos;
+            cellIsZero[cellIdx] = std::all_of(wavelets + waveletPos, wavelets + waveletPos + cellCount, [](symbol_t wavelet) { return wavelet == 0; });
+            waveletPos += cellCount;
+        }
+    }
+    assert_release(waveletPos == size.GetWaveletCount());
+    cellStarts.back() = waveletPos;
+
+    zeroCells.assign((size_t)cellsWidth * cellsHeight, 0);
+    std::vector<Code> flags;
+    flagBits = 0.0;
+    auto flagFromCells = [&](uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY, prob_t probability)
+    {
+        bool zero = true;
+        for (uint32_t cellY = startY; cellY < endY && zero; ++cellY)
+            zero = std::all_of(&cellIsZero[(size_t)cellY * cellsWidth + startX], &cellIsZero[(size_t)cellY * cellsWidth + endX], [](uint8_t cellZero) { return cellZero != 0; });
+        flags.push_back({ true, zero, probability, 0 });
+        flagBits -= std::log2(double(zero ? probability : FLAG_RANGE - probability) / FLAG_RANGE);
+        return zero;
+    };
+    VisitNode(0, 0, rootSize, 0, false, flagFromCells);
+
+    skippedWavelets = 0;
+    for (size_t cellIdx = 0; cellIdx < zeroCells.size(); ++cellIdx)
+    {
+        if (zeroCells[cellIdx])
+            skippedWavelets += cellStarts[cellIdx + 1] - cellStarts[cellIdx];
+    }
+    return flags;
+}
+
+double WaveletZeroTree::GetBreakEvenBits(const symbol_t* wavelets, size_t& skippedWavelets)
+{
+    std::vector<size_t> cellStarts;
+    double flagBits;
+    std::vector<Code> flags = BuildFlags(wavelets, cellStarts, flagBits, skippedWavelets);
+    // more flags than skipped wavelets would make decoding slower, so the tree's never used
+    if (skippedWavelets <= flags.size())
+    {
+        skippedWavelets = 0;
+        return std::numeric_limits<double>::infinity();
+    }
+    return flagBits / skippedWavelets;
+}
+
+std::vector<WaveletZeroTree::Code> WaveletZeroTree::Encode(const symbol_t* wavelets, double zeroBits)
+{
+    std::vector<size_t> cellStarts;
+    double flagBits;
+    size_t skippedWavelets;
+    std::vector<Code> flags = BuildFlags(wavelets, cellStarts, flagBits, skippedWavelets);
+    // zero wavelets are cheap when they're common, so the flags have to cost less than the wavelets they skip
+    // and there have to be fewer of them than skipped wavelets, or decoding gets slower
+    bool useTree = skippedWavelets > flags.size() && flagBits < skippedWavelets * zeroBits;
+
+    std::vector<Code> codes;
+    codes.push_back({ true, useTree, FLAG_RANGE / 2, 0 });
+    if (useTree)
+        codes.insert(codes.end(), flags.begin(), flags.end());
+    for (size_t cellIdx = 0; cellIdx < zeroCells.size(); ++cellIdx)
+    {
+        if (useTree && zeroCells[cellIdx])
+            continue;
+        for (size_t pos = cellStarts[cellIdx]; pos < cellStarts[cellIdx + 1]; ++pos)
+            codes.push_back({ false, false, 0, wavelets[pos] });
+    }
+    return codes;
+}
+
+bool WaveletZeroTree::Decode(RansState& ransState, std::vector<symbol_t>& wavelets)
+{
+    wavelets.assign(size.GetWaveletCount(), 0);
+    if (!ransState.HasData())
+        return false;
+
+    // plain wavelets, same as layers without flags
+    if (!ransState.ReadFlag(FLAG_RANGE / 2))
+    {
+        for (symbol_t& wavelet : wavelets)
+        {
+            if (!ransState.HasData())
+                return false;
+            wavelet = ransState.ReadSymbol();
+        }
+        return true;
+    }
+
+    zeroCells.assign((size_t)cellsWidth * cellsHeight, 0);
+    auto flagFromStream = [&](uint32_t, uint32_t, uint32_t, uint32_t, prob_t probability)
+    {
+        return ransState.ReadFlag(probability);
+    };
+    VisitNode(0, 0, rootSize, 0, false, flagFromStream);
+
+    // zero cells are already 0
+    symbol_t* currWavelet = wavelets.data();
+    const uint8_t* cellZero = zeroCells.data();
+    for (uint32_t cellY = 0; cellY < cellsHeight; ++cellY)
+    {
+        // only the last column can be missing it's right wavelet
+        uint32_t rowCellCount = GetCellWaveletCount(0, cellY);
+        uint32_t lastCellCount = GetCellWaveletCount(cellsWidth - 1, cellY);
+        for (uint32_t cellX = 0; cellX < cellsWidth; ++cellX, ++cellZero)
+        {
+            uint32_t cellCount = cellX + 1 < cellsWidth ? rowCellCount : lastCellCount;
+            if (*cellZero)
+            {
+                currWavelet += cellCount;
+                continue;
+            }
+            for (uint32_t wavelet = 0; wavelet < cellCount; ++wavelet)
+            {
+                if (!ransState.HasData())
+                    return false;
+                *currWavelet++ = ransState.ReadSymbol();
+            }
+        }
+    }
+    return true;
+}
+
+void WaveletZeroTreeStats::Add(double breakEvenBits, size_t skippedWavelets)
+{
+    if (skippedWavelets == 0 || breakEvenBits >= MAX_BITS)
+        return;
+    // rounded up, so zeros are only taken out if the tree definitely pays off
+    size_t bucket = (size_t)std::ceil(breakEvenBits * BUCKETS_PER_BIT);
+    skippedByBreakEven[std::min<size_t>(bucket, MAX_BITS * BUCKETS_PER_BIT - 1)] += skippedWavelets;
+}
+
+size_t WaveletZeroTreeStats::GetSkippedWavelets(double zeroBits) const
+{
+    size_t skippedWavelets = 0;
+    for (size_t bucket = 0; bucket < MAX_BITS * BUCKETS_PER_BIT && bucket < zeroBits * BUCKETS_PER_BIT; ++bucket)
+        skippedWavelets += skippedByBreakEven[bucket];
+    return skippedWavelets;
+}
+
+void WaveletZeroTreeStats::AdjustCounts(SymbolCountDict& counts) const
+{
+    auto zeroCount = counts.find(0);
+    if (zeroCount == counts.end())
+        return;
+    // zero's cost with every zero counted, which is close enough to what the table ends up with
+    uint64_t totalCount = 0;
+    for (const auto& count : counts)
+        totalCount += count.second;
+    double zeroBits = std::log2(double(totalCount) / zeroCount->second);
+    size_t skippedWavelets = GetSkippedWavelets(zeroBits);
+    zeroCount->second = (count_t)std::max<int64_t>((int64_t)zeroCount->second - (int64_t)skippedWavelets, 1);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include "WaveletLayerCommon.h"
+#include "RansEncode.h"
+#include "Precision.h"
+
+// Quadtree of "all zero" flags over a wavelet layer
+// a layer's wavelets come in cells of 1-3, one per parent val, and the tree is built over the grid of cells
+// a flag says every wavelet under the node is 0, nodes that aren't are split until they're single cells,
+// so flat areas are written as zeros straight away instead of reading a symbol per wavelet
+// flag probabilities adapt per tree depth, and a layer only uses the tree if it's smaller than the plain wavelets
+class WaveletZeroTree
+{
+public:
+    // one thing read from the rANS stream, flags have the chance of being set out of 1 << PROBABILITY_RES
+    struct Code
+    {
+        bool isFlag;
+        bool flag;
+        prob_t probability;
+        symbol_t wavelet;
+    };
+
+    WaveletZeroTree(WaveletLayerSize size);
+
+    // zero wavelet cost in bits the tree starts paying off at, infinity if it never does
+    // skippedWavelets is set to the zeros it skips when it does
+    double GetBreakEvenBits(const symbol_t* wavelets, size_t& skippedWavelets);
+    // layer's codes in decode order, wavelets under zero flags are left out
+    // the tree is only used if it's flags cost less than zeroBits per wavelet they skip
+    std::vector<Code> Encode(const symbol_t* wavelets, double zeroBits);
+    // reads a whole layer, returns false if the stream runs out first
+    bool Decode(RansState& ransState, std::vector<symbol_t>& wavelets);
+
+private:
+    // flags of every node in decode order, sets zeroCells, where each cell's wavelets start, and what the flags cost
+    std::vector<Code> BuildFlags(const symbol_t* wavelets, std::vector<size_t>& cellStarts, double& flagBits, size_t& skippedWavelets);
+    // wavelets in the cell of parent val (cellX, cellY)
+    uint32_t GetCellWaveletCount(uint32_t cellX, uint32_t cellY) const;
+    // chance of a node at depth being zero, from the nodes seen so far
+    prob_t GetZeroProbability(uint32_t depth) const;
+    // visits the node and the ones under it in decode order, readFlag returns the flag of a node
+    // returns true if the node is zero
+    template<typename ReadFlag>
+    bool VisitNode(uint32_t nodeX, uint32_t nodeY, uint32_t nodeSize, uint32_t depth, bool impliedNonZero, ReadFlag& readFlag);
+
+    static const uint32_t MAX_DEPTH = 32;
+
+    WaveletLayerSize size;
+    uint32_t cellsWidth;
+    uint32_t cellsHeight;
+    // smallest power of 2 covering the cells
+    uint32_t rootSize;
+    std::vector<uint8_t> zeroCells;
+    uint32_t zeroCounts[MAX_DEPTH] = {};
+    uint32_t nodeCounts[MAX_DEPTH] = {};
+};
+
+// zeros the trees would skip, by the zero wavelet cost they pay off at
+// the symbol table has to be counted before the zero cost is known, so this takes them out of the counts afterwards
+class WaveletZeroTreeStats
+{
+public:
+    void Add(double breakEvenBits, size_t skippedWavelets);
+    size_t GetSkippedWavelets(double zeroBits) const;
+    // takes the zeros the trees will skip out of counts of every wavelet
+    void AdjustCounts(SymbolCountDict& counts) const;
+
+private:
+    static const uint32_t BUCKETS_PER_BIT = 16;
+    static const uint32_t MAX_BITS = 32;
+    size_t skippedByBreakEven[MAX_BITS * BUCKETS_PER_BIT] = {};
+};
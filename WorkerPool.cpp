@@ -0,0 +1,118 @@
+#include "WorkerPool.h"
+
+#include <atomic>
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t threadCount)
+    : stopping(false)
+{
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < threadCount; ++i)
+        threads.emplace_back(&WorkerPool::WorkerLoop, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(jobsLock);
+        stopping = true;
+    }
+    jobsAvailable.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void WorkerPool::Submit(std::function<void()> job, bool helpable)
+{
+    {
+        std::lock_guard<std::mutex> guard(jobsLock);
+        if (helpable)
+            jobs.emplace_back(std::move(job));
+        else
+            workerOnlyJobs.emplace_back(std::move(job));
+    }
+    jobsAvailable.notify_one();
+}
+
+bool WorkerPool::RunQueuedJob()
+{
+    std::function<void()> job;
+    {
+        std::lock_guard<std::mutex> guard(jobsLock);
+        if (jobs.empty())
+            return false;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+    }
+    job();
+    return true;
+}
+
+void WorkerPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(jobsLock);
+            jobsAvailable.wait(guard, [this] { return stopping || !jobs.empty() || !workerOnlyJobs.empty(); });
+            if (stopping && jobs.empty() && workerOnlyJobs.empty())
+                return;
+            // helpable jobs first, something is usually blocked on them
+            std::deque<std::function<void()>>& from = jobs.empty() ? workerOnlyJobs : jobs;
+            job = std::move(from.front());
+            from.pop_front();
+        }
+        job();
+    }
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t, size_t)>& job)
+{
+    if (count == 0)
+        return;
+
+    // a few ranges per thread so uneven blocks balance out
+    size_t rangeCount = std::min(count, (threads.size() + 1) * 4);
+    size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+    rangeCount = (count + rangeSize - 1) / rangeSize;
+
+    std::atomic<size_t> remaining(rangeCount);
+    std::mutex doneLock;
+    std::condition_variable done;
+
+    for (size_t range = 0; range < rangeCount; ++range)
+    {
+        size_t start = range * rangeSize;
+        size_t end = std::min(count, start + rangeSize);
+        Submit([&, start, end]()
+        {
+            job(start, end);
+            // decrement and notify under the lock, otherwise the caller can see 0, return and
+            // destroy remaining/doneLock/done while this thread is still using them
+            std::lock_guard<std::mutex> guard(doneLock);
+            if (--remaining == 0)
+                done.notify_all();
+        });
+    }
+
+    // help out instead of idling - this also stops nested ParallelFor calls from deadlocking
+    while (remaining > 0 && RunQueuedJob())
+        ;
+
+    std::unique_lock<std::mutex> guard(doneLock);
+    done.wait(guard, [&] { return remaining == 0; });
+}
+
+size_t WorkerPool::GetThreadCount() const
+{
+    return threads.size();
+}
+
+WorkerPool& WorkerPool::GetShared()
+{
+    static WorkerPool sharedPool;
+    return sharedPool;
+}
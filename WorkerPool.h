@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed-size pool of worker threads, used for decoding blocks in parallel
+class WorkerPool
+{
+public:
+    // 0 threads = one per hardware thread
+    WorkerPool(size_t threadCount = 0);
+    ~WorkerPool();
+
+    // helpable jobs can also be run by threads waiting in RunQueuedJob(), others only ever run on a worker -
+    // anything that runs arbitrary code (coroutine resumes) can't be helpable, the waiting thread could be holding a lock it needs
+    void Submit(std::function<void()> job, bool helpable = true);
+    // splits [0, count) into ranges and runs job(start, end) on each across the pool
+    // blocks until every range is done. The calling thread also does work.
+    void ParallelFor(size_t count, const std::function<void(size_t, size_t)>& job);
+
+    size_t GetThreadCount() const;
+    // runs a single queued helpable job if there is one, returns false if there wasn't one
+    // lets threads that are waiting on pool work help out instead of idling
+    bool RunQueuedJob();
+
+    // pool shared by everything that doesn't provide it's own
+    static WorkerPool& GetShared();
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    // not helpable, see Submit()
+    std::deque<std::function<void()>> workerOnlyJobs;
+    std::mutex jobsLock;
+    std::condition_variable jobsAvailable;
+    bool stopping;
+};